@@ -1,39 +1,90 @@
-#ifndef RBBST_H
-#define RBBST_H
+#ifndef AVLBST_H
+#define AVLBST_H
 
 #include <iostream>
 #include <exception>
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <array>
+#include <iterator>
+#include <stdexcept>
 #include "bst.h"
+#include "work_pool.h"
 
 struct KeyError { };
 
+/**
+* Subtree-size bookkeeping mixed into AVLNode. With OrderStats off this
+* is an empty base and adds nothing to the node; with it on, every node
+* counts the nodes in its own subtree (itself included), which is what
+* rank and select need.
+*/
+template <bool OrderStats>
+class AVLSubtreeSize
+{
+};
+
+template <>
+class AVLSubtreeSize<true>
+{
+public:
+    AVLSubtreeSize();
+
+    size_t getSize() const;
+    void setSize(size_t size);
+
+protected:
+    size_t size_;
+};
+
+/**
+* A new node is a leaf, so its subtree is just itself.
+*/
+inline AVLSubtreeSize<true>::AVLSubtreeSize() :
+    size_(1)
+{
+
+}
+
+/**
+* A getter for the number of nodes in this node's subtree.
+*/
+inline size_t AVLSubtreeSize<true>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the number of nodes in this node's subtree.
+*/
+inline void AVLSubtreeSize<true>::setSize(size_t size)
+{
+    size_ = size;
+}
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+template <typename Key, typename Value, bool OrderStats = false, bool AtomicLinks = false>
+class AVLNode : public NodeBase<Key, Value, AVLNode<Key, Value, OrderStats, AtomicLinks>, AtomicLinks>, public AVLSubtreeSize<OrderStats>
 {
 public:
-    // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    // Constructor.
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, OrderStats, AtomicLinks>* parent);
+    template<typename... Args>
+    AVLNode(std::in_place_t, AVLNode<Key, Value, OrderStats, AtomicLinks>* parent, Args&&... itemArgs);
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // getParent, getLeft, and getRight come from NodeBase and already
+    // return AVLNodes, so nothing needs to be overridden or cast here.
+    // See the NodeBase class in bst.h for more information.
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -47,20 +98,23 @@ protected:
 
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor and setting
-* the color to red since every new node will be red when it is first inserted.
+* the balance to 0 since every new node is a leaf when it is first inserted.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, OrderStats, AtomicLinks> *parent) :
+    NodeBase<Key, Value, AVLNode<Key, Value, OrderStats, AtomicLinks>, AtomicLinks>(key, value, parent), balance_(0)
 {
 
 }
 
 /**
-* A destructor which does nothing.
+* In-place constructor: itemArgs build the key/value pair directly inside
+* the node (see NodeBase). The balance starts at 0 as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, bool OrderStats, bool AtomicLinks>
+template<typename... Args>
+AVLNode<Key, Value, OrderStats, AtomicLinks>::AVLNode(std::in_place_t, AVLNode<Key, Value, OrderStats, AtomicLinks>* parent, Args&&... itemArgs) :
+    NodeBase<Key, Value, AVLNode<Key, Value, OrderStats, AtomicLinks>, AtomicLinks>(std::in_place, parent, std::forward<Args>(itemArgs)...), balance_(0)
 {
 
 }
@@ -68,8 +122,8 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, bool OrderStats, bool AtomicLinks>
+int8_t AVLNode<Key, Value, OrderStats, AtomicLinks>::getBalance() const
 {
     return balance_;
 }
@@ -77,8 +131,8 @@ int8_t AVLNode<Key, Value>::getBalance() const
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, bool OrderStats, bool AtomicLinks>
+void AVLNode<Key, Value, OrderStats, AtomicLinks>::setBalance(int8_t balance)
 {
     balance_ = balance;
 }
@@ -86,138 +140,328 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, bool OrderStats, bool AtomicLinks>
+void AVLNode<Key, Value, OrderStats, AtomicLinks>::updateBalance(int8_t diff)
 {
     balance_ += diff;
 }
 
+
+/*
+  -----------------------------------------------
+  End implementations for the AVLNode class.
+  -----------------------------------------------
+*/
+
+
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A self-balancing AVL tree. The comparator and allocation policy are
+* passed straight through to BinarySearchTree, along with AVLNode as the
+* node type. Insertion itself is inherited; leafFix rebalances after it.
+* With OrderStats set, every node also tracks its subtree size, which
+* makes select(), rank() and countRange() O(log n) at the cost of one
+* extra word per node and a size update per level on insert and remove.
+* See the OrderStatisticsTree alias below. AtomicLinks gives the nodes
+* atomic child links (see NodeBase); only ConcurrentAVLTree sets it.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template <class Key, class Value, class Compare = std::less<Key>, class Alloc = HeapNodeAllocator,
+          bool OrderStats = false, bool AtomicLinks = false>
+class AVLTree : public BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+public:
+    explicit AVLTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    AVLTree(InputIt first, InputIt last, bool sortFirst = false,
+            const Compare& comp = Compare());
+
+    // Order statistics; only available when OrderStats is set.
+    typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator
+    select(size_t index) const;
+    size_t rank(const Key& key) const;
+    size_t countRange(const Key& low, const Key& high) const;
+
+    // Set operations, in place on this tree; other is left unchanged.
+    // unite adds other's items (this tree's value wins on a shared key),
+    // intersect keeps only keys also in other, and subtract drops keys
+    // that are in other. Each is O(m log(n/m + 1)) for sizes m <= n, and
+    // big subproblems run in parallel on WorkPool::shared().
+    void unite(const AVLTree& other);
+    void intersect(const AVLTree& other);
+    void subtract(const AVLTree& other);
+
+    // Moving key ranges between trees. split moves every item whose key
+    // is not before key into above (emptied first); join appends other,
+    // whose keys must all come after this tree's, and leaves other empty.
+    // Both are O(log n). split needs OrderStats, since only subtree sizes
+    // tell it how many items moved without walking them. Nodes change
+    // trees, so both need an allocator that frees nodes one at a time
+    // rather than in bulk.
+    void split(const Key& key, AVLTree& above);
+    void join(AVLTree& other);
+
+    // Both O(1): the tree keeps its height as it changes shape, and
+    // isBalanced only checks that height against the size.
+    virtual bool isBalanced() const;
+    virtual int height() const;
+    // O(n) check of every node's balance, for tests and debugging.
+    bool verifyBalance() const;
+
+    // Range erase in O(log n + k) for k erased items, by cutting the
+    // range out and joining the two sides.
+    using BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::erase;
+    typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator
+    erase(typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator first,
+          typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator last);
+protected:
+    static size_t subtreeSize(AVLNode<Key, Value, OrderStats, AtomicLinks>* node);
+    static void updateSize(AVLNode<Key, Value, OrderStats, AtomicLinks>* node);
+    virtual void removeNode(AVLNode<Key, Value, OrderStats, AtomicLinks>* current);
+    virtual void nodeSwap( AVLNode<Key, Value, OrderStats, AtomicLinks>* n1, AVLNode<Key, Value, OrderStats, AtomicLinks>* n2);
+    //Helper functions
+    virtual void insertFix(AVLNode<Key, Value, OrderStats, AtomicLinks>*parent, AVLNode<Key, Value, OrderStats, AtomicLinks>* current);
+    virtual void removeFix(AVLNode<Key, Value, OrderStats, AtomicLinks>* current, int diff);
+    virtual void rotateRight(AVLNode<Key, Value, OrderStats, AtomicLinks>* current);
+    virtual void rotateLeft(AVLNode<Key, Value, OrderStats, AtomicLinks>* current);
+    virtual void buildFix(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int leftHeight, int rightHeight);
+    virtual void leafFix(AVLNode<Key, Value, OrderStats, AtomicLinks>* leaf);
+    static int verifiedHeight(const AVLNode<Key, Value, OrderStats, AtomicLinks>* node, const AVLNode<Key, Value, OrderStats, AtomicLinks>* parent,
+                              int depth, size_t& count);
+
+    // Join-based building blocks. They work on subtrees detached from any
+    // tree, carrying each subtree's height along (starting from height_)
+    // so that none is ever recomputed, and they never touch root_, so disjoint subtrees can be
+    // worked on from several threads at once. A returned subtree root's
+    // parent pointer is left for the caller to set.
+    static void childHeights(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int height, int& leftHeight, int& rightHeight);
+    static int linkNode(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                        AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight);
+    static AVLNode<Key, Value, OrderStats, AtomicLinks>* joinTrees(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                      AVLNode<Key, Value, OrderStats, AtomicLinks>* middle,
+                                                      AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, OrderStats, AtomicLinks>* joinRight(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                      AVLNode<Key, Value, OrderStats, AtomicLinks>* middle,
+                                                      AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, OrderStats, AtomicLinks>* joinLeft(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                     AVLNode<Key, Value, OrderStats, AtomicLinks>* middle,
+                                                     AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, OrderStats, AtomicLinks>* joinPair(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                     AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, OrderStats, AtomicLinks>* splitLast(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int height,
+                                                      AVLNode<Key, Value, OrderStats, AtomicLinks>*& last, int& restHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* splitTree(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int height, const Key& key,
+                                               AVLNode<Key, Value, OrderStats, AtomicLinks>*& left, int& leftHeight,
+                                               AVLNode<Key, Value, OrderStats, AtomicLinks>*& right, int& rightHeight) const;
+
+    // Set operations, all one divide-and-conquer recursion: split one
+    // tree at the other's root key, recurse on both halves, join.
+    enum SetOperation { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+    struct SetResult
+    {
+        AVLNode<Key, Value, OrderStats, AtomicLinks>* root;
+        int height;
+        size_t matches;                             // keys found in both trees
+        AVLNode<Key, Value, OrderStats, AtomicLinks>* dropped;   // subtrees to free, chained by parent
+        AVLNode<Key, Value, OrderStats, AtomicLinks>* droppedTail;
+    };
+    void setOperation(SetOperation op, const AVLTree& other);
+    SetResult combine(SetOperation op, AVLNode<Key, Value, OrderStats, AtomicLinks>* split, int splitHeight,
+                      AVLNode<Key, Value, OrderStats, AtomicLinks>* exposed, int exposedHeight, bool keepExposed) const;
+    static void drop(SetResult& result, AVLNode<Key, Value, OrderStats, AtomicLinks>* subtree);
+    static void dropAll(SetResult& result, SetResult& from);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* cloneSubtree(const AVLNode<Key, Value, OrderStats, AtomicLinks>* node);
+
+    // Subproblems whose trees are both at least this tall are forked onto
+    // the work pool; anything smaller is not worth a task.
+    static const int PARALLEL_GRAIN_HEIGHT = 12;
+};
+
+/**
+* An AVL tree that maintains subtree sizes, for rank/select queries.
+*/
+template <class Key, class Value, class Compare = std::less<Key>, class Alloc = HeapNodeAllocator>
+using OrderStatisticsTree = AVLTree<Key, Value, Compare, Alloc, true>;
+
+/**
+* Default constructor for an empty AVL tree ordered by comp.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >(comp)
+{
+
 }
 
 /**
-* Overridden for the same reasons as above.
+* Range constructor that bulk loads a balanced tree ordered by comp in
+* O(n). The load happens here rather than in the BinarySearchTree constructor so that
+* buildFix dispatches to the AVL version and sets the balances.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+template<typename InputIt>
+AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::AVLTree(InputIt first, InputIt last, bool sortFirst,
+                                                         const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >(comp)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    this->assign(first, last, sortFirst);
 }
 
 /**
-* Overridden for the same reasons as above.
+* Sets the balance of a node created by a bulk load from the heights of
+* its two freshly built subtrees.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::buildFix(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int leftHeight, int rightHeight)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    node->setBalance(rightHeight - leftHeight);
+    if constexpr (OrderStats){
+      updateSize(node);
+    }
 }
 
+/**
+* Returns an iterator to the item at position index in key order (0 is
+* the smallest), or end() if index >= size(). O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator
+AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::select(size_t index) const
+{
+    static_assert(OrderStats, "select() needs an AVLTree with OrderStats set");
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* current = this->root_;
+    while(current != nullptr){
+      size_t leftSize = subtreeSize(current->getLeft());
+      if(index < leftSize){
+        current = current->getLeft();
+      }
+      else if(index == leftSize){
+        break;
+      }
+      else{
+        index -= leftSize + 1;
+        current = current->getRight();
+      }
+    }
+    return this->iteratorAt(current);
+}
 
-/*
-  -----------------------------------------------
-  End implementations for the AVLNode class.
-  -----------------------------------------------
+/**
+* Returns the number of keys that order before key (key itself need not
+* be in the tree). O(log n).
 */
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+size_t AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::rank(const Key& key) const
+{
+    static_assert(OrderStats, "rank() needs an AVLTree with OrderStats set");
+    size_t before = 0;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* current = this->root_;
+    while(current != nullptr){
+      if(this->comp_(current->getKey(), key)){
+        //current and its whole left subtree come before key
+        before += subtreeSize(current->getLeft()) + 1;
+        current = current->getRight();
+      }
+      else{
+        current = current->getLeft();
+      }
+    }
+    return before;
+}
 
+/**
+* Returns how many keys lie in [low, high), in O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+size_t AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::countRange(const Key& low, const Key& high) const
+{
+    static_assert(OrderStats, "countRange() needs an AVLTree with OrderStats set");
+    if(!this->comp_(low, high)){
+      return 0;
+    }
+    return rank(high) - rank(low);
+}
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* Size of the subtree at node, 0 for an empty one.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+size_t AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::subtreeSize(AVLNode<Key, Value, OrderStats, AtomicLinks>* node)
 {
-public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
-protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
-    //Helper functions
-    virtual void insertFix(AVLNode<Key,Value>*parent, AVLNode<Key,Value>* current);
-    virtual void removeFix(AVLNode<Key,Value>* current, int diff);
-    virtual void rotateRight(AVLNode<Key,Value>* current);
-    virtual void rotateLeft(AVLNode<Key,Value>* current);
+    return (node == nullptr) ? 0 : node->getSize();
+}
 
-};
+/**
+* Recomputes node's subtree size from its children, which must already
+* be correct.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::updateSize(AVLNode<Key, Value, OrderStats, AtomicLinks>* node)
+{
+    node->setSize(subtreeSize(node->getLeft()) + subtreeSize(node->getRight()) + 1);
+}
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+/**
+* Called by BinarySearchTree::insert once a new leaf is linked in; starts
+* the rebalancing from the leaf's parent.
+* Recall: If key is already in the tree, insert just overwrites the
+* value and no new leaf is made, so there is nothing to fix.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::leafFix(AVLNode<Key, Value, OrderStats, AtomicLinks>* leaf)
 {
-    AVLNode<Key,Value>* current = (AVLNode<Key,Value>*)this->root_;
-    if(current == nullptr){
-      current = new AVLNode<Key, Value> (new_item.first, new_item.second, nullptr);
-      this->root_ = current;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* parent = leaf->getParent();
+    //Every ancestor gained a node; count it before any rotation, which
+    //recomputes sizes from the children
+    if constexpr (OrderStats){
+      for(AVLNode<Key, Value, OrderStats, AtomicLinks>* up = parent; up != nullptr; up = up->getParent()){
+        up->setSize(up->getSize() + 1);
+      }
+    }
+    //the first node
+    if(parent == nullptr){
+      this->height_ = 1;
+      return;
+    }
+    //Insertion at the left
+    if(parent->getLeft() == leaf){
+      //simple case, no rebalancing needed
+      if(parent->getBalance() == 1){
+        parent->setBalance(0);
+      }
+      //Rebalance
+      else if(parent->getBalance() == 0){
+        parent->setBalance(-1);
+        insertFix(parent, leaf);
+      }
     }
-  
+    //Insertion at the right
     else{
-        while(current != nullptr){
-            if(current->getKey() > new_item.first){
-              //Insertion at the left
-                if(current->getLeft() == nullptr){
-                    AVLNode<Key,Value>* inserted = new AVLNode<Key, Value> (new_item.first, new_item.second, current);
-                    current->setLeft(inserted);
-                    //simple case, no rebalancing needed
-                    if(current->getBalance() == 1){ 
-                      current->setBalance(0);
-                    }
-                    //Rebalance
-                    else if(current->getBalance() == 0){
-                      current->setBalance(-1);
-                      insertFix(current, inserted);                    
-                      }
-                    break;
-                }
-                //Keep travering left 
-                else{
-                    current = current->getLeft();
-                }
-            }
-            else if(current->getKey() < new_item.first){
-              //Insertion at the right
-                if(current->getRight() == nullptr){
-                    AVLNode<Key,Value> *temp = new AVLNode<Key,Value>(new_item.first,new_item.second, current);
-                    current->setRight(temp);
-                    //No rebalancing needed
-                    if(current->getBalance() == -1){
-                      current->setBalance(0);
-                    }
-                    //Balancing is needed
-                    else if(current->getBalance() == 0){
-                      current->setBalance(1);
-                      insertFix(current, temp);                    
-                      }
-                    break;
-                }
-                //Keep traversing to the right
-                else{
-                    current = current->getRight();
-                }
-            }
-            else{
-                current->setValue(new_item.second);
-                break;
-            }
-        }
+      //No rebalancing needed
+      if(parent->getBalance() == -1){
+        parent->setBalance(0);
+      }
+      //Balancing is needed
+      else if(parent->getBalance() == 0){
+        parent->setBalance(1);
+        insertFix(parent, leaf);
+      }
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix (AVLNode<Key,Value>*parent, AVLNode<Key,Value>* current)
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::insertFix (AVLNode<Key, Value, OrderStats, AtomicLinks>*parent, AVLNode<Key, Value, OrderStats, AtomicLinks>* current)
 {
+  TreeStats::FixScope stats(TreeStats::INSERT_FIX);
   //Following psuedocode from CSCI104 slides
-  if(parent == nullptr || parent->getParent() == nullptr){
+  if(parent == nullptr){
+    return;
+  }
+  //parent is the root, and it just got taller
+  if(parent->getParent() == nullptr){
+    ++this->height_;
     return;
   }
 
-  AVLNode<Key,Value>*grandp = parent->getParent();//grandparent
+  AVLNode<Key, Value, OrderStats, AtomicLinks>*grandp = parent->getParent();//grandparent
 
   //parent is left of grandparent
   if(grandp->getLeft() == parent){
@@ -236,7 +480,7 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key,Value>*parent, AVLNode<Key,Valu
         return;
       }
       //zig zag 
-      else if(parent->getLeft() == nullptr && parent->getRight() == current){
+      else if(parent->getRight() == current){
         rotateLeft(parent);
         rotateRight(grandp);
         //3a
@@ -278,7 +522,7 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key,Value>*parent, AVLNode<Key,Valu
           grandp->setBalance(0);
         }
         //zig zag 
-        else if(parent->getRight() == nullptr && parent->getLeft() == current){
+        else if(parent->getLeft() == current){
           rotateRight(parent);
           rotateLeft(grandp);
            //3a
@@ -303,10 +547,11 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key,Value>*parent, AVLNode<Key,Valu
       }
     }
 }
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* current){
-  AVLNode<Key,Value>*parent = current->getParent();
-  AVLNode<Key,Value>* LC = current->getLeft();
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::rotateRight(AVLNode<Key, Value, OrderStats, AtomicLinks>* current){
+  TreeStats::countRotation();
+  AVLNode<Key, Value, OrderStats, AtomicLinks>*parent = current->getParent();
+  AVLNode<Key, Value, OrderStats, AtomicLinks>* LC = current->getLeft();
   //has a parent 
   if(parent != nullptr){
     if(parent->getLeft() == current){
@@ -321,19 +566,25 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* current){
   }
   LC->setParent(parent);
   current->setParent(LC);
-  AVLNode<Key,Value>* RC = LC->getRight();
+  AVLNode<Key, Value, OrderStats, AtomicLinks>* RC = LC->getRight();
   if(RC != nullptr){
     RC->setParent(current);
   }
   //readjust pointers 
   current->setLeft(RC);
   LC->setRight(current);
+  //current is now below LC, so it is resized first
+  if constexpr (OrderStats){
+    updateSize(current);
+    updateSize(LC);
+  }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* current){
-  AVLNode<Key,Value>* parent = current->getParent();
-  AVLNode<Key,Value>* RC = current->getRight();
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::rotateLeft(AVLNode<Key, Value, OrderStats, AtomicLinks>* current){
+  TreeStats::countRotation();
+  AVLNode<Key, Value, OrderStats, AtomicLinks>* parent = current->getParent();
+  AVLNode<Key, Value, OrderStats, AtomicLinks>* RC = current->getRight();
   //has parent
   if(parent != nullptr){
     if(parent->getRight() == current){
@@ -348,45 +599,51 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* current){
   }
   RC->setParent(parent);
   current->setParent(RC);
-  AVLNode<Key,Value>* LC = RC->getLeft();
+  AVLNode<Key, Value, OrderStats, AtomicLinks>* LC = RC->getLeft();
   if(LC != nullptr){
     LC->setParent(current);
   }
   //readjust pointers 
   current->setRight(LC);
   RC->setLeft(current);
+  if constexpr (OrderStats){
+    updateSize(current);
+    updateSize(RC);
+  }
 }
 
- template<class Key, class Value>
- void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* current, int diff){
+/**
+ * Rebalances after a removal. diff is the change to current's balance:
+ * +1 when its left subtree got shorter, -1 when its right subtree did.
+ */
+ template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+ void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::removeFix(AVLNode<Key, Value, OrderStats, AtomicLinks>* current, int diff){
+   TreeStats::FixScope stats(TreeStats::REMOVE_FIX);
    //Following pseudocode from CSCI104 slides
-   int nextdiff =0;
+   //the shrinking got past the root, so the whole tree is a level shorter
    if(current == nullptr){
+     --this->height_;
      return;
    }
-   if(current->getParent() == nullptr){
-     return;
-   }
-   AVLNode<Key,Value>* parent = current->getParent();
-   //left child +1
-   if(parent->getLeft() == current){
-     nextdiff +=1;
-   }
-  //right child, -1
-   else if(parent->getRight() == current){
-     nextdiff+=-1;
+   //work out the parent's diff before any rotation moves current
+   AVLNode<Key, Value, OrderStats, AtomicLinks>* parent = current->getParent();
+   int nextdiff = 0;
+   if(parent != nullptr){
+     nextdiff = (parent->getLeft() == current) ? 1 : -1;
    }
+
    //assume diff is =-1
    if(diff == -1){
      //Case1
      if((current->getBalance() + diff) == -2){
       //make left child variable 
-      AVLNode<Key,Value>* leftC = current->getLeft();
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* leftC = current->getLeft();
       //1a
       if(leftC->getBalance() == -1){
         rotateRight(current);
         current->setBalance(0);
         leftC->setBalance(0);
+        removeFix(parent,nextdiff);
       }
       //1b
       else if(leftC->getBalance() == 0){
@@ -396,7 +653,7 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* current){
       }
       //1c
       else if(leftC->getBalance() == 1){
-        AVLNode <Key,Value>* grandC = leftC->getRight();
+        AVLNode<Key, Value, OrderStats, AtomicLinks>* grandC = leftC->getRight();
         rotateLeft(leftC);
         rotateRight(current);
         if(grandC->getBalance() == 1){
@@ -430,42 +687,53 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* current){
 
     //assume diff is =1
     else if(diff == 1){
+      //Case 1
       if((current->getBalance()+diff) == 2){
-        AVLNode<Key,Value>* rightC = current->getRight();
-      //1a
+        AVLNode<Key, Value, OrderStats, AtomicLinks>* rightC = current->getRight();
+        //1a
         if(rightC->getBalance() == 1){
           rotateLeft(current);
           current->setBalance(0);
           rightC->setBalance(0);
+          removeFix(parent,nextdiff);
         }
-      //1b
-      else if(rightC->getBalance() == 0){
-        rotateLeft(current);
-        current->setBalance(1);
-        rightC->setBalance(-1);
-      }
-      //1c
-      else if(rightC->getBalance() == -1){//
-        AVLNode <Key,Value>* grandC = rightC->getLeft();
-        rotateRight(rightC);
-        rotateLeft(current);
-        if(grandC->getBalance() == 1){
-          current->setBalance(0);
+        //1b
+        else if(rightC->getBalance() == 0){
+          rotateLeft(current);
+          current->setBalance(1);
           rightC->setBalance(-1);
-          grandC->setBalance(0);
         }
-        else if(grandC->getBalance() == 0){
-          current->setBalance(0);
-          rightC->setBalance(0);
-          grandC->setBalance(0);
-        }
-        else if(grandC->getBalance() == -1){
-          current->setBalance(1);
-          rightC->setBalance(0);
-          grandC->setBalance(0);
+        //1c
+        else if(rightC->getBalance() == -1){
+          AVLNode<Key, Value, OrderStats, AtomicLinks>* grandC = rightC->getLeft();
+          rotateRight(rightC);
+          rotateLeft(current);
+          if(grandC->getBalance() == -1){
+            current->setBalance(0);
+            rightC->setBalance(1);
+            grandC->setBalance(0);
+          }
+          else if(grandC->getBalance() == 0){
+            current->setBalance(0);
+            rightC->setBalance(0);
+            grandC->setBalance(0);
+          }
+          else if(grandC->getBalance() == 1){
+            current->setBalance(-1);
+            rightC->setBalance(0);
+            grandC->setBalance(0);
+          }
+          removeFix(parent,nextdiff);
         }
-        removeFix(parent,nextdiff);
       }
+      //Case 2
+      else if((current->getBalance())+ diff == 1){
+        current->setBalance(1);
+      }
+      //Case 3
+      else if((current->getBalance())+ diff == 0){
+        current->setBalance(0);
+        removeFix(parent, nextdiff);
       }
     }
  }
@@ -473,113 +741,756 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* current){
 // /*
 //  * Recall: The writeup specifies that if a node has 2 children you
 //  * should swap with the predecessor and then remove.
+//  * BinarySearchTree::remove and erase find the node and call this.
 //  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::removeNode(AVLNode<Key, Value, OrderStats, AtomicLinks>* current)
 {
-     AVLNode<Key, Value>* current = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
-    //empty tree
-    if(current == nullptr){
-        return;
-    }
+    this->beforeUnlink(current);
     //two children 
     if(current->getLeft() != nullptr && current->getRight()!= nullptr){
-      nodeSwap(current, static_cast<AVLNode<Key,Value>*>(this->predecessor(current)));
-    }
-    
-    //leaf node 
-    if(current->getLeft() == nullptr && current->getRight() == nullptr){
-      //leaf child is the root!
-      if(current->getParent() == nullptr){
-        this->root_ = nullptr;
-        delete current;
-        return;
+      nodeSwap(current, this->predecessor(current));
+    }
+
+    //current now has at most one child, which takes its place
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* child = (current->getLeft() != nullptr) ? current->getLeft() : current->getRight();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* parent = current->getParent();
+    int diff = 0;
+    if(child != nullptr){
+      child->setParent(parent);
+    }
+    //removing the root
+    if(parent == nullptr){
+      this->root_ = child;
+    }
+    //left side of parent got shorter
+    else if(parent->getLeft() == current){
+      parent->setLeft(child);
+      diff = 1;
+    }
+    //right side of parent got shorter
+    else{
+      parent->setRight(child);
+      diff = -1;
+    }
+    this->destroyNode(current);
+    if constexpr (OrderStats){
+      for(AVLNode<Key, Value, OrderStats, AtomicLinks>* up = parent; up != nullptr; up = up->getParent()){
+        up->setSize(up->getSize() - 1);
       }
-      //left lead node
-      else if(current->getParent()->getLeft() == current){
-        current->getParent()->setLeft(nullptr);
+    }
+    removeFix(parent, diff);
+}
+
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::nodeSwap( AVLNode<Key, Value, OrderStats, AtomicLinks>* n1, AVLNode<Key, Value, OrderStats, AtomicLinks>* n2)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::nodeSwap(n1, n2);
+    int8_t tempB = n1->getBalance();
+    n1->setBalance(n2->getBalance());
+    n2->setBalance(tempB);
+    //sizes describe positions in the tree, so they swap too
+    if constexpr (OrderStats){
+      size_t tempS = n1->getSize();
+      n1->setSize(n2->getSize());
+      n2->setSize(tempS);
+    }
+}
+
+
+/**
+* Adds every item of other that this tree lacks. Where both trees hold a
+* key, this tree's value is kept.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::unite(const AVLTree& other)
+{
+    if(&other != this){
+      setOperation(SET_UNION, other);
+    }
+}
+
+/**
+* Removes every item whose key is not in other.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::intersect(const AVLTree& other)
+{
+    if(&other != this){
+      setOperation(SET_INTERSECTION, other);
+    }
+}
+
+/**
+* Removes every item whose key is in other.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::subtract(const AVLTree& other)
+{
+    if(&other == this){
+      this->clear();
+      return;
+    }
+    setOperation(SET_DIFFERENCE, other);
+}
+
+/**
+* Cuts the tree at key in O(log n): above receives every item whose key
+* is not before key, and this tree keeps the rest. The size of above is
+* read off its root's subtree size, which is why split needs OrderStats;
+* without it, finding the sizes means walking one of the halves.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::split(const Key& key, AVLTree& above)
+{
+    static_assert(OrderStats, "split() needs an AVLTree with OrderStats set");
+    static_assert(!Alloc::releasesInBulk, "split moves nodes between trees, so the allocator must free nodes one at a time");
+    if(&above == this){
+      throw std::invalid_argument("split: above must be a different tree");
+    }
+    above.clear();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* below;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* upper;
+    int belowHeight, upperHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* match = splitTree(this->root_, this->height_, key,
+                                                       below, belowHeight, upper, upperHeight);
+    if(match != nullptr){
+      //key itself goes above, as its smallest item
+      upper = joinTrees(nullptr, 0, match, upper, upperHeight, upperHeight);
+    }
+    if(below != nullptr){
+      below->setParent(nullptr);
+    }
+    if(upper != nullptr){
+      upper->setParent(nullptr);
+    }
+
+    size_t aboveSize = subtreeSize(upper);
+
+    above.root_ = upper;
+    above.size_ = aboveSize;
+    above.height_ = upperHeight;
+    above.rightmost_ = (upper != nullptr) ? this->rightmost_ : nullptr;
+    this->root_ = below;
+    this->size_ -= aboveSize;
+    this->height_ = belowHeight;
+    this->rightmost_ = below;
+    while(this->rightmost_ != nullptr && this->rightmost_->getRight() != nullptr){
+      this->rightmost_ = this->rightmost_->getRight();
+    }
+}
+
+/**
+* Appends other's items to this tree in O(log n). Every key in other
+* must come after every key here; if not, std::invalid_argument is thrown
+* and neither tree changes.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::join(AVLTree& other)
+{
+    static_assert(!Alloc::releasesInBulk, "join moves nodes between trees, so the allocator must free nodes one at a time");
+    if(&other == this || other.root_ == nullptr){
+      return;
+    }
+    if(this->root_ == nullptr){
+      this->root_ = other.root_;
+      this->height_ = other.height_;
+    }
+    else{
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* first = other.root_;
+      while(first->getLeft() != nullptr){
+        first = first->getLeft();
       }
-      //right leaf node
-      else if(current->getParent()->getRight() == current){
-        current->getParent()->setRight(nullptr);
+      if(!this->comp_(this->rightmost_->getKey(), first->getKey())){
+        throw std::invalid_argument("join: keys of the joined tree must all come after this tree's");
       }
-      delete current;
-      return;
+      this->root_ = joinPair(this->root_, this->height_, other.root_, other.height_, this->height_);
+      this->root_->setParent(nullptr);
     }
+    this->size_ += other.size_;
+    this->rightmost_ = other.rightmost_;
+    other.root_ = nullptr;
+    other.size_ = 0;
+    other.height_ = 0;
+    other.rightmost_ = nullptr;
+}
 
-    //if current has one right lead child 
-    else if(current->getRight() != nullptr && current->getLeft() == nullptr){
-      AVLNode <Key, Value>* rightC = current->getRight();
-      AVLNode <Key, Value>* parent = current->getParent();
+/**
+* A sanity check, in O(1), that height_ is no more than an AVL tree of
+* size_ nodes can have: the smallest AVL tree of height h has
+* F(h + 2) - 1 nodes, F being the Fibonacci numbers. The rebalancing
+* always keeps the tree within that bound, but so would plenty of trees
+* whose balances are wrong; verifyBalance checks every node.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+bool AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::isBalanced() const
+{
+    static const std::array<size_t, BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::MAX_BALANCED_HEIGHT + 1>
+        minimumSize = []{
+          std::array<size_t, BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::MAX_BALANCED_HEIGHT + 1> sizes;
+          sizes[0] = 0;
+          sizes[1] = 1;
+          for(size_t h = 2; h < sizes.size(); ++h){
+            //saturate once the sizes no longer fit
+            size_t grown = sizes[h - 1] + sizes[h - 2] + 1;
+            sizes[h] = (grown < sizes[h - 1]) ? SIZE_MAX : grown;
+          }
+          return sizes;
+        }();
+    if(this->height_ < 0 || this->height_ >= (int)minimumSize.size()){
+      return false;
+    }
+    return this->size_ >= minimumSize[this->height_];
+}
 
-      //casse that it is the root 
-      if(current == this->root_){
-        current->setRight(nullptr);
-        rightC->setParent(nullptr);
-        this->root_ = rightC;
-        delete current;
-        return;
+/**
+* Returns true iff every node's stored balance is the difference of its
+* subtrees' recomputed heights and lies in [-1, 1], the parent links
+* match the child links, and height_ and size_ (and, with OrderStats,
+* every subtree size) agree with the tree. Walks the whole tree, so it
+* is meant for tests and debugging rather than for asserting on a hot
+* path.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+bool AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::verifyBalance() const
+{
+    size_t count = 0;
+    int height = verifiedHeight(this->root_, nullptr, 0, count);
+    return height == this->height_ && count == this->size_;
+}
+
+/**
+* Returns the height of the subtree at node if verifyBalance's checks
+* hold throughout it, or -1 if one fails, and adds its node count to
+* count. depth is node's distance from the root; as in calculateHeight,
+* a path longer than MAX_BALANCED_HEIGHT already fails, which bounds the
+* recursion.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+int AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::verifiedHeight(const AVLNode<Key, Value, OrderStats, AtomicLinks>* node, const AVLNode<Key, Value, OrderStats, AtomicLinks>* parent,
+                                                                    int depth, size_t& count)
+{
+    if(node == nullptr){
+      return 0;
+    }
+    if(depth >= BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::MAX_BALANCED_HEIGHT
+       || node->getParent() != parent){
+      return -1;
+    }
+    size_t before = count;
+    int left = verifiedHeight(node->getLeft(), node, depth + 1, count);
+    int right = (left < 0) ? -1 : verifiedHeight(node->getRight(), node, depth + 1, count);
+    if(right < 0 || node->getBalance() != right - left || std::abs(right - left) > 1){
+      return -1;
+    }
+    ++count;
+    if constexpr (OrderStats){
+      if(node->getSize() != count - before){
+        return -1;
       }
-      //it is a left child of a parent 
-      else if(current->getParent()->getLeft() == current){
-        parent->setLeft(rightC);
-        rightC->setParent(parent);
-        current->setParent(nullptr);
-        current->setRight(nullptr);
-        delete current;
-        return;
+    }
+    return std::max(left, right) + 1;
+}
+
+/**
+* Returns the number of levels in the tree (0 when empty) in O(1).
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+int AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::height() const
+{
+    return this->height_;
+}
+
+/**
+* Erases [first, last) by splitting the tree at first and at last,
+* joining the outer pieces back together and freeing the middle one.
+* Returns last, which stays valid.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator
+AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::erase(typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator first,
+                                                       typename BinarySearchTree<Key, Value, Compare, Alloc, AVLNode<Key, Value, OrderStats, AtomicLinks> >::iterator last)
+{
+    if(first == last){
+      return last;
+    }
+    if(first == this->begin() && last == this->end()){
+      this->clear();
+      return last;
+    }
+    size_t count = std::distance(first, last);
+
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* below;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* rest;
+    int belowHeight, restHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* firstNode = splitTree(this->root_, this->height_, first->first,
+                                                           below, belowHeight, rest, restHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* doomed = rest;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* kept = nullptr;
+    int keptHeight = 0;
+    if(last != this->end()){
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* after;
+      int doomedHeight, afterHeight;
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* lastNode = splitTree(rest, restHeight, last->first,
+                                                            doomed, doomedHeight, after, afterHeight);
+      kept = joinTrees(nullptr, 0, lastNode, after, afterHeight, keptHeight);
+    }
+    this->root_ = joinPair(below, belowHeight, kept, keptHeight, this->height_);
+    if(this->root_ != nullptr){
+      this->root_->setParent(nullptr);
+    }
+    this->size_ -= count;
+    if(last == this->end()){
+      this->rightmost_ = this->root_;
+      while(this->rightmost_ != nullptr && this->rightmost_->getRight() != nullptr){
+        this->rightmost_ = this->rightmost_->getRight();
       }
-      //node is right child of a parent
-      else if(current->getParent()->getRight() == current){
-        parent->setRight(rightC);
-        rightC->setParent(parent);
-        current->setParent(nullptr);
-        current->setLeft(nullptr);
-        delete current;
-        return;
+    }
+    this->destroyNode(firstNode);
+    this->deleteTree(doomed);
+    return last;
+}
+
+/**
+* Runs one set operation over the whole tree, then frees what it dropped
+* and fixes up the size and rightmost node.
+* Recall: The recursion splits the tree it works on and only reads the
+* one it exposes, so intersect and subtract work straight on other. A
+* union has to link the exposed tree's nodes in, so other is first copied
+* with this tree's allocator, and the recursion splits the bigger of the
+* two trees, which is what keeps it work-efficient. Nodes are only made
+* and freed here, outside the recursion, because allocation policies are
+* not thread-safe. Compare must not throw.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::setOperation(SetOperation op, const AVLTree& other)
+{
+    int height = this->height_;
+    int otherHeight = other.height_;
+    SetResult result;
+    size_t size = 0;
+    if(op == SET_UNION){
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* copy = cloneSubtree(other.root_);
+      if(other.size_ <= this->size_){
+        result = combine(op, this->root_, height, copy, otherHeight, false);
+      }
+      else{
+        result = combine(op, copy, otherHeight, this->root_, height, true);
+      }
+      size = this->size_ + other.size_ - result.matches;
+    }
+    else{
+      result = combine(op, this->root_, height, other.root_, otherHeight, false);
+      size = (op == SET_INTERSECTION) ? result.matches : this->size_ - result.matches;
+    }
+
+    this->root_ = result.root;
+    this->size_ = size;
+    this->height_ = result.height;
+    this->rightmost_ = result.root;
+    if(result.root != nullptr){
+      result.root->setParent(nullptr);
+      while(this->rightmost_->getRight() != nullptr){
+        this->rightmost_ = this->rightmost_->getRight();
+      }
+    }
+    while(result.dropped != nullptr){
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* next = result.dropped->getParent();
+      this->deleteTree(result.dropped);
+      result.dropped = next;
+    }
+}
+
+/**
+* The set operation op on two subtrees: split is taken apart, exposed
+* only read unless op is a union, and keepExposed says whose node stays
+* when a key is in both (for a union; the others always keep split's).
+* The two halves are independent, so big ones are forked onto the pool.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+typename AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::SetResult
+AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::combine(SetOperation op, AVLNode<Key, Value, OrderStats, AtomicLinks>* split, int splitHeight,
+                                                         AVLNode<Key, Value, OrderStats, AtomicLinks>* exposed, int exposedHeight, bool keepExposed) const
+{
+    SetResult result = { nullptr, 0, 0, nullptr, nullptr };
+    if(exposed == nullptr){
+      if(op == SET_INTERSECTION){
+        if(split != nullptr){
+          drop(result, split);
+        }
+      }
+      else{
+        result.root = split;
+        result.height = splitHeight;
+      }
+      return result;
+    }
+    if(split == nullptr){
+      if(op == SET_UNION){
+        result.root = exposed;
+        result.height = exposedHeight;
+      }
+      return result;
+    }
+
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* splitLeft;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* splitRight;
+    int splitLeftHeight, splitRightHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* match = splitTree(split, splitHeight, exposed->getKey(),
+                                                       splitLeft, splitLeftHeight, splitRight, splitRightHeight);
+    int exposedLeftHeight, exposedRightHeight;
+    childHeights(exposed, exposedHeight, exposedLeftHeight, exposedRightHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* exposedLeft = exposed->getLeft();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* exposedRight = exposed->getRight();
+
+    SetResult left, right;
+    auto doLeft = [&](){
+      left = combine(op, splitLeft, splitLeftHeight, exposedLeft, exposedLeftHeight, keepExposed);
+    };
+    auto doRight = [&](){
+      right = combine(op, splitRight, splitRightHeight, exposedRight, exposedRightHeight, keepExposed);
+    };
+    if(std::min(splitHeight, exposedHeight) >= PARALLEL_GRAIN_HEIGHT){
+      WorkPool::shared().invoke(doLeft, doRight);
+    }
+    else{
+      doLeft();
+      doRight();
+    }
+    result.matches = left.matches + right.matches + ((match != nullptr) ? 1 : 0);
+    dropAll(result, left);
+    dropAll(result, right);
+
+    //Pick the node, if any, that goes between the two halves
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* middle = nullptr;
+    if(op == SET_UNION){
+      middle = exposed;
+      if(match != nullptr && !keepExposed){
+        middle = match;
+        match = exposed;
+      }
+      if(match != nullptr){
+        match->setLeft(nullptr);
+        match->setRight(nullptr);
+        drop(result, match);
       }
     }
+    else if(op == SET_INTERSECTION){
+      middle = match;
+    }
+    else if(match != nullptr){
+      drop(result, match);
+    }
+
+    if(middle != nullptr){
+      result.root = joinTrees(left.root, left.height, middle, right.root, right.height, result.height);
+    }
+    else{
+      result.root = joinPair(left.root, left.height, right.root, right.height, result.height);
+    }
+    return result;
+}
 
-// current has one left child 
-  else if(current->getRight() == nullptr && current->getLeft() != nullptr){
-    AVLNode <Key, Value>* leftC = current->getLeft();
-    AVLNode <Key, Value>* parent = current->getParent();
-    //root to be removed has a child 
-    if(current == this->root_){
-      current->setLeft(nullptr);
-      leftC->setParent(nullptr);
-      this->root_ = leftC;
-      delete current;
+/**
+* Adds subtree to the ones result has dropped.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::drop(SetResult& result, AVLNode<Key, Value, OrderStats, AtomicLinks>* subtree)
+{
+    subtree->setParent(result.dropped);
+    result.dropped = subtree;
+    if(result.droppedTail == nullptr){
+      result.droppedTail = subtree;
+    }
+}
+
+/**
+* Moves every subtree from has dropped onto result's list.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::dropAll(SetResult& result, SetResult& from)
+{
+    if(from.dropped == nullptr){
       return;
+    }
+    from.droppedTail->setParent(result.dropped);
+    result.dropped = from.dropped;
+    if(result.droppedTail == nullptr){
+      result.droppedTail = from.droppedTail;
+    }
+    from.dropped = nullptr;
+    from.droppedTail = nullptr;
+}
+
+/**
+* Copies node's subtree, shape and balances included, into nodes from
+* this tree's allocator.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::cloneSubtree(const AVLNode<Key, Value, OrderStats, AtomicLinks>* node)
+{
+    if(node == nullptr){
+      return nullptr;
+    }
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* copy = this->createNode(nullptr, node->getItem());
+    copy->setBalance(node->getBalance());
+    if constexpr (OrderStats){
+      copy->setSize(node->getSize());
+    }
+    try{
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* left = cloneSubtree(node->getLeft());
+      copy->setLeft(left);
+      if(left != nullptr){
+        left->setParent(copy);
       }
-      //is left of its parent 
-      else if(current->getParent()->getLeft() == current){
-        parent->setLeft(leftC);
-        leftC->setParent(parent);
-        current->setParent(nullptr);
-        current->setLeft(nullptr);
-        delete current;
-        return;
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* right = cloneSubtree(node->getRight());
+      copy->setRight(right);
+      if(right != nullptr){
+        right->setParent(copy);
       }
-      //is right of its parent 
-      else if(current->getParent()->getRight() == current){
-        parent->setRight(leftC);
-        leftC->setParent(parent);
-        current->setParent(nullptr);
-        current->setRight(nullptr);
-        delete current;
-        return;
     }
-  }
+    catch(...){
+      this->deleteTree(copy);
+      throw;
+    }
+    return copy;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Works out the heights of node's children from its own height and
+* balance.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+void AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::childHeights(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int height, int& leftHeight, int& rightHeight)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int8_t tempB = n1->getBalance();
-    n1->setBalance(n2->getBalance());
-    n2->setBalance(tempB);
+    int balance = node->getBalance();
+    leftHeight = (balance > 0) ? height - 1 - balance : height - 1;
+    rightHeight = (balance < 0) ? height - 1 + balance : height - 1;
+}
+
+/**
+* Makes left and right node's children and sets node's balance (and
+* size) to match. left and right must differ in height by at most one.
+* Returns node's height.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+int AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::linkNode(AVLNode<Key, Value, OrderStats, AtomicLinks>* node,
+                                                             AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                             AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight)
+{
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != nullptr){
+      left->setParent(node);
+    }
+    if(right != nullptr){
+      right->setParent(node);
+    }
+    node->setBalance(rightHeight - leftHeight);
+    if constexpr (OrderStats){
+      updateSize(node);
+    }
+    return std::max(leftHeight, rightHeight) + 1;
+}
+
+/**
+* Joins left, middle and right, where every key of left is before
+* middle's and every key of right after it, into one balanced subtree.
+* O(|leftHeight - rightHeight| + 1). height is set to the result's height.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::joinTrees(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>* middle,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height)
+{
+    if(leftHeight > rightHeight + 1){
+      return joinRight(left, leftHeight, middle, right, rightHeight, height);
+    }
+    if(rightHeight > leftHeight + 1){
+      return joinLeft(left, leftHeight, middle, right, rightHeight, height);
+    }
+    height = linkNode(middle, left, leftHeight, right, rightHeight);
+    return middle;
+}
+
+/**
+* joinTrees when left is the taller: walk down left's right spine to a
+* subtree about as tall as right, hang middle there, and rotate on the way
+* back up wherever the spine became too tall.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::joinRight(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>* middle,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height)
+{
+    int outerHeight, innerHeight;
+    childHeights(left, leftHeight, outerHeight, innerHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* outer = left->getLeft();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* inner = left->getRight();
+
+    if(innerHeight <= rightHeight + 1){
+      int joinedHeight = linkNode(middle, inner, innerHeight, right, rightHeight);
+      if(joinedHeight <= outerHeight + 1){
+        height = linkNode(left, outer, outerHeight, middle, joinedHeight);
+        return left;
+      }
+      //middle's new subtree is too tall: double rotation brings inner up
+      int innerLeftHeight, innerRightHeight;
+      childHeights(inner, innerHeight, innerLeftHeight, innerRightHeight);
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* innerLeft = inner->getLeft();
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* innerRight = inner->getRight();
+      int newLeftHeight = linkNode(left, outer, outerHeight, innerLeft, innerLeftHeight);
+      int newRightHeight = linkNode(middle, innerRight, innerRightHeight, right, rightHeight);
+      height = linkNode(inner, left, newLeftHeight, middle, newRightHeight);
+      return inner;
+    }
+
+    int joinedHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* joined = joinRight(inner, innerHeight, middle, right, rightHeight, joinedHeight);
+    if(joinedHeight <= outerHeight + 1){
+      height = linkNode(left, outer, outerHeight, joined, joinedHeight);
+      return left;
+    }
+    //Single rotation to the left
+    int joinedLeftHeight, joinedRightHeight;
+    childHeights(joined, joinedHeight, joinedLeftHeight, joinedRightHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* joinedLeft = joined->getLeft();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* joinedRight = joined->getRight();
+    int newLeftHeight = linkNode(left, outer, outerHeight, joinedLeft, joinedLeftHeight);
+    height = linkNode(joined, left, newLeftHeight, joinedRight, joinedRightHeight);
+    return joined;
+}
+
+/**
+* The mirror image of joinRight, for when right is the taller.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::joinLeft(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                                                          AVLNode<Key, Value, OrderStats, AtomicLinks>* middle,
+                                                                                          AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height)
+{
+    int innerHeight, outerHeight;
+    childHeights(right, rightHeight, innerHeight, outerHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* inner = right->getLeft();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* outer = right->getRight();
+
+    if(innerHeight <= leftHeight + 1){
+      int joinedHeight = linkNode(middle, left, leftHeight, inner, innerHeight);
+      if(joinedHeight <= outerHeight + 1){
+        height = linkNode(right, middle, joinedHeight, outer, outerHeight);
+        return right;
+      }
+      //middle's new subtree is too tall: double rotation brings inner up
+      int innerLeftHeight, innerRightHeight;
+      childHeights(inner, innerHeight, innerLeftHeight, innerRightHeight);
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* innerLeft = inner->getLeft();
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* innerRight = inner->getRight();
+      int newLeftHeight = linkNode(middle, left, leftHeight, innerLeft, innerLeftHeight);
+      int newRightHeight = linkNode(right, innerRight, innerRightHeight, outer, outerHeight);
+      height = linkNode(inner, middle, newLeftHeight, right, newRightHeight);
+      return inner;
+    }
+
+    int joinedHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* joined = joinLeft(left, leftHeight, middle, inner, innerHeight, joinedHeight);
+    if(joinedHeight <= outerHeight + 1){
+      height = linkNode(right, joined, joinedHeight, outer, outerHeight);
+      return right;
+    }
+    //Single rotation to the right
+    int joinedLeftHeight, joinedRightHeight;
+    childHeights(joined, joinedHeight, joinedLeftHeight, joinedRightHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* joinedLeft = joined->getLeft();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* joinedRight = joined->getRight();
+    int newRightHeight = linkNode(right, joinedRight, joinedRightHeight, outer, outerHeight);
+    height = linkNode(joined, joinedLeft, joinedLeftHeight, right, newRightHeight);
+    return joined;
+}
+
+/**
+* Joins left and right, every key of left being before every key of
+* right, with no node in between: left's last node is cut out and used
+* as the middle. O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::joinPair(AVLNode<Key, Value, OrderStats, AtomicLinks>* left, int leftHeight,
+                                                                                          AVLNode<Key, Value, OrderStats, AtomicLinks>* right, int rightHeight, int& height)
+{
+    if(left == nullptr){
+      height = rightHeight;
+      return right;
+    }
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* last;
+    int restHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* rest = splitLast(left, leftHeight, last, restHeight);
+    return joinTrees(rest, restHeight, last, right, rightHeight, height);
+}
+
+/**
+* Cuts the last node out of node's subtree and returns what is left,
+* setting last to the cut node and restHeight to the rest's height.
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::splitLast(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int height,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>*& last, int& restHeight)
+{
+    int leftHeight, rightHeight;
+    childHeights(node, height, leftHeight, rightHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* left = node->getLeft();
+    if(node->getRight() == nullptr){
+      last = node;
+      restHeight = leftHeight;
+      return left;
+    }
+    int rightRestHeight;
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* rightRest = splitLast(node->getRight(), rightHeight, last, rightRestHeight);
+    return joinTrees(left, leftHeight, node, rightRest, rightRestHeight, restHeight);
+}
+
+/**
+* Splits node's subtree into the keys before key (left) and after it
+* (right), rejoining the pieces along the search path on the way back up.
+* Returns the node holding key itself, detached and childless, or NULL.
+* O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc, bool OrderStats, bool AtomicLinks>
+AVLNode<Key, Value, OrderStats, AtomicLinks>* AVLTree<Key, Value, Compare, Alloc, OrderStats, AtomicLinks>::splitTree(AVLNode<Key, Value, OrderStats, AtomicLinks>* node, int height, const Key& key,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>*& left, int& leftHeight,
+                                                                                           AVLNode<Key, Value, OrderStats, AtomicLinks>*& right, int& rightHeight) const
+{
+    if(node == nullptr){
+      left = nullptr;
+      right = nullptr;
+      leftHeight = 0;
+      rightHeight = 0;
+      return nullptr;
+    }
+    int childLeftHeight, childRightHeight;
+    childHeights(node, height, childLeftHeight, childRightHeight);
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* childLeft = node->getLeft();
+    AVLNode<Key, Value, OrderStats, AtomicLinks>* childRight = node->getRight();
+
+    if(this->comp_(key, node->getKey())){
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* between;
+      int betweenHeight;
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* match = splitTree(childLeft, childLeftHeight, key, left, leftHeight, between, betweenHeight);
+      right = joinTrees(between, betweenHeight, node, childRight, childRightHeight, rightHeight);
+      return match;
+    }
+    if(this->comp_(node->getKey(), key)){
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* between;
+      int betweenHeight;
+      AVLNode<Key, Value, OrderStats, AtomicLinks>* match = splitTree(childRight, childRightHeight, key, between, betweenHeight, right, rightHeight);
+      left = joinTrees(childLeft, childLeftHeight, node, between, betweenHeight, leftHeight);
+      return match;
+    }
+    left = childLeft;
+    leftHeight = childLeftHeight;
+    right = childRight;
+    rightHeight = childRightHeight;
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+    return node;
 }
 
 
@@ -0,0 +1,1635 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "key_compare.h"
+
+/**
+ * Uninitialized storage for up to N objects of type T. Slots are
+ * constructed and destroyed one at a time, so T needs neither a default
+ * constructor nor assignment (std::pair<const Key, Value> has neither).
+ */
+template<typename T, size_t N>
+class SlotArray
+{
+public:
+    T& operator[](size_t i);
+    const T& operator[](size_t i) const;
+
+    template<typename... Args>
+    void construct(size_t i, Args&&... args);
+    void destroy(size_t i);
+    // Moves slot from into the unconstructed slot to and destroys from.
+    void relocate(size_t from, T* to);
+
+private:
+    alignas(T) unsigned char bytes_[N * sizeof(T)];
+};
+
+/**
+ * A B+ tree with the same interface as BinarySearchTree, so code can switch
+ * between the two with a typedef. Not carried over: findBatch,
+ * assignParallel, freeze and print.
+ *
+ * Every node holds up to NodeKeys sorted keys in one block, so a lookup
+ * touches about log_{NodeKeys/2}(n) nodes instead of log_2(n), and the
+ * keys it compares sit next to each other rather than behind separate
+ * pointers. Items live only in the leaves; inner nodes hold copies of keys
+ * that route the search, key i being a lower bound for child i + 1. The
+ * leaves are linked in both directions, so iteration and range scans walk
+ * a leaf array at a time and never climb back up the tree.
+ *
+ * Nodes other than the root stay at least half full: insert splits a full
+ * node in two, and remove refills an underfull one from a sibling or
+ * merges it into one.
+ *
+ * NodeKeys sets the node size. Larger nodes mean fewer levels but longer
+ * in-node searches and moves; around 16 to 64 keys suits most key types.
+ */
+template<typename Key, typename Value, typename Compare = std::less<Key>, size_t NodeKeys = 32>
+class BPlusTree
+{
+    static_assert(NodeKeys >= 4, "BPlusTree needs room for at least 4 keys per node");
+
+    struct LeafNode;
+
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    explicit BPlusTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    BPlusTree(InputIt first, InputIt last, bool sortFirst = false,
+              const Compare& comp = Compare());
+    ~BPlusTree();
+    void remove(const Key& key);
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last, bool sortFirst = false);
+    void clear();
+    // O(1) check of height against size; every leaf is at the same depth.
+    bool isBalanced() const;
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    /**
+    * Iterator over the items in key order. It steps along a leaf and then
+    * follows the leaf links, in either direction; an iterator converts to
+    * a const_iterator and the two compare equal at the same item.
+    */
+    template<bool IsConst>
+    class TreeIterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+
+        TreeIterator();
+        template<bool OtherConst,
+                 typename = typename std::enable_if<IsConst && !OtherConst>::type>
+        TreeIterator(const TreeIterator<OtherConst>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool OtherConst>
+        bool operator==(const TreeIterator<OtherConst>& rhs) const;
+        template<bool OtherConst>
+        bool operator!=(const TreeIterator<OtherConst>& rhs) const;
+
+        TreeIterator& operator++();
+        TreeIterator operator++(int);
+        TreeIterator& operator--();
+        TreeIterator operator--(int);
+
+    protected:
+        friend class BPlusTree<Key, Value, Compare, NodeKeys>;
+        template<bool> friend class TreeIterator;
+        TreeIterator(LeafNode* leaf, size_t slot, const BPlusTree* tree);
+        LeafNode* leaf_;
+        size_t slot_;
+        const BPlusTree* tree_;
+    };
+
+    typedef TreeIterator<false> iterator;
+    typedef TreeIterator<true> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator find(const Key& key) const;
+    template<typename K, typename C = Compare,
+             typename = typename std::enable_if<IsTransparent<C>::value>::type>
+    iterator find(const K& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    // Insertion, as in BinarySearchTree: each returns the item's position
+    // and whether it is new. insert and insert_or_assign overwrite an
+    // existing value; emplace and try_emplace leave an existing item alone.
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value);
+    // Hinted insertion, for code written against BinarySearchTree. A
+    // split needs the path from the root, so the hint saves nothing here
+    // and this is the same O(log n) as insert.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+
+    // Ordered lookups, the starting points for range scans. floor is the
+    // last item not after key (end() if there is none); ceiling is the
+    // same as lower_bound.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+
+    // Removal by position; each returns the iterator after the last item
+    // removed. Removing can move items between leaves, so each item costs
+    // a descent: O(log n) for one and O(k log n) for k.
+    iterator erase(iterator pos);
+    iterator erase(iterator first, iterator last);
+
+private:
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+
+    // Nodes are one slot over capacity, so an insert can always go in
+    // first and the split sort out the overflow afterwards.
+    struct LeafNode
+    {
+        size_t count;
+        LeafNode* prev;
+        LeafNode* next;
+        SlotArray<value_type, NodeKeys + 1> items;
+    };
+
+    struct InnerNode
+    {
+        size_t count;   // number of keys; there are count + 1 children
+        SlotArray<Key, NodeKeys + 1> keys;
+        void* children[NodeKeys + 2];
+    };
+
+    // One inner node on the way down and the child taken from it.
+    struct PathStep
+    {
+        InnerNode* node;
+        size_t child;
+    };
+
+    // The root can't split or merge below half full, so every level has a
+    // fan-out of at least 2 and 64 levels covers any size_t worth of items.
+    static const int MAX_HEIGHT = 64;
+    static const size_t MIN_LEAF_ITEMS = NodeKeys / 2;
+    static const size_t MIN_INNER_KEYS = (NodeKeys - 1) / 2;
+
+    template<typename K>
+    LeafNode* findLeaf(const K& key, PathStep* path) const;
+    template<typename K>
+    size_t childIndex(const InnerNode* node, const K& key) const;
+    template<typename K>
+    size_t leafLowerBound(const LeafNode* leaf, const K& key) const;
+    template<typename K>
+    bool findItem(const K& key, PathStep* path, LeafNode*& leaf, size_t& slot) const;
+    iterator iteratorAt(LeafNode* leaf, size_t slot) const;
+    template<typename P>
+    std::pair<iterator, bool> insertItem(P&& keyValuePair);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignKey(K&& key, M&& value);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplaceKey(K&& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> insertAt(LeafNode* leaf, size_t slot, PathStep* path, Args&&... itemArgs);
+    void splitLeaf(LeafNode* leaf, PathStep* path, int depth, LeafNode* right, InnerNode** spares);
+    void splitInner(InnerNode* node, PathStep* path, int depth, InnerNode** spares);
+    void insertIntoParent(PathStep* path, int depth, const Key& separator, void* right, InnerNode** spares);
+    void rebalanceLeaf(LeafNode* leaf, PathStep* path, int depth);
+    void rebalanceInner(PathStep* path, int depth);
+    void removeFromInner(InnerNode* node, size_t key);
+    void deleteSubtree(void* node, int level);
+    void buildTree(std::pair<Key, Value>* items, size_t count);
+    size_t collapseDuplicates(std::vector<std::pair<Key, Value> >& items) const;
+
+private:
+    void* root_;          // a LeafNode if levels_ is 1, else an InnerNode
+    int levels_;          // 0 when empty
+    size_t size_;
+    LeafNode* first_;     // leftmost leaf
+    LeafNode* last_;      // rightmost leaf
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the SlotArray class.
+  ---------------------------------------------------
+*/
+
+/**
+* Returns the object in slot i, which must be constructed.
+*/
+template<typename T, size_t N>
+T& SlotArray<T, N>::operator[](size_t i)
+{
+    return *std::launder(reinterpret_cast<T*>(bytes_) + i);
+}
+
+/**
+* Const version of operator[].
+*/
+template<typename T, size_t N>
+const T& SlotArray<T, N>::operator[](size_t i) const
+{
+    return *std::launder(reinterpret_cast<const T*>(bytes_) + i);
+}
+
+/**
+* Constructs slot i, which must be empty, from args.
+*/
+template<typename T, size_t N>
+template<typename... Args>
+void SlotArray<T, N>::construct(size_t i, Args&&... args)
+{
+    ::new (static_cast<void*>(reinterpret_cast<T*>(bytes_) + i)) T(std::forward<Args>(args)...);
+}
+
+/**
+* Destroys the object in slot i.
+*/
+template<typename T, size_t N>
+void SlotArray<T, N>::destroy(size_t i)
+{
+    (*this)[i].~T();
+}
+
+/**
+* Move-constructs *to from slot from and leaves slot from empty.
+*/
+template<typename T, size_t N>
+void SlotArray<T, N>::relocate(size_t from, T* to)
+{
+    ::new (static_cast<void*>(to)) T(std::move((*this)[from]));
+    destroy(from);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the SlotArray class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the BPlusTree::iterator class.
+  ---------------------------------------------------
+*/
+
+/**
+* Initializes an iterator at a slot of a leaf (NULL for end()).
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::TreeIterator(LeafNode* leaf, size_t slot, const BPlusTree* tree) :
+    leaf_(leaf),
+    slot_(slot),
+    tree_(tree)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::TreeIterator() :
+    leaf_(nullptr),
+    slot_(0),
+    tree_(nullptr)
+{
+
+}
+
+/**
+* Converts an iterator into a const_iterator at the same item.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+template<bool OtherConst, typename>
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::TreeIterator(const TreeIterator<OtherConst>& other) :
+    leaf_(other.leaf_),
+    slot_(other.slot_),
+    tree_(other.tree_)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::template TreeIterator<IsConst>::reference
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator*() const
+{
+    return leaf_->items[slot_];
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::template TreeIterator<IsConst>::pointer
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator->() const
+{
+    return &(leaf_->items[slot_]);
+}
+
+/**
+* Checks if 'this' iterator is at the same item as 'rhs'.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+template<bool OtherConst>
+bool
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator==(const TreeIterator<OtherConst>& rhs) const
+{
+    return leaf_ == rhs.leaf_ && slot_ == rhs.slot_;
+}
+
+/**
+* Checks if 'this' iterator is at a different item than 'rhs'.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+template<bool OtherConst>
+bool
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator!=(const TreeIterator<OtherConst>& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next item, moving on to the next leaf at the end of
+* this one.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::template TreeIterator<IsConst>&
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator++()
+{
+    ++slot_;
+    if(slot_ == leaf_->count){
+      leaf_ = leaf_->next;
+      slot_ = 0;
+    }
+    return *this;
+}
+
+/**
+* Post-increment: advances the iterator and returns where it was.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::template TreeIterator<IsConst>
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator++(int)
+{
+    TreeIterator before = *this;
+    ++(*this);
+    return before;
+}
+
+/**
+* Moves back one item. From end() that is the last item of the last leaf.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::template TreeIterator<IsConst>&
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator--()
+{
+    if(leaf_ == nullptr){
+      leaf_ = tree_->last_;
+      slot_ = leaf_->count;
+    }
+    else if(slot_ == 0){
+      leaf_ = leaf_->prev;
+      slot_ = leaf_->count;
+    }
+    --slot_;
+    return *this;
+}
+
+/**
+* Post-decrement: moves the iterator back and returns where it was.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::template TreeIterator<IsConst>
+BPlusTree<Key, Value, Compare, NodeKeys>::TreeIterator<IsConst>::operator--(int)
+{
+    TreeIterator before = *this;
+    --(*this);
+    return before;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the BPlusTree::iterator class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the BPlusTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an empty tree; no node is allocated until the first insert.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+BPlusTree<Key, Value, Compare, NodeKeys>::BPlusTree(const Compare& comp) :
+    root_(nullptr),
+    levels_(0),
+    size_(0),
+    first_(nullptr),
+    last_(nullptr),
+    comp_(comp)
+{
+
+}
+
+/**
+* Range constructor that bulk loads the items, ordered by comp, in O(n);
+* see assign.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename InputIt>
+BPlusTree<Key, Value, Compare, NodeKeys>::BPlusTree(InputIt first, InputIt last, bool sortFirst, const Compare& comp) :
+    BPlusTree(comp)
+{
+    assign(first, last, sortFirst);
+}
+
+/**
+* Destroys every item and node.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+BPlusTree<Key, Value, Compare, NodeKeys>::~BPlusTree()
+{
+    clear();
+}
+
+/**
+* Removes every item.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::clear()
+{
+    if(root_ != nullptr){
+      deleteSubtree(root_, levels_);
+    }
+    root_ = nullptr;
+    levels_ = 0;
+    size_ = 0;
+    first_ = nullptr;
+    last_ = nullptr;
+}
+
+/**
+* Destroys a subtree whose root is level levels above the bottom
+* (1 = a leaf).
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::deleteSubtree(void* node, int level)
+{
+    if(level == 1){
+      LeafNode* leaf = static_cast<LeafNode*>(node);
+      for(size_t i = 0; i < leaf->count; ++i){
+        leaf->items.destroy(i);
+      }
+      delete leaf;
+      return;
+    }
+    InnerNode* inner = static_cast<InnerNode*>(node);
+    for(size_t i = 0; i <= inner->count; ++i){
+      deleteSubtree(inner->children[i], level - 1);
+    }
+    for(size_t i = 0; i < inner->count; ++i){
+      inner->keys.destroy(i);
+    }
+    delete inner;
+}
+
+/**
+* Replaces the contents with the items in [first, last) in O(n) (plus
+* O(n log n) if sortFirst asks for them to be sorted), as
+* BinarySearchTree::assign does: a later item with the same key
+* overwrites an earlier one, and an unsorted range without sortFirst
+* throws std::invalid_argument.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename InputIt>
+void BPlusTree<Key, Value, Compare, NodeKeys>::assign(InputIt first, InputIt last, bool sortFirst)
+{
+    clear();
+
+    std::vector<std::pair<Key, Value> > items(first, last);
+    if(sortFirst){
+      // stable, so duplicates keep their input order and the last one wins
+      std::stable_sort(items.begin(), items.end(),
+          [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return comp_(a.first, b.first);
+          });
+    }
+
+    size_t kept = collapseDuplicates(items);
+    if(kept > 0){
+      buildTree(items.data(), kept);
+    }
+}
+
+/**
+* Builds the tree bottom up from count sorted, distinct items, moving them
+* in. Each level is cut into as few nodes as fit, with the items or
+* children spread evenly, which leaves every node at least half full.
+* If an allocation or a move throws, everything built so far is freed and
+* the tree stays empty.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::buildTree(std::pair<Key, Value>* items, size_t count)
+{
+    // level holds the nodes of the last finished level, left to right;
+    // upper the ones of the level being built over it
+    std::vector<void*> level;
+    std::vector<void*> upper;
+    int levels = 1;
+    LeafNode* head = nullptr;
+    LeafNode* prev = nullptr;
+    try{
+      size_t leaves = (count + NodeKeys - 1) / NodeKeys;
+      level.reserve(leaves);
+      for(size_t i = 0; i < leaves; ++i){
+        LeafNode* leaf = new LeafNode();
+        level.push_back(leaf);
+        leaf->prev = prev;
+        if(prev != nullptr){
+          prev->next = leaf;
+        }
+        else{
+          head = leaf;
+        }
+        prev = leaf;
+        for(size_t j = count * i / leaves; j < count * (i + 1) / leaves; ++j){
+          leaf->items.construct(leaf->count, std::move(items[j]));
+          ++leaf->count;
+        }
+      }
+
+      while(level.size() > 1){
+        size_t parents = (level.size() + NodeKeys) / (NodeKeys + 1);
+        upper.clear();
+        upper.reserve(parents);
+        for(size_t i = 0; i < parents; ++i){
+          InnerNode* node = new InnerNode();
+          upper.push_back(node);
+          size_t from = level.size() * i / parents;
+          size_t to = level.size() * (i + 1) / parents;
+          node->children[0] = level[from];
+          for(size_t c = from + 1; c < to; ++c){
+            // a routing key is the smallest key under the child after it
+            void* smallest = level[c];
+            for(int down = levels; down > 1; --down){
+              smallest = static_cast<InnerNode*>(smallest)->children[0];
+            }
+            node->keys.construct(node->count, static_cast<LeafNode*>(smallest)->items[0].first);
+            node->children[node->count + 1] = level[c];
+            ++node->count;
+          }
+        }
+        level.swap(upper);
+        upper.clear();
+        ++levels;
+      }
+    }
+    catch(...){
+      // nodes in upper only own their keys; their children are in level
+      for(size_t i = 0; i < upper.size(); ++i){
+        InnerNode* node = static_cast<InnerNode*>(upper[i]);
+        for(size_t k = 0; k < node->count; ++k){
+          node->keys.destroy(k);
+        }
+        delete node;
+      }
+      for(size_t i = 0; i < level.size(); ++i){
+        deleteSubtree(level[i], levels);
+      }
+      throw;
+    }
+
+    root_ = level[0];
+    levels_ = levels;
+    size_ = count;
+    first_ = head;
+    last_ = prev;
+}
+
+/**
+* Squeezes runs of equal keys in the sorted items down to one item each,
+* keeping the last value seen, and returns how many items are left at
+* the front. Throws std::invalid_argument if items are not sorted.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+size_t BPlusTree<Key, Value, Compare, NodeKeys>::collapseDuplicates(std::vector<std::pair<Key, Value> >& items) const
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < items.size(); ++i){
+      if(kept > 0 && !comp_(items[kept-1].first, items[i].first)){
+        if(comp_(items[i].first, items[kept-1].first)){
+          throw std::invalid_argument("assign: range is not sorted by key");
+        }
+        items[kept-1].second = std::move(items[i].second);
+      }
+      else{
+        if(kept != i){
+          items[kept] = std::move(items[i]);
+        }
+        ++kept;
+      }
+    }
+    return kept;
+}
+
+/**
+* A sanity check, in O(1), that size_ is at least the fewest items a tree
+* of levels_ levels can hold: a root with two children, every other node
+* at least half full. Splits and merges keep every leaf at the same
+* depth, so a wrong node count is all this can catch.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+bool BPlusTree<Key, Value, Compare, NodeKeys>::isBalanced() const
+{
+    if(levels_ == 0){
+      return size_ == 0;
+    }
+    size_t fewest = (levels_ == 1) ? 1 : 2 * MIN_LEAF_ITEMS;
+    for(int level = 3; level <= levels_ && fewest <= size_; ++level){
+      fewest *= MIN_INNER_KEYS + 1;
+    }
+    return size_ >= fewest;
+}
+
+/**
+* Returns true if the tree holds no items.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+bool BPlusTree<Key, Value, Compare, NodeKeys>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns the number of items.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+size_t BPlusTree<Key, Value, Compare, NodeKeys>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns the number of node levels; every leaf is at the same depth.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+int BPlusTree<Key, Value, Compare, NodeKeys>::height() const
+{
+    return levels_;
+}
+
+/**
+* Wraps a leaf slot as an iterator.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::iteratorAt(LeafNode* leaf, size_t slot) const
+{
+    return iterator(leaf, slot, this);
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::begin() const
+{
+    return iteratorAt(first_, 0);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::end() const
+{
+    return iteratorAt(nullptr, 0);
+}
+
+/**
+* Returns a const_iterator to the "smallest" item in the tree
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::const_iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns the const_iterator that means INVALID
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::const_iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::reverse_iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator one before the "smallest" item.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::reverse_iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Const version of rbegin().
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::const_reverse_iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+/**
+* Const version of rend().
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::const_reverse_iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns the index of the child of node that would hold key: the number
+* of routing keys not after key.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K>
+size_t BPlusTree<Key, Value, Compare, NodeKeys>::childIndex(const InnerNode* node, const K& key) const
+{
+    size_t low = 0;
+    size_t count = node->count;
+    while(count > 0){
+      size_t half = count / 2;
+      if(comp_(key, node->keys[low + half])){
+        count = half;
+      }
+      else{
+        low += half + 1;
+        count -= half + 1;
+      }
+    }
+    return low;
+}
+
+/**
+* Returns the first slot of leaf whose key is not before key (count if
+* there is none).
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K>
+size_t BPlusTree<Key, Value, Compare, NodeKeys>::leafLowerBound(const LeafNode* leaf, const K& key) const
+{
+    size_t low = 0;
+    size_t count = leaf->count;
+    while(count > 0){
+      size_t half = count / 2;
+      if(comp_(leaf->items[low + half].first, key)){
+        low += half + 1;
+        count -= half + 1;
+      }
+      else{
+        count = half;
+      }
+    }
+    return low;
+}
+
+/**
+* Descends from the root to the leaf that would hold key. If path is not
+* NULL, each inner node passed and the child taken are recorded there,
+* root first. The tree must not be empty.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::LeafNode*
+BPlusTree<Key, Value, Compare, NodeKeys>::findLeaf(const K& key, PathStep* path) const
+{
+    void* node = root_;
+    for(int level = levels_; level > 1; --level){
+      InnerNode* inner = static_cast<InnerNode*>(node);
+      size_t child = childIndex(inner, key);
+      if(path != nullptr){
+        path->node = inner;
+        path->child = child;
+        ++path;
+      }
+      node = inner->children[child];
+    }
+    return static_cast<LeafNode*>(node);
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::find(const Key& key) const
+{
+    if(root_ == nullptr){
+      return end();
+    }
+    LeafNode* leaf = findLeaf(key, nullptr);
+    size_t slot = leafLowerBound(leaf, key);
+    if(slot == leaf->count || comp_(key, leaf->items[slot].first)){
+      return end();
+    }
+    return iteratorAt(leaf, slot);
+}
+
+/**
+* Heterogeneous version of find, only available with a transparent
+* comparator.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K, typename C, typename>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::find(const K& key) const
+{
+    if(root_ == nullptr){
+      return end();
+    }
+    LeafNode* leaf = findLeaf(key, nullptr);
+    size_t slot = leafLowerBound(leaf, key);
+    if(slot == leaf->count || comp_(key, leaf->items[slot].first)){
+      return end();
+    }
+    return iteratorAt(leaf, slot);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+Value& BPlusTree<Key, Value, Compare, NodeKeys>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+Value const & BPlusTree<Key, Value, Compare, NodeKeys>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Returns an iterator to the first item whose key is not before key.
+* The answer can be the first item of the next leaf, which is one link
+* away.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::lower_bound(const Key& key) const
+{
+    if(root_ == nullptr){
+      return end();
+    }
+    LeafNode* leaf = findLeaf(key, nullptr);
+    size_t slot = leafLowerBound(leaf, key);
+    if(slot == leaf->count){
+      return iteratorAt(leaf->next, 0);
+    }
+    return iteratorAt(leaf, slot);
+}
+
+/**
+* Returns an iterator to the first item whose key is after key.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::upper_bound(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it != end() && !comp_(key, it->first)){
+      ++it;
+    }
+    return it;
+}
+
+/**
+* Returns [lower_bound(key), upper_bound(key)), which holds the item with
+* key if there is one and is empty otherwise.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator,
+          typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator>
+BPlusTree<Key, Value, Compare, NodeKeys>::equal_range(const Key& key) const
+{
+    iterator low = lower_bound(key);
+    iterator high = low;
+    if(low != end() && !comp_(key, low->first)){
+      ++high;
+    }
+    return std::make_pair(low, high);
+}
+
+/**
+* Returns an iterator to the last item whose key is not after key, or
+* end() if every key is after it.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::floor(const Key& key) const
+{
+    iterator it = upper_bound(key);
+    if(it == begin()){
+      return end();
+    }
+    return --it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not before key, or
+* end() if there is none; another name for lower_bound.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::ceiling(const Key& key) const
+{
+    return lower_bound(key);
+}
+
+/**
+* Inserts a copy of keyValuePair, or overwrites the value if the key is
+* already present.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    return insertItem(keyValuePair);
+}
+
+/**
+* Moves keyValuePair into the tree, or moves its value over the existing
+* one if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertItem(std::move(keyValuePair));
+}
+
+/**
+* Builds the item in place from args, then puts it in the tree. As with
+* BinarySearchTree::emplace, if the key is already present the new item
+* is thrown away and the existing one is left alone. The item has to
+* exist before its key can be looked up, so it is then moved into its
+* leaf slot.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::emplace(Args&&... args)
+{
+    value_type item(std::forward<Args>(args)...);
+    PathStep path[MAX_HEIGHT];
+    LeafNode* leaf;
+    size_t slot;
+    if(findItem(item.first, path, leaf, slot)){
+      return std::make_pair(iteratorAt(leaf, slot), false);
+    }
+    return insertAt(leaf, slot, path, std::move(item));
+}
+
+/**
+* Inserts key with a value constructed from args, unless key is already
+* present, in which case nothing is constructed and args are not touched.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::try_emplace(const Key& key, Args&&... args)
+{
+    return emplaceKey(key, std::forward<Args>(args)...);
+}
+
+/**
+* As above, moving key into the new item.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::try_emplace(Key&& key, Args&&... args)
+{
+    return emplaceKey(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Inserts key with the given value, or assigns value to the existing item
+* if key is already present. value is forwarded, so an rvalue is moved.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename M>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::insert_or_assign(const Key& key, M&& value)
+{
+    return assignKey(key, std::forward<M>(value));
+}
+
+/**
+* As above, moving key into the new item if one is made.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename M>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::insert_or_assign(Key&& key, M&& value)
+{
+    return assignKey(std::move(key), std::forward<M>(value));
+}
+
+/**
+* Inserts (or overwrites, like insert above) a copy of keyValuePair and
+* returns its position. hint is not used; see the declaration.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    (void)hint;
+    return insertItem(keyValuePair).first;
+}
+
+/**
+* As above, moving keyValuePair in.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::insert(iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    (void)hint;
+    return insertItem(std::move(keyValuePair)).first;
+}
+
+/**
+* Descends to where key belongs, recording the path as findLeaf does, and
+* sets leaf and slot to the leaf and its first slot not before key (leaf
+* is NULL for an empty tree). Returns true if that slot holds key.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K>
+bool BPlusTree<Key, Value, Compare, NodeKeys>::findItem(const K& key, PathStep* path, LeafNode*& leaf, size_t& slot) const
+{
+    if(root_ == nullptr){
+      leaf = nullptr;
+      slot = 0;
+      return false;
+    }
+    leaf = findLeaf(key, path);
+    slot = leafLowerBound(leaf, key);
+    return slot < leaf->count && !comp_(key, leaf->items[slot].first);
+}
+
+/**
+* Shared body of the insert overloads: one descent, then either the
+* existing value is overwritten or a new item goes in.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename P>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::insertItem(P&& keyValuePair)
+{
+    PathStep path[MAX_HEIGHT];
+    LeafNode* leaf;
+    size_t slot;
+    if(findItem(keyValuePair.first, path, leaf, slot)){
+      leaf->items[slot].second = std::forward<P>(keyValuePair).second;
+      return std::make_pair(iteratorAt(leaf, slot), false);
+    }
+    return insertAt(leaf, slot, path, std::forward<P>(keyValuePair));
+}
+
+/**
+* Shared body of insert_or_assign: one descent, then either the existing
+* value is assigned or a new item is made from key and value.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K, typename M>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::assignKey(K&& key, M&& value)
+{
+    PathStep path[MAX_HEIGHT];
+    LeafNode* leaf;
+    size_t slot;
+    if(findItem(key, path, leaf, slot)){
+      leaf->items[slot].second = std::forward<M>(value);
+      return std::make_pair(iteratorAt(leaf, slot), false);
+    }
+    return insertAt(leaf, slot, path, std::forward<K>(key), std::forward<M>(value));
+}
+
+/**
+* Shared body of try_emplace: one descent, and the item is only built
+* (piecewise, from key and args) once we know the key is new.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename K, typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::emplaceKey(K&& key, Args&&... args)
+{
+    PathStep path[MAX_HEIGHT];
+    LeafNode* leaf;
+    size_t slot;
+    if(findItem(key, path, leaf, slot)){
+      return std::make_pair(iteratorAt(leaf, slot), false);
+    }
+    return insertAt(leaf, slot, path, std::piecewise_construct,
+                    std::forward_as_tuple(std::forward<K>(key)),
+                    std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+/**
+* Builds a new item from itemArgs at slot of leaf, where findItem found
+* its key belongs and is missing, splitting nodes on path as needed (leaf
+* is NULL for an empty tree). Every node a split will need is allocated
+* before anything changes, so a failed allocation leaves the tree as it
+* was.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+template<typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator, bool>
+BPlusTree<Key, Value, Compare, NodeKeys>::insertAt(LeafNode* leaf, size_t slot, PathStep* path, Args&&... itemArgs)
+{
+    if(leaf == nullptr){
+      leaf = new LeafNode();
+      try{
+        leaf->items.construct(0, std::forward<Args>(itemArgs)...);
+      }
+      catch(...){
+        delete leaf;
+        throw;
+      }
+      leaf->count = 1;
+      root_ = first_ = last_ = leaf;
+      levels_ = 1;
+      size_ = 1;
+      return std::make_pair(iteratorAt(leaf, 0), true);
+    }
+
+    // A full leaf splits, and so does each full inner node above it; if
+    // the root splits too, a new root is needed on top.
+    int depth = levels_ - 1;
+    LeafNode* rightLeaf = nullptr;
+    InnerNode* spares[MAX_HEIGHT];
+    int spareCount = 0;
+    if(leaf->count == NodeKeys){
+      int full = 0;
+      while(full < depth && path[depth - 1 - full].node->count == NodeKeys){
+        ++full;
+      }
+      int needed = (full == depth) ? full + 1 : full;
+      try{
+        rightLeaf = new LeafNode();
+        for(; spareCount < needed; ++spareCount){
+          spares[spareCount] = new InnerNode();
+        }
+      }
+      catch(...){
+        delete rightLeaf;
+        for(int i = 0; i < spareCount; ++i){
+          delete spares[i];
+        }
+        throw;
+      }
+    }
+    spares[spareCount] = nullptr;
+
+    // leaves have a spare slot, so the item always fits before the split
+    for(size_t i = leaf->count; i > slot; --i){
+      leaf->items.relocate(i - 1, &leaf->items[i]);
+    }
+    try{
+      leaf->items.construct(slot, std::forward<Args>(itemArgs)...);
+    }
+    catch(...){
+      for(size_t i = slot; i < leaf->count; ++i){
+        leaf->items.relocate(i + 1, &leaf->items[i]);
+      }
+      delete rightLeaf;
+      for(int i = 0; i < spareCount; ++i){
+        delete spares[i];
+      }
+      throw;
+    }
+    ++leaf->count;
+    ++size_;
+
+    if(rightLeaf == nullptr){
+      return std::make_pair(iteratorAt(leaf, slot), true);
+    }
+    size_t kept = (NodeKeys + 1) / 2;
+    splitLeaf(leaf, path, depth, rightLeaf, spares);
+    if(slot < kept){
+      return std::make_pair(iteratorAt(leaf, slot), true);
+    }
+    return std::make_pair(iteratorAt(rightLeaf, slot - kept), true);
+}
+
+/**
+* Moves the upper half of an overfull leaf into right (already allocated),
+* links right in after it and hands right's first key to the parent.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::splitLeaf(LeafNode* leaf, PathStep* path, int depth, LeafNode* right, InnerNode** spares)
+{
+    size_t kept = leaf->count / 2;
+    for(size_t i = kept; i < leaf->count; ++i){
+      leaf->items.relocate(i, &right->items[i - kept]);
+    }
+    right->count = leaf->count - kept;
+    leaf->count = kept;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if(leaf->next != nullptr){
+      leaf->next->prev = right;
+    }
+    else{
+      last_ = right;
+    }
+    leaf->next = right;
+
+    insertIntoParent(path, depth, right->items[0].first, right, spares);
+}
+
+/**
+* Adds separator and the new node right (which goes just after the child
+* that split) to the parent recorded at path[depth - 1], splitting it in
+* turn if it overflows. At depth 0 the root itself split, so a new root is
+* made over the two halves.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::insertIntoParent(PathStep* path, int depth, const Key& separator, void* right, InnerNode** spares)
+{
+    InnerNode* fresh = spares[0];
+    if(depth == 0){
+      fresh->keys.construct(0, separator);
+      fresh->children[0] = root_;
+      fresh->children[1] = right;
+      fresh->count = 1;
+      root_ = fresh;
+      ++levels_;
+      return;
+    }
+
+    InnerNode* parent = path[depth - 1].node;
+    size_t at = path[depth - 1].child;
+    for(size_t i = parent->count; i > at; --i){
+      parent->keys.relocate(i - 1, &parent->keys[i]);
+      parent->children[i + 1] = parent->children[i];
+    }
+    parent->keys.construct(at, separator);
+    parent->children[at + 1] = right;
+    ++parent->count;
+
+    if(parent->count > NodeKeys){
+      splitInner(parent, path, depth - 1, spares);
+    }
+}
+
+/**
+* Splits an overfull inner node: the lower half stays, the middle key
+* moves up to the parent, and the upper half goes to a spare node.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::splitInner(InnerNode* node, PathStep* path, int depth, InnerNode** spares)
+{
+    InnerNode* right = spares[0];
+    size_t kept = node->count / 2;
+    for(size_t i = kept + 1; i < node->count; ++i){
+      node->keys.relocate(i, &right->keys[i - kept - 1]);
+    }
+    for(size_t i = kept + 1; i <= node->count; ++i){
+      right->children[i - kept - 1] = node->children[i];
+    }
+    right->count = node->count - kept - 1;
+    node->count = kept;
+
+    Key promoted(std::move(node->keys[kept]));
+    node->keys.destroy(kept);
+    insertIntoParent(path, depth, promoted, right, spares + 1);
+}
+
+/**
+* Removes the item with the given key, if there is one.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::remove(const Key& key)
+{
+    if(root_ == nullptr){
+      return;
+    }
+    PathStep path[MAX_HEIGHT];
+    LeafNode* leaf = findLeaf(key, path);
+    size_t slot = leafLowerBound(leaf, key);
+    if(slot == leaf->count || comp_(key, leaf->items[slot].first)){
+      return;
+    }
+
+    leaf->items.destroy(slot);
+    for(size_t i = slot + 1; i < leaf->count; ++i){
+      leaf->items.relocate(i, &leaf->items[i - 1]);
+    }
+    --leaf->count;
+    --size_;
+    rebalanceLeaf(leaf, path, levels_ - 1);
+}
+
+/**
+* Removes the item at pos, which must not be end(), and returns an
+* iterator to the item after it. Rebalancing can move that item to
+* another leaf, so it is looked up again by key afterwards.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::erase(iterator pos)
+{
+    iterator next = pos;
+    ++next;
+    if(next == end()){
+      remove(pos->first);
+      return end();
+    }
+    Key nextKey(next->first);
+    remove(pos->first);
+    return lower_bound(nextKey);
+}
+
+/**
+* Removes every item in [first, last) and returns an iterator to the
+* item last pointed at. Erasing the whole tree is handed to clear().
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+typename BPlusTree<Key, Value, Compare, NodeKeys>::iterator
+BPlusTree<Key, Value, Compare, NodeKeys>::erase(iterator first, iterator last)
+{
+    if(first == begin() && last == end()){
+      clear();
+      return end();
+    }
+    if(last == end()){
+      while(first != end()){
+        first = erase(first);
+      }
+      return first;
+    }
+    Key lastKey(last->first);
+    while(comp_(first->first, lastKey)){
+      first = erase(first);
+    }
+    return first;
+}
+
+/**
+* Restores the half-full rule for a leaf that lost an item: borrow one
+* from a sibling that can spare it, otherwise merge with a sibling, which
+* takes a key out of the parent. The routing keys only have to keep
+* bounding their subtrees, so one that no longer matches an item is fine.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::rebalanceLeaf(LeafNode* leaf, PathStep* path, int depth)
+{
+    if(depth == 0){
+      // the root leaf may hold any number of items, but not zero
+      if(leaf->count == 0){
+        delete leaf;
+        root_ = nullptr;
+        levels_ = 0;
+        first_ = last_ = nullptr;
+      }
+      return;
+    }
+    if(leaf->count >= MIN_LEAF_ITEMS){
+      return;
+    }
+
+    InnerNode* parent = path[depth - 1].node;
+    size_t at = path[depth - 1].child;
+    LeafNode* left = (at > 0) ? static_cast<LeafNode*>(parent->children[at - 1]) : nullptr;
+    LeafNode* right = (at < parent->count) ? static_cast<LeafNode*>(parent->children[at + 1]) : nullptr;
+
+    if(left != nullptr && left->count > MIN_LEAF_ITEMS){
+      for(size_t i = leaf->count; i > 0; --i){
+        leaf->items.relocate(i - 1, &leaf->items[i]);
+      }
+      left->items.relocate(left->count - 1, &leaf->items[0]);
+      --left->count;
+      ++leaf->count;
+      parent->keys[at - 1] = leaf->items[0].first;
+      return;
+    }
+    if(right != nullptr && right->count > MIN_LEAF_ITEMS){
+      right->items.relocate(0, &leaf->items[leaf->count]);
+      for(size_t i = 1; i < right->count; ++i){
+        right->items.relocate(i, &right->items[i - 1]);
+      }
+      --right->count;
+      ++leaf->count;
+      parent->keys[at] = right->items[0].first;
+      return;
+    }
+
+    // neither sibling can spare an item: fold the right one of a pair
+    // into the left one
+    size_t separator = at;
+    if(left != nullptr){
+      right = leaf;
+      leaf = left;
+      separator = at - 1;
+    }
+    for(size_t i = 0; i < right->count; ++i){
+      right->items.relocate(i, &leaf->items[leaf->count + i]);
+    }
+    leaf->count += right->count;
+    leaf->next = right->next;
+    if(right->next != nullptr){
+      right->next->prev = leaf;
+    }
+    else{
+      last_ = leaf;
+    }
+    delete right;
+    removeFromInner(parent, separator);
+    rebalanceInner(path, depth - 1);
+}
+
+/**
+* Takes key index key and the child after it out of an inner node.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::removeFromInner(InnerNode* node, size_t key)
+{
+    node->keys.destroy(key);
+    for(size_t i = key + 1; i < node->count; ++i){
+      node->keys.relocate(i, &node->keys[i - 1]);
+      node->children[i] = node->children[i + 1];
+    }
+    --node->count;
+}
+
+/**
+* Restores the half-full rule for the inner node at path[depth] after it
+* lost a key, the same way rebalanceLeaf does, except that keys rotate
+* through the parent. A root left with no keys is replaced by its only
+* child.
+*/
+template<typename Key, typename Value, typename Compare, size_t NodeKeys>
+void BPlusTree<Key, Value, Compare, NodeKeys>::rebalanceInner(PathStep* path, int depth)
+{
+    InnerNode* node = path[depth].node;
+    if(depth == 0){
+      if(node->count == 0){
+        root_ = node->children[0];
+        delete node;
+        --levels_;
+      }
+      return;
+    }
+    if(node->count >= MIN_INNER_KEYS){
+      return;
+    }
+
+    InnerNode* parent = path[depth - 1].node;
+    size_t at = path[depth - 1].child;
+    InnerNode* left = (at > 0) ? static_cast<InnerNode*>(parent->children[at - 1]) : nullptr;
+    InnerNode* right = (at < parent->count) ? static_cast<InnerNode*>(parent->children[at + 1]) : nullptr;
+
+    if(left != nullptr && left->count > MIN_INNER_KEYS){
+      node->children[node->count + 1] = node->children[node->count];
+      for(size_t i = node->count; i > 0; --i){
+        node->keys.relocate(i - 1, &node->keys[i]);
+        node->children[i] = node->children[i - 1];
+      }
+      parent->keys.relocate(at - 1, &node->keys[0]);
+      node->children[0] = left->children[left->count];
+      left->keys.relocate(left->count - 1, &parent->keys[at - 1]);
+      --left->count;
+      ++node->count;
+      return;
+    }
+    if(right != nullptr && right->count > MIN_INNER_KEYS){
+      parent->keys.relocate(at, &node->keys[node->count]);
+      node->children[node->count + 1] = right->children[0];
+      right->keys.relocate(0, &parent->keys[at]);
+      for(size_t i = 1; i < right->count; ++i){
+        right->keys.relocate(i, &right->keys[i - 1]);
+      }
+      for(size_t i = 1; i <= right->count; ++i){
+        right->children[i - 1] = right->children[i];
+      }
+      --right->count;
+      ++node->count;
+      return;
+    }
+
+    // merge the right node of a pair into the left one, pulling the
+    // parent's key between them down
+    size_t separator = at;
+    if(left != nullptr){
+      right = node;
+      node = left;
+      separator = at - 1;
+    }
+    node->keys.construct(node->count, std::move(parent->keys[separator]));
+    for(size_t i = 0; i < right->count; ++i){
+      right->keys.relocate(i, &node->keys[node->count + 1 + i]);
+    }
+    for(size_t i = 0; i <= right->count; ++i){
+      node->children[node->count + 1 + i] = right->children[i];
+    }
+    node->count += 1 + right->count;
+    delete right;
+    removeFromInner(parent, separator);
+    rebalanceInner(path, depth - 1);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the BPlusTree class.
+  -------------------------------------------------
+*/
+
+#endif
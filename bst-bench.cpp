@@ -0,0 +1,952 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "static_search_tree.h"
+#include "bplustree.h"
+#include "compact_avl.h"
+#include "concurrent_avl.h"
+
+using namespace std;
+
+// Keeps the optimizer from throwing away lookup results.
+static volatile long long sink;
+
+// Seconds elapsed since start.
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Times n successful lookups (in shuffled order) and prints nanoseconds
+// per lookup.
+template<typename Tree>
+void timeFind(const char* name, const Tree& tree, const vector<int>& keys)
+{
+    vector<int> probes(keys);
+    std::shuffle(probes.begin(), probes.end(), std::mt19937(7));
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long total = 0;
+    for(int rep = 0; rep < 5; ++rep) {
+        for(size_t i = 0; i < probes.size(); ++i) {
+            total += tree.find(probes[i])->second;
+        }
+    }
+    double secs = secondsSince(start);
+    sink = total;
+
+    cout << name << "," << keys.size() << "," << (secs * 1e9 / (5.0 * probes.size())) << endl;
+}
+
+// Fills a tree from keys and times lookups against it.
+template<typename Tree>
+void benchFind(const char* name, const vector<int>& keys)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], (int)i));
+    }
+    timeFind(name, tree, keys);
+}
+
+// Same, but times lookups against a frozen snapshot of the tree.
+template<typename Tree>
+void benchFrozenFind(const char* name, const vector<int>& keys)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], (int)i));
+    }
+    timeFind(name, tree.freeze(), keys);
+}
+
+// Resolves shuffled keys 256 at a time, first with a find loop and then
+// with findBatch, and prints nanoseconds per key for each.
+template<typename Tree>
+void benchFindBatch(const char* name, const vector<int>& keys)
+{
+    const size_t batch = 256;
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], (int)i));
+    }
+    vector<int> probes(keys);
+    std::shuffle(probes.begin(), probes.end(), std::mt19937(7));
+    size_t n = probes.size() / batch * batch;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long total = 0;
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.find(probes[i])->second;
+    }
+    double loopSecs = secondsSince(start);
+
+    vector<typename Tree::iterator> found(batch);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; i += batch) {
+        tree.findBatch(&probes[i], batch, &found[0]);
+        for(size_t j = 0; j < batch; ++j) {
+            total += found[j]->second;
+        }
+    }
+    double batchSecs = secondsSince(start);
+    sink = total;
+
+    cout << name << "," << n << "," << (loopSecs * 1e9 / n) << "," << (batchSecs * 1e9 / n) << endl;
+}
+
+// Runs readers threads doing finds for a fixed time while one writer
+// keeps removing and reinserting keys, and prints reads per second for an
+// AVLTree behind a mutex and for ConcurrentAVLTree.
+void benchConcurrentReads(size_t n, int readers)
+{
+    const chrono::milliseconds duration(300);
+    AVLTree<int,int> locked;
+    std::mutex lock;
+    ConcurrentAVLTree<int,int> shared;
+    for(size_t i = 0; i < n; ++i) {
+        locked.insert(std::make_pair((int)i, (int)i));
+        shared.insert(std::make_pair((int)i, (int)i));
+    }
+
+    for(int variant = 0; variant < 2; ++variant) {
+        std::atomic<bool> stop(false);
+        std::atomic<long long> reads(0);
+        vector<std::thread> threads;
+        for(int r = 0; r < readers; ++r) {
+            threads.push_back(std::thread([&, r]() {
+                std::mt19937 rng(r);
+                long long done = 0;
+                long long total = 0;
+                while(!stop.load(std::memory_order_relaxed)) {
+                    int key = (int)(rng() % n);
+                    if(variant == 0) {
+                        std::lock_guard<std::mutex> guard(lock);
+                        AVLTree<int,int>::iterator it = locked.find(key);
+                        total += (it != locked.end()) ? it->second : 0;
+                    }
+                    else {
+                        int value = 0;
+                        total += shared.find(key, value) ? value : 0;
+                    }
+                    ++done;
+                }
+                sink = total;
+                reads += done;
+            }));
+        }
+        std::thread writer([&]() {
+            std::mt19937 rng(1234);
+            while(!stop.load(std::memory_order_relaxed)) {
+                int key = (int)(rng() % n);
+                if(variant == 0) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    locked.remove(key);
+                    locked.insert(std::make_pair(key, key));
+                }
+                else {
+                    shared.remove(key);
+                    shared.insert(std::make_pair(key, key));
+                }
+                // a busy writer, but one that leaves the CPU to readers
+                std::this_thread::yield();
+            }
+        });
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        writer.join();
+        for(size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+        double secs = chrono::duration<double>(duration).count();
+        cout << (variant == 0 ? "AVLTree+mutex" : "ConcurrentAVLTree") << "," << readers << ","
+             << (reads.load() / secs) << endl;
+    }
+}
+
+// Times pointer-based find in a bulk loaded AVLTree against the SIMD
+// static index built from it, with its best kernel and with the scalar one.
+void benchStaticFind(size_t n)
+{
+    vector<std::pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = std::make_pair((int)i, (int)i);
+    }
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+
+    {
+        AVLTree<int,int> tree(items.begin(), items.end());
+        timeFind("AVLTree", tree, keys);
+    }
+    StaticSearchTree<int,int> simd(items.begin(), items.end());
+    string name = string("StaticSearchTree/") + simd.kernel();
+    timeFind(name.c_str(), simd, keys);
+    StaticSearchTree<int,int> scalar(items.begin(), items.end(), false);
+    timeFind("StaticSearchTree/scalar", scalar, keys);
+}
+
+// Builds a tree from already sorted keys with an insert loop, a hinted
+// insert loop (hint = end()) and the O(n) bulk loader, and prints
+// milliseconds for each.
+template<typename Tree>
+void benchSortedLoad(const char* name, size_t n)
+{
+    vector<std::pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = std::make_pair((int)i, (int)i);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        Tree tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+    }
+    double insertSecs = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    {
+        Tree tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(tree.end(), items[i]);
+        }
+    }
+    double hintedSecs = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    {
+        Tree tree(items.begin(), items.end());
+    }
+    double assignSecs = secondsSince(start);
+
+    cout << name << "," << n << "," << insertSecs * 1e3 << "," << hintedSecs * 1e3
+         << "," << assignSecs * 1e3 << endl;
+}
+
+// Builds a tree from n shuffled keys, a quarter of them repeated, with an
+// insert loop, the serial bulk loader (sortFirst) and the parallel one,
+// and prints milliseconds for each.
+template<typename Tree>
+void benchUnsortedLoad(const char* name, size_t n)
+{
+    vector<std::pair<int,int> > items(n);
+    std::mt19937 rng(11);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = std::make_pair((int)(rng() % (n - n / 4 + 1)), (int)i);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        Tree tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert_or_assign(items[i].first, items[i].second);
+        }
+    }
+    double insertSecs = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    {
+        Tree tree(items.begin(), items.end(), true);
+    }
+    double assignSecs = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    {
+        Tree tree;
+        tree.assignParallel(items.begin(), items.end());
+    }
+    double parallelSecs = secondsSince(start);
+
+    cout << name << "," << n << "," << WorkPool::shared().threads() << "," << insertSecs * 1e3
+         << "," << assignSecs * 1e3 << "," << parallelSecs * 1e3 << endl;
+}
+
+// Times union, intersection and difference of an n-key tree with an
+// m-key one, half of whose keys are shared, both as an insert/find/remove
+// loop over the smaller tree and with the join-based set operations,
+// which run on every core.
+// Each pair of runs starts from fresh copies built outside the timing.
+void benchSetOps(size_t n, size_t m)
+{
+    AVLTree<int,int> big, small;
+    for(size_t i = 0; i < n; ++i) {
+        big.insert(std::make_pair((int)(2 * i), 0));
+    }
+    std::mt19937 rng(7);
+    for(size_t i = 0; i < m; ++i) {
+        small.insert(std::make_pair((int)(rng() % (4 * n)), 1));
+    }
+
+    const char* names[3] = { "union", "intersection", "difference" };
+    for(int op = 0; op < 3; ++op) {
+        AVLTree<int,int> target;
+        target.unite(big);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(op == 0) {
+            for(AVLTree<int,int>::iterator it = small.begin(); it != small.end(); ++it) {
+                target.try_emplace(it->first, it->second);
+            }
+        }
+        else if(op == 1) {
+            AVLTree<int,int> kept;
+            for(AVLTree<int,int>::iterator it = small.begin(); it != small.end(); ++it) {
+                AVLTree<int,int>::iterator found = target.find(it->first);
+                if(found != target.end()) {
+                    kept.insert(kept.end(), *found);
+                }
+            }
+            // the in-place version frees the dropped nodes, so this does too
+            target.clear();
+        }
+        else {
+            for(AVLTree<int,int>::iterator it = small.begin(); it != small.end(); ++it) {
+                target.remove(it->first);
+            }
+        }
+        double loopSecs = secondsSince(start);
+
+        AVLTree<int,int> joined;
+        joined.unite(big);
+        start = chrono::steady_clock::now();
+        if(op == 0) {
+            joined.unite(small);
+        }
+        else if(op == 1) {
+            joined.intersect(small);
+        }
+        else {
+            joined.subtract(small);
+        }
+        double joinSecs = secondsSince(start);
+
+        cout << names[op] << "," << n << "," << m << "," << WorkPool::shared().threads()
+             << "," << loopSecs * 1e3 << "," << joinSecs * 1e3 << endl;
+    }
+}
+
+// Keeps a tree at about n keys under churn: each of n operations inserts
+// a fresh random key or removes a random live one, with a writePct
+// percent chance of a write (split evenly between the two) and a find of
+// a live key otherwise. Prints nanoseconds per operation.
+template<typename Tree>
+void benchMixed(const char* name, size_t n, int writePct)
+{
+    std::mt19937 rng(13);
+    vector<int> live(n);
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        live[i] = (int)rng();
+        tree.insert(std::make_pair(live[i], (int)i));
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long total = 0;
+    for(size_t i = 0; i < n; ++i) {
+        size_t slot = rng() % live.size();
+        if((int)(rng() % 100) >= writePct) {
+            typename Tree::iterator it = tree.find(live[slot]);
+            total += (it != tree.end()) ? it->second : 0;
+        }
+        else if(rng() % 2 == 0) {
+            live.push_back((int)rng());
+            tree.insert(std::make_pair(live.back(), (int)i));
+        }
+        else {
+            tree.remove(live[slot]);
+            live[slot] = live.back();
+            live.pop_back();
+        }
+    }
+    double secs = secondsSince(start);
+    sink = total;
+
+    cout << name << "," << n << "," << writePct << "," << (secs * 1e9 / n) << endl;
+}
+
+// Resident set size of this process in bytes, read from
+// /proc/self/statm; 0 where that is not available.
+static size_t residentBytes()
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm == NULL) {
+        return 0;
+    }
+    unsigned long pages = 0, resident = 0;
+    int fields = fscanf(statm, "%lu %lu", &pages, &resident);
+    fclose(statm);
+    return (fields == 2) ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+// Fills tree from keys with an insert loop and prints how far the
+// resident set grew, per item. The caller owns the tree and keeps every
+// measured tree alive until all are done, since memory freed by one would
+// be handed straight to the next and hide its growth.
+template<typename Tree>
+void benchMemory(const char* name, const vector<int>& keys, Tree& tree)
+{
+    size_t before = residentBytes();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], (int)i));
+    }
+    size_t after = residentBytes();
+    cout << name << "," << keys.size() << "," << (double)(after - before) / keys.size() << endl;
+}
+
+// ---------------------------------------------------------------------
+// Regression suite: bst-bench suite [--json] [size ...]
+//
+// Runs insert, find (hit and miss), remove, a full iteration, isBalanced
+// and clear on BinarySearchTree, AVLTree, RedBlackTree and std::map side by side, for
+// every key distribution, with int and std::string keys, at each size
+// (default 1K, 100K and 1M; anything up to 100M can be passed, memory
+// permitting). One CSV row, or JSON object, per tree/key/distribution/size.
+// ---------------------------------------------------------------------
+
+// Sizes below this are repeated until about this many inserts have been
+// timed, keeping the best run, so small trees do not just measure noise.
+static const size_t SUITE_MIN_OPS = 200000;
+// The find and remove phases time at most this many operations.
+static const size_t SUITE_MAX_PROBES = 1000000;
+// Sorted and reverse inserts turn a plain BST into a list, O(n^2) to
+// build, so it is skipped for them above this size.
+static const size_t SUITE_DEGENERATE_LIMIT = 20000;
+// Keys are twice a value below this, so every key is even and key + 1
+// is a guaranteed miss.
+static const int SUITE_KEY_SPACE = 1 << 30;
+
+enum SuiteDistribution { UNIFORM, SORTED, REVERSE, ZIPFIAN, CLUSTERED, DISTRIBUTION_COUNT };
+static const char* suiteDistributionNames[DISTRIBUTION_COUNT] = {
+    "uniform", "sorted", "reverse", "zipfian", "clustered"
+};
+
+struct SuiteResult
+{
+    const char* tree;
+    const char* keyType;
+    const char* distribution;
+    size_t n;
+    double insertNs;
+    double findHitNs;
+    double findMissNs;
+    double removeNs;
+    double iterateNs;
+    double isBalancedMs;    // negative when the tree has no isBalanced
+    double clearMs;
+};
+
+// Draws Zipf-distributed ranks in [0, n), rank 0 the most popular, with
+// the O(1)-per-draw method of Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases" (the one YCSB uses). Setup is O(n).
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double theta) :
+        n_(n), theta_(theta)
+    {
+        zetaN_ = zeta(n, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetaN_);
+    }
+
+    size_t operator()(std::mt19937_64& rng)
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetaN_;
+        if(uz < 1.0) {
+            return 0;
+        }
+        if(uz < 1.0 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        size_t rank = (size_t)(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    static double zeta(size_t n, double theta)
+    {
+        double sum = 0;
+        for(size_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow((double)i, theta);
+        }
+        return sum;
+    }
+
+    size_t n_;
+    double theta_;
+    double zetaN_;
+    double alpha_;
+    double eta_;
+};
+
+// Returns n even keys in insertion order for the given distribution.
+// Uniform and Zipfian keys repeat; the others do not.
+static vector<int> suiteKeys(SuiteDistribution distribution, size_t n)
+{
+    vector<int> keys(n);
+    std::mt19937_64 rng(n * DISTRIBUTION_COUNT + distribution);
+    const int mask = SUITE_KEY_SPACE - 1;
+    if(distribution == UNIFORM) {
+        for(size_t i = 0; i < n; ++i) {
+            keys[i] = 2 * (int)(rng() & mask);
+        }
+    }
+    else if(distribution == SORTED || distribution == REVERSE) {
+        for(size_t i = 0; i < n; ++i) {
+            keys[i] = 2 * (int)(distribution == SORTED ? i : n - 1 - i);
+        }
+    }
+    else if(distribution == ZIPFIAN) {
+        // scatter the ranks, so popular keys are not also neighbours; an
+        // odd multiplier is a bijection modulo a power of two
+        ZipfGenerator zipf(n, 0.99);
+        for(size_t i = 0; i < n; ++i) {
+            keys[i] = 2 * (int)((zipf(rng) * 2654435761u) & mask);
+        }
+    }
+    else {
+        // runs of 64 consecutive keys, each starting somewhere random
+        // (runs that land on each other just repeat keys)
+        for(size_t i = 0; i < n; i += 64) {
+            int base = (int)(rng() & mask & ~63);
+            for(size_t j = i; j < n && j < i + 64; ++j) {
+                keys[j] = 2 * (base + (int)(j - i));
+            }
+        }
+    }
+    return keys;
+}
+
+// Turns a suite key into the key type under test. String keys are 16
+// digits, zero padded so they sort like the ints, and one character too
+// long for the small string optimization, as most real string keys are.
+template<typename K>
+K suiteKey(int key);
+
+template<>
+int suiteKey<int>(int key)
+{
+    return key;
+}
+
+template<>
+std::string suiteKey<std::string>(int key)
+{
+    char buffer[20];
+    snprintf(buffer, sizeof(buffer), "%016d", key);
+    return std::string(buffer);
+}
+
+template<typename Tree, typename K>
+void suiteRemove(Tree& tree, const K& key)
+{
+    tree.remove(key);
+}
+
+template<typename K, typename V>
+void suiteRemove(std::map<K, V>& tree, const K& key)
+{
+    tree.erase(key);
+}
+
+template<typename Tree>
+bool suiteIsBalanced(const Tree& tree)
+{
+    return tree.isBalanced();
+}
+
+template<typename K, typename V>
+bool suiteIsBalanced(const std::map<K, V>& tree)
+{
+    return true;
+}
+
+// Times every phase on a tree of type Tree loaded with keys, in order,
+// and returns the best time of each phase over the repetitions.
+template<typename Tree, typename K>
+SuiteResult suiteRun(const char* treeName, const char* keyType, SuiteDistribution distribution,
+                     const vector<int>& keys)
+{
+    const size_t n = keys.size();
+    vector<K> inserts(n);
+    for(size_t i = 0; i < n; ++i) {
+        inserts[i] = suiteKey<K>(keys[i]);
+    }
+
+    // probe present keys in random order; the first half is removed later
+    vector<int> distinct(keys);
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    std::shuffle(distinct.begin(), distinct.end(), std::mt19937(99));
+    size_t probeCount = std::min(distinct.size(), SUITE_MAX_PROBES);
+    size_t removeCount = std::min(distinct.size() / 2, SUITE_MAX_PROBES);
+    vector<K> hits(probeCount);
+    vector<K> misses(probeCount);
+    for(size_t i = 0; i < probeCount; ++i) {
+        hits[i] = suiteKey<K>(distinct[i]);
+        misses[i] = suiteKey<K>(distinct[i] + 1);
+    }
+
+    SuiteResult result = { treeName, keyType, suiteDistributionNames[distribution], n,
+                           1e300, 1e300, 1e300, 1e300, 1e300, 1e300, 1e300 };
+    bool hasIsBalanced = true;
+    size_t repetitions = std::max<size_t>(1, SUITE_MIN_OPS / std::max<size_t>(n, 1));
+    for(size_t rep = 0; rep < repetitions; ++rep) {
+        std::unique_ptr<Tree> tree(new Tree());
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree->insert_or_assign(inserts[i], (int)i);
+        }
+        result.insertNs = std::min(result.insertNs, secondsSince(start) * 1e9 / n);
+
+        long long total = 0;
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < probeCount; ++i) {
+            total += tree->find(hits[i]) != tree->end();
+        }
+        result.findHitNs = std::min(result.findHitNs, secondsSince(start) * 1e9 / probeCount);
+
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < probeCount; ++i) {
+            total += tree->find(misses[i]) != tree->end();
+        }
+        result.findMissNs = std::min(result.findMissNs, secondsSince(start) * 1e9 / probeCount);
+
+        start = chrono::steady_clock::now();
+        for(typename Tree::iterator it = tree->begin(); it != tree->end(); ++it) {
+            total += it->second;
+        }
+        result.iterateNs = std::min(result.iterateNs, secondsSince(start) * 1e9 / tree->size());
+
+        start = chrono::steady_clock::now();
+        total += suiteIsBalanced(*tree);
+        result.isBalancedMs = std::min(result.isBalancedMs, secondsSince(start) * 1e3);
+        hasIsBalanced = !std::is_same<Tree, std::map<K, int> >::value;
+
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < removeCount; ++i) {
+            suiteRemove(*tree, hits[i]);
+        }
+        if(removeCount > 0) {
+            result.removeNs = std::min(result.removeNs, secondsSince(start) * 1e9 / removeCount);
+        }
+
+        start = chrono::steady_clock::now();
+        tree->clear();
+        result.clearMs = std::min(result.clearMs, secondsSince(start) * 1e3);
+        sink = total;
+    }
+    if(!hasIsBalanced) {
+        result.isBalancedMs = -1;
+    }
+    if(removeCount == 0) {
+        result.removeNs = 0;
+    }
+    return result;
+}
+
+// Prints one result as a CSV row, or as a JSON array element.
+static void suitePrint(const SuiteResult& result, bool json, bool first)
+{
+    if(json) {
+        cout << (first ? "[\n" : ",\n")
+             << "  {\"tree\": \"" << result.tree << "\", \"key\": \"" << result.keyType
+             << "\", \"distribution\": \"" << result.distribution << "\", \"n\": " << result.n
+             << ", \"insert_ns\": " << result.insertNs << ", \"find_hit_ns\": " << result.findHitNs
+             << ", \"find_miss_ns\": " << result.findMissNs << ", \"remove_ns\": " << result.removeNs
+             << ", \"iterate_ns\": " << result.iterateNs << ", \"is_balanced_ms\": ";
+        if(result.isBalancedMs < 0) {
+            cout << "null";
+        }
+        else {
+            cout << result.isBalancedMs;
+        }
+        cout << ", \"clear_ms\": " << result.clearMs << "}" << std::flush;
+        return;
+    }
+    if(first) {
+        cout << "tree,key,distribution,n,insert_ns,find_hit_ns,find_miss_ns,remove_ns,iterate_ns,"
+             << "is_balanced_ms,clear_ms" << endl;
+    }
+    cout << result.tree << "," << result.keyType << "," << result.distribution << "," << result.n
+         << "," << result.insertNs << "," << result.findHitNs << "," << result.findMissNs
+         << "," << result.removeNs << "," << result.iterateNs << ",";
+    if(result.isBalancedMs >= 0) {
+        cout << result.isBalancedMs;
+    }
+    cout << "," << result.clearMs << endl;
+}
+
+// Runs every tree with key type K on one key set.
+template<typename K>
+void suiteRunTrees(const char* keyType, SuiteDistribution distribution, const vector<int>& keys,
+                   bool json, bool& first)
+{
+    if((distribution != SORTED && distribution != REVERSE) || keys.size() <= SUITE_DEGENERATE_LIMIT) {
+        suitePrint(suiteRun<BinarySearchTree<K,int>, K>("BinarySearchTree", keyType, distribution, keys),
+                   json, first);
+        first = false;
+    }
+    else {
+        cerr << "skipping BinarySearchTree," << keyType << "," << suiteDistributionNames[distribution]
+             << "," << keys.size() << ": degenerates to a list" << endl;
+    }
+    suitePrint(suiteRun<AVLTree<K,int>, K>("AVLTree", keyType, distribution, keys), json, first);
+    first = false;
+    suitePrint(suiteRun<RedBlackTree<K,int>, K>("RedBlackTree", keyType, distribution, keys), json, first);
+    suitePrint(suiteRun<BPlusTree<K,int>, K>("BPlusTree", keyType, distribution, keys), json, first);
+    suitePrint(suiteRun<std::map<K,int>, K>("std::map", keyType, distribution, keys), json, first);
+}
+
+int runSuite(int argc, char* argv[])
+{
+    bool json = false;
+    vector<size_t> sizes;
+    for(int i = 0; i < argc; ++i) {
+        if(std::string(argv[i]) == "--json") {
+            json = true;
+        }
+        else {
+            sizes.push_back(strtoul(argv[i], NULL, 10));
+        }
+    }
+    if(sizes.empty()) {
+        sizes.push_back(1000);
+        sizes.push_back(100000);
+        sizes.push_back(1000000);
+    }
+
+    bool first = true;
+    for(size_t s = 0; s < sizes.size(); ++s) {
+        for(int d = 0; d < DISTRIBUTION_COUNT; ++d) {
+            SuiteDistribution distribution = (SuiteDistribution)d;
+            vector<int> keys = suiteKeys(distribution, sizes[s]);
+            suiteRunTrees<int>("int", distribution, keys, json, first);
+            suiteRunTrees<std::string>("string", distribution, keys, json, first);
+        }
+    }
+    if(json) {
+        cout << (first ? "[" : "") << "\n]" << endl;
+    }
+    return 0;
+}
+
+// A lookup skew for benchSkewedFinds: Zipf with exponent theta when that
+// is set, otherwise hotShare of the lookups go to a hot set of
+// hotFraction of the keys and the rest are uniform.
+struct SkewProfile
+{
+    const char* name;
+    double theta;
+    double hotFraction;
+    double hotShare;
+};
+
+// Times lookups drawn with the given skew from an n-key tree, on a
+// non-const tree so that the splay trees adjust, and prints nanoseconds
+// per lookup. Splaying costs writes on every lookup, so it only pays
+// where the hot keys are few and comparisons dear enough for the depth
+// it saves to matter: string keys under heavy skew. The semi and
+// every-Nth variants trade some of the depth for fewer writes.
+template<typename Tree, typename K>
+void benchSkewedFind(const char* name, const char* keyType, const char* skew, const vector<K>& keys,
+                     const vector<K>& probes, Tree& tree)
+{
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], (int)i));
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long total = 0;
+    for(size_t i = 0; i < probes.size(); ++i) {
+        total += tree.find(probes[i])->second;
+    }
+    double secs = secondsSince(start);
+    sink = total;
+
+    cout << name << "," << keyType << "," << keys.size() << "," << skew << ","
+         << (secs * 1e9 / probes.size()) << endl;
+}
+
+// Runs benchSkewedFind on AVLTree and the splay tree variants, with key
+// type K.
+template<typename K>
+void benchSkewedFinds(const char* keyType, const vector<int>& intKeys, const SkewProfile& skew)
+{
+    vector<K> keys(intKeys.size());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = suiteKey<K>(intKeys[i]);
+    }
+    // rank r is the r-th key of a shuffled order, so hot keys are not
+    // the ones inserted first
+    vector<K> byRank(keys);
+    std::shuffle(byRank.begin(), byRank.end(), std::mt19937(5));
+    std::mt19937_64 rng(17);
+    vector<K> probes(4 * keys.size());
+    if(skew.theta > 0) {
+        ZipfGenerator zipf(keys.size(), skew.theta);
+        for(size_t i = 0; i < probes.size(); ++i) {
+            probes[i] = byRank[zipf(rng)];
+        }
+    }
+    else {
+        size_t hot = std::max((size_t)1, (size_t)(keys.size() * skew.hotFraction));
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        for(size_t i = 0; i < probes.size(); ++i) {
+            probes[i] = byRank[(coin(rng) < skew.hotShare) ? rng() % hot : rng() % keys.size()];
+        }
+    }
+
+    {
+        AVLTree<K,int> avl;
+        benchSkewedFind("AVLTree", keyType, skew.name, keys, probes, avl);
+    }
+    {
+        SplayTree<K,int> splay;
+        benchSkewedFind("SplayTree", keyType, skew.name, keys, probes, splay);
+    }
+    {
+        SplayTree<K,int> semi;
+        semi.setSplayPolicy(SplayTree<K,int>::SEMI_SPLAY);
+        benchSkewedFind("SplayTree/semi", keyType, skew.name, keys, probes, semi);
+    }
+    {
+        SplayTree<K,int> every8;
+        every8.setSplayPolicy(SplayTree<K,int>::FULL_SPLAY, 8);
+        benchSkewedFind("SplayTree/every8", keyType, skew.name, keys, probes, every8);
+    }
+}
+
+// Usage: bst-bench [n [static_n ...]]
+//        bst-bench suite [--json] [size ...]
+// n sizes the main runs (default 1M). Each static_n adds a run of the
+// static index comparison at that size (default just n), e.g.
+// bst-bench 1000000 1000000 10000000 100000000
+// The second form runs the regression suite above instead.
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && std::string(argv[1]) == "suite") {
+        return runSuite(argc - 2, argv + 2);
+    }
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    cout << "node,bytes" << endl;
+    cout << "Node<int,int>," << sizeof(Node<int,int>) << endl;
+    cout << "AVLNode<int,int>," << sizeof(AVLNode<int,int>) << endl;
+    cout << "AVLNode<int,int,true>," << sizeof(AVLNode<int,int,true>) << endl;
+    cout << "RBNode<int,int>," << sizeof(RBNode<int,int>) << endl;
+    {
+        CompactAVLTree<int,int> slot;
+        slot.reserve(1);
+        cout << "CompactAVLTree<int,int> slot," << slot.arenaBytes() << endl;
+    }
+
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    // Measured first, before any other run has left freed memory about.
+    // Node-based trees also pay the allocator's per-node overhead.
+    cout << "\ntree,n,resident_bytes_per_item" << endl;
+    {
+        AVLTree<int,int> avl;
+        AVLTree<int,int,std::less<int>,PoolNodeAllocator> pooled;
+        RedBlackTree<int,int> redBlack;
+        BPlusTree<int,int> bplus;
+        CompactAVLTree<int,int> compact;
+        benchMemory("AVLTree", keys, avl);
+        benchMemory("AVLTree/pool", keys, pooled);
+        benchMemory("RedBlackTree", keys, redBlack);
+        benchMemory("BPlusTree", keys, bplus);
+        benchMemory("CompactAVLTree", keys, compact);
+    }
+
+    cout << "\ntree,n,ns_per_find" << endl;
+    benchFind<BinarySearchTree<int,int> >("BinarySearchTree", keys);
+    benchFind<AVLTree<int,int> >("AVLTree", keys);
+    benchFind<RedBlackTree<int,int> >("RedBlackTree", keys);
+    benchFind<OrderStatisticsTree<int,int> >("OrderStatisticsTree", keys);
+    benchFind<BPlusTree<int,int> >("BPlusTree", keys);
+    benchFind<CompactAVLTree<int,int> >("CompactAVLTree", keys);
+    benchFrozenFind<AVLTree<int,int> >("FrozenTree", keys);
+
+    cout << "\ntree,n,find_loop_ns,find_batch_ns" << endl;
+    benchFindBatch<BinarySearchTree<int,int> >("BinarySearchTree", keys);
+    benchFindBatch<AVLTree<int,int> >("AVLTree", keys);
+
+    cout << "\ntree,readers,reads_per_sec" << endl;
+    // hardware_concurrency() may return 0 when it cannot tell
+    unsigned hc = std::thread::hardware_concurrency();
+    benchConcurrentReads(n, (int)std::max(2u, hc > 1 ? hc - 1 : 1u));
+
+    // An insert loop over sorted keys degenerates the plain BST into a list,
+    // so only the AVL tree is timed both ways.
+    cout << "\ntree,n,insert_loop_ms,hinted_insert_ms,bulk_load_ms" << endl;
+    benchSortedLoad<AVLTree<int,int> >("AVLTree", n);
+    benchSortedLoad<OrderStatisticsTree<int,int> >("OrderStatisticsTree", n);
+
+    cout << "\ntree,n,threads,insert_loop_ms,sorted_bulk_load_ms,parallel_bulk_load_ms" << endl;
+    benchUnsortedLoad<AVLTree<int,int> >("AVLTree", n);
+    benchUnsortedLoad<AVLTree<int,int,std::less<int>,PoolNodeAllocator> >("AVLTree/pool", n);
+
+    // Write-heavy churn, where red-black's O(1) rotations per update
+    // should pay for its slightly taller tree.
+    cout << "\ntree,n,write_pct,ns_per_op" << endl;
+    const int writePcts[3] = { 100, 50, 10 };
+    for(int w = 0; w < 3; ++w) {
+        benchMixed<AVLTree<int,int> >("AVLTree", n, writePcts[w]);
+        benchMixed<RedBlackTree<int,int> >("RedBlackTree", n, writePcts[w]);
+        benchMixed<CompactAVLTree<int,int> >("CompactAVLTree", n, writePcts[w]);
+    }
+
+    cout << "\ntree,key,n,skew,ns_per_find" << endl;
+    const SkewProfile skews[4] = {
+        { "uniform", 0, 0, 0 },
+        { "zipf0.99", 0.99, 0, 0 },
+        { "hot1%/90%", 0, 0.01, 0.9 },
+        { "hot0.01%/99%", 0, 0.0001, 0.99 }
+    };
+    for(int k = 0; k < 4; ++k) {
+        benchSkewedFinds<int>("int", keys, skews[k]);
+        benchSkewedFinds<std::string>("string", keys, skews[k]);
+    }
+
+    cout << "\nop,n,m,threads,loop_ms,join_ms" << endl;
+    benchSetOps(n, n / 100);
+    benchSetOps(n, n);
+
+    cout << "\ntree,n,ns_per_find" << endl;
+    if(argc > 2) {
+        for(int i = 2; i < argc; ++i) {
+            benchStaticFind(strtoul(argv[i], NULL, 10));
+        }
+    }
+    else {
+        benchStaticFind(n);
+    }
+    return 0;
+}
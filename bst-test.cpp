@@ -1,7 +1,21 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <thread>
+#include <atomic>
 #include "bst.h"
 #include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "static_search_tree.h"
+#include "bplustree.h"
+#include "compact_avl.h"
+#include "concurrent_avl.h"
+#include "persistent_avl.h"
 
 using namespace std;
 
@@ -44,5 +58,437 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Red-black tree tests
+    RedBlackTree<int,int> rb;
+    for(int i = 0; i < 1000; ++i) {
+        rb.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        rb.remove(i);
+    }
+    cout << "\nRedBlackTree size: " << rb.size() << ", balanced: " << rb.isBalanced()
+         << ", height: " << rb.height() << ", value of 500: " << rb.find(500)->second << endl;
+
+    // Splay tree tests
+    SplayTree<int,int> st;
+    for(int i = 0; i < 1000; ++i) {
+        st.insert(std::make_pair(i, i));
+    }
+    cout << "\nSplayTree height after sorted inserts: " << st.height() << endl;
+    for(int rep = 0; rep < 3; ++rep) {
+        for(int i = 0; i < 1000; i += 100) {
+            st.find(i);
+        }
+    }
+    cout << "SplayTree value of 900: " << st.find(900)->second
+         << ", height after repeated finds: " << st.height() << endl;
+    st.setSplayPolicy(SplayTree<int,int>::SEMI_SPLAY, 4);
+    for(int i = 0; i < 1000; i += 3) {
+        st.remove(i);
+    }
+    cout << "Semi-splayed SplayTree size after removes: " << st.size()
+         << ", contains 500: " << (st.find(500) != st.end()) << endl;
+    // the range constructor must keep the comparator it is given; a
+    // default constructed std::function would throw on the first compare
+    std::vector<std::pair<int,int> > splayItems;
+    for(int i = 0; i < 10; ++i) {
+        splayItems.push_back(std::make_pair(i, i));
+    }
+    typedef SplayTree<int,int,std::function<bool(int,int)> > FnSplayTree;
+    FnSplayTree byFn(splayItems.rbegin(), splayItems.rend(), true,
+                     [](int a, int b) { return a > b; });
+    cout << "SplayTree with a std::function comparator, first: " << byFn.begin()->first
+         << ", contains 3: " << (byFn.find(3) != byFn.end()) << endl;
+    std::function<bool(int,int)> descending = [](int a, int b) { return a > b; };
+    BinarySearchTree<int,int,std::function<bool(int,int)> > bstByFn(splayItems.rbegin(), splayItems.rend(), true, descending);
+    AVLTree<int,int,std::function<bool(int,int)> > avlByFn(splayItems.begin(), splayItems.end(), true, descending);
+    RedBlackTree<int,int,std::function<bool(int,int)> > rbByFn(splayItems.begin(), splayItems.end(), true, descending);
+    CompactAVLTree<int,int,std::function<bool(int,int)> > compactByFn(splayItems.begin(), splayItems.end(), true, descending);
+    cout << "Range loaded with a std::function comparator, first keys: " << bstByFn.begin()->first
+         << " " << avlByFn.begin()->first << " " << rbByFn.begin()->first
+         << " " << compactByFn.begin()->first << endl;
+
+    // Pool allocated tree tests
+    AVLTree<int,int,std::less<int>,PoolNodeAllocator> pt;
+    for(int i = 0; i < 1000; ++i) {
+        pt.insert(std::make_pair(i, i*i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        pt.remove(i);
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        pt.insert(std::make_pair(i, -i));
+    }
+    int count = 0;
+    for(AVLTree<int,int,std::less<int>,PoolNodeAllocator>::iterator it = pt.begin(); it != pt.end(); ++it) {
+        ++count;
+    }
+    cout << "\nPool AVLTree holds " << count << " items" << endl;
+    pt.clear();
+    cout << "Pool AVLTree empty after clear: " << pt.empty() << endl;
+
+    // Bulk load tests
+    std::vector<std::pair<int,int> > sortedItems;
+    for(int i = 0; i < 1000; ++i) {
+        sortedItems.push_back(std::make_pair(i, i));
+    }
+    AVLTree<int,int> bulk(sortedItems.begin(), sortedItems.end());
+    BinarySearchTree<int,int> bulkBst(sortedItems.begin(), sortedItems.end());
+    cout << "\nBulk loaded AVLTree balanced: " << bulk.verifyBalance() << endl;
+    cout << "Bulk loaded BinarySearchTree balanced: " << bulkBst.isBalanced() << endl;
+    RedBlackTree<int,int> bulkRb(sortedItems.begin(), sortedItems.end());
+    for(int i = 0; i < 1000; i += 2) {
+        bulkRb.remove(i);
+    }
+    cout << "Bulk loaded RedBlackTree balanced after removes: " << bulkRb.isBalanced()
+         << ", size: " << bulkRb.size() << endl;
+    std::reverse(sortedItems.begin(), sortedItems.end());
+    bulk.assign(sortedItems.begin(), sortedItems.end(), true);
+    for(int i = 0; i < 1000; i += 3) {
+        bulk.remove(i);
+    }
+    cout << "Sorted-then-loaded AVLTree balanced after removes: " << bulk.verifyBalance()
+         << ", height: " << bulk.height() << endl;
+    std::vector<std::pair<int,int> > shuffledItems;
+    for(int i = 0; i < 100000; ++i) {
+        shuffledItems.push_back(std::make_pair((i * 7919) % 50000, i));
+    }
+    AVLTree<int,int,std::less<int>,PoolNodeAllocator> parallelBulk;
+    parallelBulk.assignParallel(shuffledItems.begin(), shuffledItems.end());
+    cout << "Parallel loaded AVLTree size: " << parallelBulk.size()
+         << ", balanced: " << parallelBulk.verifyBalance()
+         << ", value of 0: " << parallelBulk.find(0)->second << endl;
+
+    // Degenerate tree tests
+    BinarySearchTree<int,int> chain;
+    for(int i = 0; i < 2000; ++i) {
+        chain.insert(std::make_pair(i, i));
+    }
+    cout << "\nDegenerate BinarySearchTree height: " << chain.height()
+         << ", balanced: " << chain.isBalanced() << endl;
+    for(int i = 0; i < 2000; i += 2) {
+        chain.remove(i);
+    }
+    cout << "Degenerate BinarySearchTree height after removes: " << chain.height()
+         << ", balanced: " << chain.isBalanced() << endl;
+    chain.clear();
+    cout << "Degenerate BinarySearchTree empty after clear: " << chain.empty() << endl;
+    // A chain far deeper than any stack a recursive walk could survive.
+    // Each increasing key splays to the root with the old root as its
+    // left child, so this builds in O(n); the plain tree above would keep
+    // its heights all the way up on every insert, which is O(n^2).
+    SplayTree<int,int> deepChain;
+    for(int i = 0; i < 1000000; ++i) {
+        deepChain.insert(std::make_pair(i, i));
+    }
+    cout << "Deep SplayTree chain height: " << deepChain.height()
+         << ", balanced: " << deepChain.isBalanced() << endl;
+    deepChain.clear();
+    cout << "Deep SplayTree chain empty after clear: " << deepChain.empty() << endl;
+
+    // Comparator tests
+    AVLTree<int,int,std::greater<int> > desc;
+    for(int i = 0; i < 5; ++i) {
+        desc.insert(std::make_pair(i, i * i));
+    }
+    cout << "\nDescending AVLTree contents:";
+    for(AVLTree<int,int,std::greater<int> >::iterator it = desc.begin(); it != desc.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    AVLTree<std::string,int,std::less<> > words;
+    words.insert(std::make_pair(std::string("pear"), 1));
+    words.insert(std::make_pair(std::string("apple"), 2));
+    words.insert(std::make_pair(std::string("plum"), 3));
+    std::string_view probe("apple");
+    cout << "Found apple by string_view: " << (words.find(probe) != words.end())
+         << ", found fig: " << (words.find(std::string_view("fig")) != words.end()) << endl;
+
+    // Emplace and move-insert tests
+    AVLTree<int,std::vector<int> > lists;
+    std::vector<int> big(1000, 7);
+    std::pair<AVLTree<int,std::vector<int> >::iterator, bool> res =
+        lists.insert_or_assign(1, std::move(big));
+    cout << "\ninsert_or_assign new: " << res.second << ", size " << res.first->second.size()
+         << ", source emptied: " << big.empty() << endl;
+    res = lists.try_emplace(1, 5, 3);
+    cout << "try_emplace existing: " << res.second << ", size " << res.first->second.size() << endl;
+    res = lists.try_emplace(2, 5, 3);
+    cout << "try_emplace new: " << res.second << ", size " << res.first->second.size() << endl;
+    res = lists.emplace(2, std::vector<int>());
+    cout << "emplace existing: " << res.second << ", size " << res.first->second.size() << endl;
+    res = lists.insert(std::make_pair(2, std::vector<int>(4, 0)));
+    cout << "insert existing: " << res.second << ", size " << res.first->second.size() << endl;
+
+    // Hinted insert tests
+    AVLTree<int,int> stamps;
+    AVLTree<int,int>::iterator last = stamps.end();
+    for(int i = 0; i < 1000; ++i) {
+        // nearly increasing: every tenth key arrives a little late
+        int key = (i % 10 == 9) ? i - 5 : i;
+        last = stamps.insert(last, std::make_pair(key, i));
+    }
+    stamps.insert(stamps.end(), std::make_pair(5000, 0));
+    count = 0;
+    for(AVLTree<int,int>::iterator it = stamps.begin(); it != stamps.end(); ++it) {
+        ++count;
+    }
+    cout << "\nHinted AVLTree holds " << count << " items, balanced: " << stamps.verifyBalance() << endl;
+    cout << "Hinted AVLTree size(): " << stamps.size() << endl;
+    std::vector<int> wanted;
+    wanted.push_back(4);
+    wanted.push_back(5000);
+    wanted.push_back(-1);
+    std::vector<AVLTree<int,int>::iterator> hits;
+    stamps.findBatch(wanted, hits);
+    cout << "findBatch(4, 5000, -1) found: " << (hits[0] != stamps.end()) << " "
+         << (hits[1] != stamps.end()) << " " << (hits[2] != stamps.end()) << endl;
+
+    // Set operation tests
+    AVLTree<int,int> evens, threes;
+    for(int i = 0; i < 3000; ++i) {
+        evens.insert(std::make_pair(i * 2, 2));
+        threes.insert(std::make_pair(i * 3, 3));
+    }
+    AVLTree<int,int> both;
+    both.unite(evens);
+    both.intersect(threes);
+    AVLTree<int,int> onlyEvens;
+    onlyEvens.unite(evens);
+    onlyEvens.subtract(threes);
+    evens.unite(threes);
+    cout << "\nUnion size: " << evens.size() << ", balanced: " << evens.verifyBalance()
+         << ", [6]: " << evens[6] << ", [9]: " << evens[9] << endl;
+    cout << "Intersection size: " << both.size() << ", first: " << both.begin()->first
+         << ", last: " << std::prev(both.end())->first << endl;
+    cout << "Difference size: " << onlyEvens.size() << ", balanced: " << onlyEvens.verifyBalance()
+         << ", found 6: " << (onlyEvens.find(6) != onlyEvens.end()) << endl;
+
+    // Split and join tests; split needs the subtree sizes
+    OrderStatisticsTree<int,int> sharded(evens.begin(), evens.end());
+    OrderStatisticsTree<int,int> shard;
+    sharded.split(3000, shard);
+    cout << "Split at 3000: below " << sharded.size() << " items, last " << std::prev(sharded.end())->first
+         << "; above " << shard.size() << " items, first " << shard.begin()->first
+         << ", balanced: " << shard.verifyBalance() << endl;
+    sharded.join(shard);
+    cout << "Joined back: " << sharded.size() << " items, balanced: " << sharded.verifyBalance()
+         << ", other empty: " << shard.empty() << endl;
+
+    // Order statistics tests
+    OrderStatisticsTree<int,int> ranks;
+    for(int i = 0; i < 100; ++i) {
+        ranks.insert(std::make_pair(i * 10, i));
+    }
+    ranks.remove(500);
+    cout << "\nOrder statistics size: " << ranks.size()
+         << ", select(50): " << ranks.select(50)->first
+         << ", rank(505): " << ranks.rank(505)
+         << ", count in [100, 200): " << ranks.countRange(100, 200) << endl;
+
+    // Range query tests
+    cout << "\nlower_bound(95): " << ranks.lower_bound(95)->first
+         << ", upper_bound(100): " << ranks.upper_bound(100)->first
+         << ", floor(95): " << ranks.floor(95)->first
+         << ", ceiling(95): " << ranks.ceiling(95)->first << endl;
+    std::pair<OrderStatisticsTree<int,int>::iterator, OrderStatisticsTree<int,int>::iterator> same =
+        ranks.equal_range(300);
+    cout << "equal_range(300): [" << same.first->first << ", " << same.second->first << ")" << endl;
+    ranks.erase(ranks.lower_bound(200), ranks.lower_bound(700));
+    cout << "After erasing [200, 700): size " << ranks.size()
+         << ", balanced: " << ranks.verifyBalance()
+         << ", next after 190: " << ranks.upper_bound(190)->first << endl;
+
+    // Bidirectional iterator tests
+    cout << "\nLast item via std::prev(end()): " << std::prev(ranks.end())->first << endl;
+    cout << "Largest three in reverse:";
+    OrderStatisticsTree<int,int>::const_reverse_iterator rit = ranks.crbegin();
+    for(int i = 0; i < 3 && rit != ranks.crend(); ++i, ++rit) {
+        cout << " " << rit->first;
+    }
+    cout << endl;
+    count = 0;
+    for(OrderStatisticsTree<int,int>::const_iterator cit = ranks.cend(); cit != ranks.begin(); ) {
+        --cit;
+        ++count;
+    }
+    cout << "Backward walk visits " << count << " items" << endl;
+
+    // Frozen snapshot tests
+    FrozenTree<int,int> frozen = ranks.freeze();
+    ranks.insert(std::make_pair(5, 5));
+    cout << "\nFrozen snapshot size: " << frozen.size()
+         << ", find(150): " << frozen.find(150)->second
+         << ", found 5: " << (frozen.find(5) != frozen.end())
+         << ", lower_bound(195): " << frozen.lower_bound(195)->first
+         << ", last: " << frozen.rbegin()->first << endl;
+    FrozenTree<std::string,int,std::less<> > frozenWords = words.freeze();
+    cout << "Frozen words found apple by string_view: "
+         << (frozenWords.find(probe) != frozenWords.end()) << endl;
+
+    // Static search tree tests
+    StaticSearchTree<int,int> index(ranks.begin(), ranks.end());
+    cout << "\nStatic index size: " << index.size()
+         << ", find(150): " << index.find(150)->second
+         << ", found 155: " << (index.find(155) != index.end())
+         << ", upper_bound(190): " << index.upper_bound(190)->first << endl;
+    std::vector<std::pair<unsigned,int> > wide;
+    wide.push_back(std::make_pair(7u, 1));
+    wide.push_back(std::make_pair(4000000000u, 2));
+    StaticSearchTree<unsigned,int> wideIndex(wide.begin(), wide.end());
+    cout << "Unsigned static index lower_bound(8): " << wideIndex.lower_bound(8)->first << endl;
+
+    // B+ tree tests
+    BPlusTree<int,int> bp;
+    for(int i = 0; i < 1000; ++i) {
+        bp.insert(std::make_pair(i, i * i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        bp.remove(i);
+    }
+    bp[7] = -7;
+    int scanned = 0;
+    for(BPlusTree<int,int>::iterator it = bp.lower_bound(100); it != bp.end() && it->first < 200; ++it) {
+        ++scanned;
+    }
+    cout << "\nBPlusTree size: " << bp.size() << ", height: " << bp.height()
+         << ", [7]: " << bp[7] << ", found 8: " << (bp.find(8) != bp.end())
+         << ", items in [100, 200): " << scanned
+         << ", last: " << bp.rbegin()->first << endl;
+    bp.emplace(3, 30);
+    bp.try_emplace(7, 70);
+    bp.insert_or_assign(9, 90);
+    bp.insert(bp.end(), std::make_pair(5, 50));
+    BPlusTree<int,int>::iterator bpLow = bp.equal_range(9).first;
+    BPlusTree<int,int>::iterator bpPast = bp.erase(bp.find(101), bp.find(301));
+    for(BPlusTree<int,int>::iterator it = bp.find(501); it != bp.end(); ) {
+        it = bp.erase(it);
+    }
+    cout << "BPlusTree [3]: " << bp[3] << ", [7]: " << bp[7] << ", [9]: " << bpLow->second
+         << ", floor(100): " << bp.floor(100)->first << ", ceiling(100): " << bp.ceiling(100)->first
+         << ", after erased range: " << bpPast->first << ", size: " << bp.size()
+         << ", balanced: " << bp.isBalanced() << endl;
+    std::vector<std::pair<int,int> > bpItems;
+    for(int i = 0; i < 5000; ++i) {
+        bpItems.push_back(std::make_pair((i * 7919) % 5000, i));
+    }
+    bpItems.push_back(std::make_pair(42, -1));
+    BPlusTree<int,int,std::function<bool(int,int)> > bpByFn(bpItems.begin(), bpItems.end(), true, descending);
+    cout << "BPlusTree range loaded, size: " << bpByFn.size() << ", height: " << bpByFn.height()
+         << ", first: " << bpByFn.begin()->first << ", last: " << bpByFn.rbegin()->first
+         << ", [42]: " << bpByFn.find(42)->second << ", balanced: " << bpByFn.isBalanced() << endl;
+
+    // Compact AVL tree tests
+    CompactAVLTree<int,int> compact;
+    for(int i = 0; i < 1000; ++i) {
+        compact.insert(std::make_pair(i, i * i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        compact.remove(i);
+    }
+    CompactAVLTree<int,int>::iterator kept = compact.find(501);
+    for(int i = 1000; i < 1500; ++i) {
+        compact.insert(std::make_pair(i, i));
+    }
+    cout << "\nCompactAVLTree size: " << compact.size() << ", height: " << compact.height()
+         << ", balanced: " << compact.verifyBalance()
+         << ", [501] via old iterator: " << kept->second
+         << ", bytes per slot: " << compact.arenaBytes() / compact.capacity() << endl;
+    compact.erase(compact.lower_bound(1000), compact.end());
+    cout << "CompactAVLTree after erasing [1000, end): size " << compact.size()
+         << ", last: " << compact.rbegin()->first
+         << ", floor(600): " << compact.floor(600)->first
+         << ", balanced: " << compact.verifyBalance() << endl;
+    std::vector<std::pair<int,int> > compactItems;
+    for(int i = 0; i < 1000; ++i) {
+        compactItems.push_back(std::make_pair(i, i));
+    }
+    CompactAVLTree<int,int> compactBulk(compactItems.begin(), compactItems.end());
+    for(int i = 0; i < 1000; i += 3) {
+        compactBulk.remove(i);
+    }
+    cout << "Bulk loaded CompactAVLTree balanced after removes: " << compactBulk.verifyBalance()
+         << ", size: " << compactBulk.size() << endl;
+
+    // Concurrent reader tests
+    ConcurrentAVLTree<int,int> shared;
+    for(int i = 0; i < 1000; ++i) {
+        shared.insert(std::make_pair(i, i * 2));
+    }
+    std::thread writer([&shared]() {
+        for(int round = 0; round < 20; ++round) {
+            for(int i = 0; i < 1000; i += 2) {
+                shared.remove(i);
+            }
+            for(int i = 0; i < 1000; i += 2) {
+                shared.insert(std::make_pair(i, i * 2));
+            }
+            // overwrite the odd keys the readers look at, with the same values
+            for(int i = 1; i < 1000; i += 2) {
+                shared.insert(std::make_pair(i, i * 2));
+            }
+        }
+    });
+    std::atomic<int> missing(0);
+    std::thread reader([&shared, &missing]() {
+        for(int round = 0; round < 20; ++round) {
+            for(int i = 1; i < 1000; i += 2) {
+                if(!shared.contains(i) || shared.size() < 500) {
+                    ++missing;
+                }
+            }
+        }
+    });
+    int mismatches = 0;
+    for(int round = 0; round < 20; ++round) {
+        for(int i = 1; i < 1000; i += 2) {
+            int value = 0;
+            if(!shared.find(i, value) || value != i * 2) {
+                ++mismatches;
+            }
+        }
+    }
+    writer.join();
+    reader.join();
+    cout << "\nConcurrentAVLTree odd keys misread during writes: " << mismatches + missing
+         << ", size after: " << shared.size()
+         << ", contains 998: " << shared.contains(998) << endl;
+
+    // Persistent snapshot tests
+    PersistentAVLTree<int,int> versions;
+    for(int i = 0; i < 100; ++i) {
+        versions.insert(std::make_pair(i, i));
+    }
+    PersistentAVLTree<int,int>::Snapshot before = versions.snapshot();
+    for(int i = 0; i < 100; i += 2) {
+        versions.remove(i);
+    }
+    versions.insert(std::make_pair(1, -1));
+    PersistentAVLTree<int,int>::Snapshot after = versions.snapshot();
+    long total = 0;
+    for(PersistentAVLTree<int,int>::const_iterator it = before.begin(); it != before.end(); ++it) {
+        total += it->second;
+    }
+    cout << "\nPersistent snapshot before: size " << before.size() << ", sum " << total
+         << ", [1]: " << before.find(1)->second << endl;
+    cout << "Persistent snapshot after: size " << after.size()
+         << ", [1]: " << after.find(1)->second
+         << ", contains 2: " << after.contains(2)
+         << ", lower_bound(50): " << after.lower_bound(50)->first << endl;
+
+    // Hot-path counter tests (all zero unless built with -DBST_STATS)
+    TreeStats::reset();
+    AVLTree<int,int> counted;
+    for(int i = 0; i < 100; ++i) {
+        counted.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 100; ++i) {
+        counted.find(i);
+    }
+    TreeStats::Snapshot stats = TreeStats::snapshot();
+    cout << "\nTree stats compiled in: " << TreeStats::enabled << ", finds: " << stats.finds
+         << ", allocations: " << stats.allocations << ", rotations: " << stats.rotations << endl;
+
     return 0;
 }
@@ -5,20 +5,46 @@
 #include <exception> 
 #include <cstdlib>
 #include <utility>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <tuple>
+#include <iterator>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "node_alloc.h"
+#include "key_compare.h"
+#include "frozen_tree.h"
+#include "work_pool.h"
+#include "tree_stats.h"
 
 /**
- * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * A templated base class for a Node in a search tree.
+ * It is parameterized on the concrete node type (CRTP), so that
+ * getParent/getLeft/getRight hand back the derived node type
+ * without any virtual calls or casts. Future kinds of search
+ * trees, such as Red Black trees, Splay trees, and AVL trees,
+ * derive from NodeBase<Key, Value, TheirNode> and add their
+ * own bookkeeping. Nodes carry no vtable; the tree always knows
+ * the exact node type it allocated.
+ *
+ * The child links are plain pointers unless AtomicLinks is set, which
+ * only ConcurrentAVLTree does, so that its readers can walk the links
+ * while its writer changes them. Then setting a child is a release store,
+ * so a reader that loads the link with getLeftAcquire or getRightAcquire
+ * also sees the node behind it fully built, and getLeft and getRight are
+ * relaxed loads.
  */
-template <typename Key, typename Value>
-class Node
+template <typename Key, typename Value, typename Derived, bool AtomicLinks = false>
+class NodeBase
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    NodeBase(const Key& key, const Value& value, Derived* parent);
+    template<typename... Args>
+    NodeBase(std::in_place_t, Derived* parent, Args&&... itemArgs);
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +52,49 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Derived* getParent() const;
+    Derived* getLeft() const;
+    Derived* getRight() const;
+    // For readers that run alongside a writer; AtomicLinks only.
+    Derived* getLeftAcquire() const;
+    Derived* getRightAcquire() const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(Derived* parent);
+    void setLeft(Derived* left);
+    void setRight(Derived* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    Derived* parent_;
+    typedef typename std::conditional<AtomicLinks, std::atomic<Derived*>, Derived*>::type Link;
+    Link left_;
+    Link right_;
+};
+
+/**
+ * The plain node used by the unbalanced BinarySearchTree. It keeps the
+ * height of its subtree, and whether its children's heights differ by
+ * more than one, so the tree can answer height() and isBalanced()
+ * without a walk.
+ */
+template <typename Key, typename Value>
+class Node : public NodeBase<Key, Value, Node<Key, Value> >
+{
+public:
+    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
+    template<typename... Args>
+    Node(std::in_place_t, Node<Key, Value>* parent, Args&&... itemArgs);
+
+    int getHeight() const;
+    void setHeight(int height);
+    bool isUnbalanced() const;
+    void setUnbalanced(bool unbalanced);
+
+protected:
+    int height_;
+    bool unbalanced_;
 };
 
 /*
@@ -51,32 +106,102 @@ protected:
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+NodeBase<Key, Value, Derived, AtomicLinks>::NodeBase(const Key& key, const Value& value, Derived* parent) :
     item_(key, value),
     parent_(parent),
-    left_(NULL),
-    right_(NULL)
+    left_(nullptr),
+    right_(nullptr)
 {
 
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
-* are only used as references to existing nodes. The nodes pointed to by parent/left/right
-* are freed by the BinarySearchTree.
+* Constructs the item in place from itemArgs, which are passed straight to
+* the std::pair constructor (so a std::piecewise_construct argument list
+* works too). This lets the tree move keys and values into a node rather
+* than copy them.
+*/
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+template<typename... Args>
+NodeBase<Key, Value, Derived, AtomicLinks>::NodeBase(std::in_place_t, Derived* parent, Args&&... itemArgs) :
+    item_(std::forward<Args>(itemArgs)...),
+    parent_(parent),
+    left_(nullptr),
+    right_(nullptr)
+{
+
+}
+
+/**
+* Explicit constructor for a plain node. There is no destructor to write:
+* the pointers inside of a node are only used as references to existing
+* nodes, and the nodes pointed to by parent/left/right are freed by the
+* BinarySearchTree.
 */
 template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+    NodeBase<Key, Value, Node<Key, Value> >(key, value, parent),
+    height_(1),
+    unbalanced_(false)
 {
 
 }
 
 /**
-* A const getter for the item.
+* In-place constructor for a plain node; see the NodeBase one.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(std::in_place_t, Node<Key, Value>* parent, Args&&... itemArgs) :
+    NodeBase<Key, Value, Node<Key, Value> >(std::in_place, parent, std::forward<Args>(itemArgs)...),
+    height_(1),
+    unbalanced_(false)
+{
+
+}
+
+/**
+* Returns the height of the subtree rooted here (1 for a leaf).
+*/
+template<typename Key, typename Value>
+int Node<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+/**
+* Sets the height of the subtree rooted here.
 */
 template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+void Node<Key, Value>::setHeight(int height)
+{
+    height_ = height;
+}
+
+/**
+* Returns true if the children's heights differ by more than one.
+*/
+template<typename Key, typename Value>
+bool Node<Key, Value>::isUnbalanced() const
+{
+    return unbalanced_;
+}
+
+/**
+* Records whether the children's heights differ by more than one.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setUnbalanced(bool unbalanced)
+{
+    unbalanced_ = unbalanced;
+}
+
+/**
+* A const getter for the item.
+*/
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+const std::pair<const Key, Value>& NodeBase<Key, Value, Derived, AtomicLinks>::getItem() const
 {
     return item_;
 }
@@ -84,8 +209,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+std::pair<const Key, Value>& NodeBase<Key, Value, Derived, AtomicLinks>::getItem()
 {
     return item_;
 }
@@ -93,8 +218,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+const Key& NodeBase<Key, Value, Derived, AtomicLinks>::getKey() const
 {
     return item_.first;
 }
@@ -102,8 +227,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+const Value& NodeBase<Key, Value, Derived, AtomicLinks>::getValue() const
 {
     return item_.second;
 }
@@ -111,44 +236,74 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+Value& NodeBase<Key, Value, Derived, AtomicLinks>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent, already typed as the derived node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+Derived* NodeBase<Key, Value, Derived, AtomicLinks>::getParent() const
 {
     return parent_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child, already typed as the derived node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+Derived* NodeBase<Key, Value, Derived, AtomicLinks>::getLeft() const
 {
-    return left_;
+    if constexpr (AtomicLinks){
+      return left_.load(std::memory_order_relaxed);
+    }
+    else{
+      return left_;
+    }
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child, already typed as the derived node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+Derived* NodeBase<Key, Value, Derived, AtomicLinks>::getRight() const
 {
-    return right_;
+    if constexpr (AtomicLinks){
+      return right_.load(std::memory_order_relaxed);
+    }
+    else{
+      return right_;
+    }
+}
+
+/**
+* getLeft with acquire order, for a reader racing a writer.
+*/
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+Derived* NodeBase<Key, Value, Derived, AtomicLinks>::getLeftAcquire() const
+{
+    static_assert(AtomicLinks, "getLeftAcquire needs a node with AtomicLinks set");
+    return left_.load(std::memory_order_acquire);
+}
+
+/**
+* getRight with acquire order, for a reader racing a writer.
+*/
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+Derived* NodeBase<Key, Value, Derived, AtomicLinks>::getRightAcquire() const
+{
+    static_assert(AtomicLinks, "getRightAcquire needs a node with AtomicLinks set");
+    return right_.load(std::memory_order_acquire);
 }
 
 /**
 * A setter for setting the parent of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+void NodeBase<Key, Value, Derived, AtomicLinks>::setParent(Derived* parent)
 {
     parent_ = parent;
 }
@@ -156,30 +311,49 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+void NodeBase<Key, Value, Derived, AtomicLinks>::setLeft(Derived* left)
 {
-    left_ = left;
+    if constexpr (AtomicLinks){
+      left_.store(left, std::memory_order_release);
+    }
+    else{
+      left_ = left;
+    }
 }
 
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+void NodeBase<Key, Value, Derived, AtomicLinks>::setRight(Derived* right)
 {
-    right_ = right;
+    if constexpr (AtomicLinks){
+      right_.store(right, std::memory_order_release);
+    }
+    else{
+      right_ = right;
+    }
 }
 
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+void NodeBase<Key, Value, Derived, AtomicLinks>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
+/**
+* A setter that moves the new value into the node.
+*/
+template<typename Key, typename Value, typename Derived, bool AtomicLinks>
+void NodeBase<Key, Value, Derived, AtomicLinks>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -188,332 +362,1456 @@ void Node<Key, Value>::setValue(const Value& value)
 
 /**
 * A templated unbalanced binary search tree.
+* Nodes are obtained from an allocation policy (see node_alloc.h); the
+* default HeapNodeAllocator behaves like plain new/delete, while
+* PoolNodeAllocator carves nodes out of slabs and lets clear() drop the
+* whole tree at once.
+* NodeType is the concrete node the tree allocates; subclasses such as
+* AVLTree pass their own NodeBase-derived node so that every child access
+* is a plain, inlinable load.
+* Keys are ordered by Compare, as in std::map. With a transparent
+* comparator such as std::less<> the tree can also be searched by any
+* type the comparator accepts (e.g. std::string_view in a std::string
+* tree) without building a temporary key.
 */
-template <typename Key, typename Value>
+template<typename Key, typename Value, typename Compare = std::less<Key>,
+         typename Alloc = HeapNodeAllocator, typename NodeType = Node<Key, Value> >
 class BinarySearchTree
 {
 public:
-    BinarySearchTree(); //TODO //DONE
+    explicit BinarySearchTree(const Compare& comp = Compare()); //TODO //DONE
+    template<typename InputIt>
+    BinarySearchTree(InputIt first, InputIt last, bool sortFirst = false,
+                     const Compare& comp = Compare());
     virtual ~BinarySearchTree(); //TODO //DONE
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
-    virtual void remove(const Key& key); //TODO
+    void remove(const Key& key); //TODO
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last, bool sortFirst = false);
+    template<typename InputIt>
+    void assignParallel(InputIt first, InputIt last);
     void clear(); //TODO
-    bool isBalanced() const; //TODO
+    virtual bool isBalanced() const; //TODO
+    virtual int height() const;
     void print() const;
     bool empty() const;
+    size_t size() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPCompare, typename PPAlloc, typename PPNode>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare, PPAlloc, PPNode> & tree);
 public:
     /**
-    * An internal iterator class for traversing the contents of the BST.
+    * An internal iterator class for traversing the contents of the BST
+    * in either direction. iterator and const_iterator are the two
+    * instantiations; an iterator converts to a const_iterator and the
+    * two compare equal when they point at the same item.
+    * Besides the node, an iterator remembers its tree, so that stepping
+    * back from end() can go straight to the largest node.
     */
-    class iterator  
+    template<bool IsConst>
+    class TreeIterator
     {
     public:
-        iterator();
-
-        std::pair<const Key,Value>& operator*() const;
-        std::pair<const Key,Value>* operator->() const;
-
-        bool operator==(const iterator& rhs) const;
-        bool operator!=(const iterator& rhs) const;
-
-        iterator& operator++();
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+
+        TreeIterator();
+        template<bool OtherConst,
+                 typename = typename std::enable_if<IsConst && !OtherConst>::type>
+        TreeIterator(const TreeIterator<OtherConst>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool OtherConst>
+        bool operator==(const TreeIterator<OtherConst>& rhs) const;
+        template<bool OtherConst>
+        bool operator!=(const TreeIterator<OtherConst>& rhs) const;
+
+        TreeIterator& operator++();
+        TreeIterator operator++(int);
+        TreeIterator& operator--();
+        TreeIterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        friend class BinarySearchTree<Key, Value, Compare, Alloc, NodeType>;
+        template<bool> friend class TreeIterator;
+        TreeIterator(NodeType* ptr, const BinarySearchTree* tree);
+        NodeType *current_;
+        const BinarySearchTree* tree_;
     };
 
+    typedef TreeIterator<false> iterator;
+    typedef TreeIterator<true> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare,
+             typename = typename std::enable_if<IsTransparent<C>::value>::type>
+    iterator find(const K& key) const;
+    // Looks up many keys at once, out[i] being find(keys[i]). The
+    // descents are interleaved so their cache misses overlap.
+    void findBatch(const Key* keys, size_t count, iterator* out) const;
+    void findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Insertion. Each returns the item's position and whether a new node
+    // was made. insert and insert_or_assign overwrite an existing value;
+    // emplace and try_emplace leave an existing item untouched. Balanced
+    // subclasses hook in through leafFix() rather than overriding these,
+    // so a move-only Value only needs the overloads it actually calls.
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value);
+    // Hinted insertion: amortized O(1) when the key belongs right next to
+    // hint, e.g. hint is end() or the previous insert for increasing keys.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+
+    // Ordered lookups, all O(log n). floor is the last item not after key
+    // (end() if there is none); ceiling is the same as lower_bound.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+
+    // Removal by position; each returns the iterator after the last
+    // item removed.
+    iterator erase(iterator pos);
+    iterator erase(iterator first, iterator last);
+
+    // Read-only snapshot laid out for cache-friendly lookups; O(n).
+    FrozenTree<Key, Value, Compare> freeze() const;
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
-    static Node<Key, Value>* successor(Node<Key, Value>* current); // TODO
+    template<typename K>
+    NodeType* internalFind(const K& k) const; // TODO
+    NodeType* findInsertionPoint(const Key& key, NodeType*& parent, bool& isLeft) const;
+    NodeType* findInsertionPoint(NodeType* hint, const Key& key, NodeType*& parent, bool& isLeft) const;
+    void linkChild(NodeType* parent, bool isLeft, NodeType* child);
+    void beforeUnlink(NodeType* node);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplaceKey(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignKey(K&& key, M&& value);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignAt(NodeType* existing, NodeType* parent, bool isLeft, K&& key, M&& value);
+    NodeType *getSmallestNode() const;  // TODO
+    iterator iteratorAt(NodeType* node) const;
+    template<typename K>
+    NodeType* lowerBoundNode(const K& key) const;
+    template<typename K>
+    NodeType* upperBoundNode(const K& key) const;
+    virtual void removeNode(NodeType* current);
+    static NodeType* predecessor(NodeType* current); // TODO
+    static NodeType* successor(NodeType* current); // TODO
 
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
-    void deleteTree(Node<Key, Value>* root_);
-    int calculateHeight(Node<Key, Value>* root_) const;
+    void printRoot (NodeType *r) const;
+    virtual void nodeSwap( NodeType* n1, NodeType* n2) ;
+    void deleteTree(NodeType* root_);
+    static int calculateHeight(NodeType* root_, int depth = 0);
+
+    // An AVL tree of 2^64 nodes is under 93 levels tall, so no balanced
+    // tree this code can ever hold is taller than this.
+    static const int MAX_BALANCED_HEIGHT = 96;
+
+    // Number of lookups findBatch keeps in flight; enough to cover a
+    // memory miss with the compares of the others.
+    static const size_t FIND_BATCH_WIDTH = 16;
+
+    // assignParallel builds subtrees of fewer items than this on one thread.
+    static const size_t PARALLEL_BUILD_GRAIN = 1 << 14;
+
+    // Node lifetime goes through the allocation policy
+    template<typename... Args>
+    NodeType* createNode(NodeType* parent, Args&&... itemArgs);
+    template<typename... Args>
+    NodeType* createNodeIn(Alloc& arena, NodeType* parent, Args&&... itemArgs);
+    void destroyNode(NodeType* node);
+
+    // Bulk loading helpers
+    size_t collapseDuplicates(std::vector<std::pair<Key, Value> >& items) const;
+    int buildRange(std::pair<Key, Value>* items, size_t count, NodeType* parent, bool isLeft);
+    struct BuildArenas
+    {
+        std::mutex lock;
+        std::vector<std::unique_ptr<Alloc> > arenas;
+    };
+    int buildRangeParallel(std::pair<Key, Value>* items, size_t count, NodeType* parent, bool isLeft,
+                           Alloc& arena, BuildArenas& arenas);
+    virtual void buildFix(NodeType* node, int leftHeight, int rightHeight);
+    virtual void leafFix(NodeType* leaf);
+    virtual void hitFix(NodeType* node);
+
+    // Plain nodes keep their subtree heights, which heightFix updates
+    // on the way up from a change.
+    static const bool TRACKS_HEIGHT = std::is_same<NodeType, Node<Key, Value> >::value;
+    void heightFix(NodeType* node);
+    void unlinkNode(NodeType* current);
+
+protected:
+    NodeType* root_;
+    NodeType* rightmost_;   // largest node, or NULL when empty
+    size_t size_;           // number of nodes
+    int height_;            // kept up to date by AVLTree; plain nodes keep their own
+    size_t unbalanced_;     // plain nodes whose children differ in height by over 1
+    Alloc alloc_;
+    Compare comp_;
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the BinarySearchTree::iterator class.
+---------------------------------------------------------------
+*/
+
+/**
+* Explicit constructor that initializes an iterator with a given node
+* pointer (NULL for end()) and the tree it belongs to.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::TreeIterator(NodeType *ptr, const BinarySearchTree* tree)
+{
+    current_ = ptr;
+    tree_ = tree;
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::TreeIterator() 
+{
+  current_ = nullptr;
+  tree_ = nullptr;
+}
+
+/**
+* Converts an iterator into a const_iterator pointing at the same item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+template<bool OtherConst, typename>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::TreeIterator(const TreeIterator<OtherConst>& other)
+{
+    current_ = other.current_;
+    tree_ = other.tree_;
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::template TreeIterator<IsConst>::reference
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator*() const
+{
+    return current_->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::template TreeIterator<IsConst>::pointer
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator->() const
+{
+    return &(current_->getItem());
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+template<bool OtherConst>
+bool
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator==(const TreeIterator<OtherConst>& rhs) const
+{
+    return(this->current_ == rhs.current_);
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+template<bool OtherConst>
+bool
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator!=(const TreeIterator<OtherConst>& rhs) const
+{
+  return(this->current_ != rhs.current_);
+}
+
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::template TreeIterator<IsConst>&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator++()
+{
+  this->current_ = successor(current_);
+  return *this;
+}
+
+/**
+* Post-increment: advances the iterator and returns where it was.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::template TreeIterator<IsConst>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator++(int)
+{
+  TreeIterator before = *this;
+  this->current_ = successor(current_);
+  return before;
+}
+
+/**
+* Moves the iterator back one item. Stepping back from end() lands on the
+* largest item, which the tree keeps track of, so that is O(1); any other
+* step is amortized O(1) like operator++.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::template TreeIterator<IsConst>&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator--()
+{
+  if(this->current_ == nullptr){
+    this->current_ = tree_->rightmost_;
+  }
+  else{
+    this->current_ = predecessor(current_);
+  }
+  return *this;
+}
+
+/**
+* Post-decrement: moves the iterator back and returns where it was.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::template TreeIterator<IsConst>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::TreeIterator<IsConst>::operator--(int)
+{
+  TreeIterator before = *this;
+  --(*this);
+  return before;
+}
+
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::iterator class.
+-------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL
+* and orders keys with comp.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(const Compare& comp) :
+    comp_(comp)
+{
+    root_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
+    height_ = 0;
+    unbalanced_ = 0;
+}
+
+/**
+* Range constructor that bulk loads a tree ordered by comp; see assign().
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename InputIt>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(InputIt first, InputIt last, bool sortFirst,
+                                                                         const Compare& comp) :
+    comp_(comp)
+{
+    root_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
+    height_ = 0;
+    unbalanced_ = 0;
+    assign(first, last, sortFirst);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::~BinarySearchTree()
+{
+    clear();
+
+}
+
+/**
+* Replaces the contents of the tree with the key/value pairs in
+* [first, last), building a perfectly balanced tree in O(n) instead
+* of inserting one item at a time.
+* The range must be sorted by key unless sortFirst is true, in which
+* case it is sorted here (O(n log n)). As with insert(), a later item
+* with the same key overwrites an earlier one.
+* Throws std::invalid_argument if sortFirst is false and the range is
+* not sorted; the tree is left empty in that case.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::assign(InputIt first, InputIt last, bool sortFirst)
+{
+    clear();
+
+    std::vector<std::pair<Key, Value> > items(first, last);
+    if(sortFirst){
+      // stable, so duplicates keep their input order and the last one wins
+      std::stable_sort(items.begin(), items.end(),
+          [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return comp_(a.first, b.first);
+          });
+    }
+
+    size_t kept = collapseDuplicates(items);
+    try{
+      height_ = buildRange(items.data(), kept, nullptr, false);
+    }
+    catch(...){
+      clear();
+      throw;
+    }
+}
+
+/**
+* assign(first, last, true) for big inputs, on every thread of the shared
+* WorkPool: the items are sorted with a parallel merge sort, then the
+* tree is built with the two halves of each big enough subtree made in
+* parallel. Every stolen half allocates its nodes from an arena of its
+* own, a fresh Alloc, so the policy needs no locking; the tree's
+* allocator adopts the arenas once the build is over. As with insert(),
+* a later item with the same key overwrites an earlier one. Collapsing
+* duplicates is still one pass on one thread.
+* If an item's construction throws, the tree is left empty.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::assignParallel(InputIt first, InputIt last)
+{
+    clear();
+
+    std::vector<std::pair<Key, Value> > items(first, last);
+    parallelStableSort(items,
+        [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+          return comp_(a.first, b.first);
+        });
+    size_t kept = collapseDuplicates(items);
+    if(kept == 0){
+      return;
+    }
+
+    BuildArenas arenas;
+    std::exception_ptr error;
+    try{
+      height_ = buildRangeParallel(items.data(), kept, nullptr, false, alloc_, arenas);
+    }
+    catch(...){
+      error = std::current_exception();
+    }
+    //every node is the tree's to free from here on, even after a throw
+    for(size_t i = 0; i < arenas.arenas.size(); ++i){
+      alloc_.adopt(*arenas.arenas[i]);
+    }
+    if(error){
+      clear();
+      std::rethrow_exception(error);
+    }
+
+    size_ = kept;
+    rightmost_ = root_;
+    while(rightmost_->getRight() != nullptr){
+      rightmost_ = rightmost_->getRight();
+    }
+}
+
+/**
+* Copies the items into a FrozenTree, whose find() visits a contiguous
+* array instead of chasing node pointers. The snapshot is independent of
+* the tree: changing the tree afterwards does not affect it.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::freeze() const
+{
+    return FrozenTree<Key, Value, Compare>(begin(), end(), comp_);
+}
+
+/**
+* Builds a balanced subtree from count sorted items and hangs it off
+* parent (or makes it the root). Each node is linked in as soon as it
+* exists, so a throwing allocation never leaks a detached subtree.
+* The items are moved into the nodes. Returns the height of the subtree.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+int BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::buildRange(std::pair<Key, Value>* items, size_t count, NodeType* parent, bool isLeft)
+{
+    if(count == 0){
+      return 0;
+    }
+    //the middle item becomes the root; the left half is never shorter
+    size_t mid = count / 2;
+    NodeType* node = createNode(parent, std::move(items[mid].first), std::move(items[mid].second));
+    linkChild(parent, isLeft, node);
+
+    int leftHeight = buildRange(items, mid, node, true);
+    int rightHeight = buildRange(items + mid + 1, count - mid - 1, node, false);
+
+    buildFix(node, leftHeight, rightHeight);
+    return std::max(leftHeight, rightHeight) + 1;
+}
+
+/**
+* Squeezes runs of equal keys in the sorted items down to one item each,
+* keeping the last value seen, and returns how many items are left at
+* the front. Throws std::invalid_argument if items are not sorted.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+size_t BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::collapseDuplicates(std::vector<std::pair<Key, Value> >& items) const
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < items.size(); ++i){
+      if(kept > 0 && !comp_(items[kept-1].first, items[i].first)){
+        if(comp_(items[i].first, items[kept-1].first)){
+          throw std::invalid_argument("assign: range is not sorted by key");
+        }
+        items[kept-1].second = std::move(items[i].second);
+      }
+      else{
+        if(kept != i){
+          items[kept] = std::move(items[i]);
+        }
+        ++kept;
+      }
+    }
+    return kept;
+}
+
+/**
+* buildRange for assignParallel. Nodes come from arena, and when count
+* is big enough the right half is offered to the WorkPool with an arena
+* of its own (registered in arenas before use, so it gets adopted even if
+* the build throws). Nodes are linked in as they are made, as in
+* buildRange, but size_ and rightmost_ are left to the caller, since
+* linkChild would race on them.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+int BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::buildRangeParallel(std::pair<Key, Value>* items, size_t count, NodeType* parent, bool isLeft,
+                                                                              Alloc& arena, BuildArenas& arenas)
+{
+    if(count == 0){
+      return 0;
+    }
+    size_t mid = count / 2;
+    NodeType* node = createNodeIn(arena, parent, std::move(items[mid].first), std::move(items[mid].second));
+    if(parent == nullptr){
+      root_ = node;
+    }
+    else if(isLeft){
+      parent->setLeft(node);
+    }
+    else{
+      parent->setRight(node);
+    }
+
+    int leftHeight;
+    int rightHeight;
+    if(count < PARALLEL_BUILD_GRAIN){
+      leftHeight = buildRangeParallel(items, mid, node, true, arena, arenas);
+      rightHeight = buildRangeParallel(items + mid + 1, count - mid - 1, node, false, arena, arenas);
+    }
+    else{
+      WorkPool::shared().invoke(
+          [&](){ leftHeight = buildRangeParallel(items, mid, node, true, arena, arenas); },
+          [&](){
+            Alloc* own;
+            {
+              std::lock_guard<std::mutex> lock(arenas.lock);
+              arenas.arenas.push_back(std::unique_ptr<Alloc>(new Alloc()));
+              own = arenas.arenas.back().get();
+            }
+            rightHeight = buildRangeParallel(items + mid + 1, count - mid - 1, node, false, *own, arenas);
+          });
+    }
+
+    buildFix(node, leftHeight, rightHeight);
+    return std::max(leftHeight, rightHeight) + 1;
+}
+
+/**
+* Called for every node created by a bulk load, once both subtrees are
+* built. Plain nodes just record their height: a bulk loaded tree is
+* balanced everywhere.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::buildFix(NodeType* node, int leftHeight, int rightHeight)
+{
+    if constexpr (TRACKS_HEIGHT){
+      node->setHeight(std::max(leftHeight, rightHeight) + 1);
+    }
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+ * Returns the number of items in the tree, in O(1).
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+size_t BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::begin() const
+{
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator begin(getSmallestNode(), this);
+    return begin;
+}
+
+/**
+* Wraps a node in an iterator (NULL gives end()). Lets subclasses hand
+* out iterators, since only this class can build them.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iteratorAt(NodeType* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::end() const
+{
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator end(NULL, this);
+    return end;
+}
+
+/**
+* Returns a const_iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns the const_iterator that means INVALID
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree. This is
+* O(1) and walks backwards without copying anything.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator one before the "smallest" item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Const version of rbegin().
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+/**
+* Const version of rend().
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::find(const Key & k) const
+{
+    NodeType *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Heterogeneous version of find, only available with a transparent
+* comparator: k can be any type Compare accepts against a Key, so no
+* temporary Key is built.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::find(const K & k) const
+{
+    NodeType *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Looks up keys[0..count) and stores find(keys[i]) in out[i].
+* Rather than one descent after another, up to FIND_BATCH_WIDTH descents
+* advance a level each in turn, and each prefetches the next node it
+* will visit. By the time a lookup comes round again that node is
+* usually in cache, so the misses of the whole group overlap instead of
+* being paid one at a time. A finished lookup hands its lane to the
+* next key, keeping the group full.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findBatch(const Key* keys, size_t count, iterator* out) const
+{
+    struct Lookup
+    {
+      NodeType* node;
+      NodeType* candidate;   // last node not after the key, as in internalFind
+      size_t index;
+    };
+
+    if(root_ == nullptr){
+      for(size_t i = 0; i < count; ++i){
+        out[i] = end();
+      }
+      return;
+    }
+
+    Lookup lanes[FIND_BATCH_WIDTH];
+    size_t active = 0;
+    size_t next = 0;
+    while(active < FIND_BATCH_WIDTH && next < count){
+      lanes[active].node = root_;
+      lanes[active].candidate = nullptr;
+      lanes[active].index = next++;
+      ++active;
+    }
+
+    while(active > 0){
+      for(size_t i = 0; i < active; ){
+        Lookup& lookup = lanes[i];
+        const Key& key = keys[lookup.index];
+        NodeType* node = lookup.node;
+        if(comp_(key, node->getKey())){
+          node = node->getLeft();
+        }
+        else{
+          lookup.candidate = node;
+          node = node->getRight();
+        }
+        if(node != nullptr){
+#if defined(__GNUC__)
+          __builtin_prefetch(node);
+#endif
+          lookup.node = node;
+          ++i;
+          continue;
+        }
+
+        //This lookup reached the bottom
+        NodeType* found = lookup.candidate;
+        if(found != nullptr && comp_(found->getKey(), key)){
+          found = nullptr;
+        }
+        out[lookup.index] = iteratorAt(found);
+        if(next < count){
+          lookup.node = root_;
+          lookup.candidate = nullptr;
+          lookup.index = next++;
+          ++i;
+        }
+        else{
+          //no keys left: move the last lane here and look at it next
+          lookup = lanes[--active];
+        }
+      }
+    }
+}
+
+/**
+* Vector version of findBatch; out is resized to match keys.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    out.resize(keys.size());
+    findBatch(keys.data(), keys.size(), out.data());
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+Value& BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](const Key& key)
+{
+    NodeType *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+Value const & BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](const Key& key) const
+{
+    NodeType *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    return assignKey(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Same as above, but the value is moved into the tree instead of copied.
+* (The key is const inside the pair, so it is still copied.)
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return assignKey(keyValuePair.first, std::move(keyValuePair.second));
+}
 
-protected:
-    Node<Key, Value>* root_;
-};
+/**
+* Inserts (or overwrites, like insert above) using hint as a starting
+* point. If the key belongs immediately before or after hint, or after
+* the largest key when hint is end(), no descent from the root is made,
+* so feeding each insert the iterator returned by the previous one makes
+* in-order or nearly in-order loads amortized O(1) per item. A wrong hint
+* only costs a normal insert. Returns an iterator to the item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    NodeType* parent;
+    bool isLeft;
+    NodeType* existing = findInsertionPoint(hint.current_, keyValuePair.first, parent, isLeft);
+    return assignAt(existing, parent, isLeft, keyValuePair.first, keyValuePair.second).first;
+}
 
-/*
---------------------------------------------------------------
-Begin implementations for the BinarySearchTree::iterator class.
----------------------------------------------------------------
+/**
+* Hinted insert that moves the value into the tree.
 */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    NodeType* parent;
+    bool isLeft;
+    NodeType* existing = findInsertionPoint(hint.current_, keyValuePair.first, parent, isLeft);
+    return assignAt(existing, parent, isLeft, keyValuePair.first, std::move(keyValuePair.second)).first;
+}
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Builds the item in a new node straight from args (anything a
+* std::pair<const Key, Value> can be constructed from), then links the
+* node in. As with std::map::emplace the node has to exist before its
+* key can be looked up, so if the key is already present the new node is
+* thrown away and the existing item is left alone.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::emplace(Args&&... args)
 {
-    current_ = ptr;
+    NodeType* node = createNode(nullptr, std::forward<Args>(args)...);
+    NodeType* parent;
+    bool isLeft;
+    NodeType* existing;
+    try{
+      existing = findInsertionPoint(node->getKey(), parent, isLeft);
+    }
+    catch(...){
+      destroyNode(node);
+      throw;
+    }
+    if(existing != nullptr){
+      destroyNode(node);
+      hitFix(existing);
+      return std::make_pair(iteratorAt(existing), false);
+    }
+    node->setParent(parent);
+    linkChild(parent, isLeft, node);
+    leafFix(node);
+    return std::make_pair(iteratorAt(node), true);
 }
 
 /**
-* A default constructor that initializes the iterator to NULL.
+* Inserts key with a value constructed from args, unless key is already
+* present, in which case nothing is constructed and args are not touched.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::try_emplace(const Key& key, Args&&... args)
 {
-  current_ = nullptr;
+    return emplaceKey(key, std::forward<Args>(args)...);
 }
 
 /**
-* Provides access to the item.
+* As above, moving key into the new node.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::try_emplace(Key&& key, Args&&... args)
 {
-    return current_->getItem();
+    return emplaceKey(std::move(key), std::forward<Args>(args)...);
 }
 
 /**
-* Provides access to the address of the item.
+* Inserts key with the given value, or assigns value to the existing item
+* if key is already present. value is forwarded, so an rvalue is moved.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert_or_assign(const Key& key, M&& value)
 {
-    return &(current_->getItem());
+    return assignKey(key, std::forward<M>(value));
 }
 
 /**
-* Checks if 'this' iterator's internals have the same value
-* as 'rhs'
+* As above, moving key into the new node if one is made.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert_or_assign(Key&& key, M&& value)
 {
-    return(this->current_ == rhs.current_);
+    return assignKey(std::move(key), std::forward<M>(value));
 }
 
 /**
-* Checks if 'this' iterator's internals have a different value
-* as 'rhs'
+* Shared body of try_emplace: one descent, and the node is only built
+* (piecewise, from key and args) once we know the key is new.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::emplaceKey(K&& key, Args&&... args)
 {
-  return(this->current_ != rhs.current_);
+    NodeType* parent;
+    bool isLeft;
+    NodeType* existing = findInsertionPoint(key, parent, isLeft);
+    if(existing != nullptr){
+      hitFix(existing);
+      return std::make_pair(iteratorAt(existing), false);
+    }
+    NodeType* inserted = createNode(parent, std::piecewise_construct,
+                                    std::forward_as_tuple(std::forward<K>(key)),
+                                    std::forward_as_tuple(std::forward<Args>(args)...));
+    linkChild(parent, isLeft, inserted);
+    leafFix(inserted);
+    return std::make_pair(iteratorAt(inserted), true);
 }
 
+/**
+* Shared body of insert and insert_or_assign: one descent, then either
+* the existing value is assigned or a new leaf is made (a new root for
+* an empty tree); see assignAt.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::assignKey(K&& key, M&& value)
+{
+    NodeType* parent;
+    bool isLeft;
+    NodeType* existing = findInsertionPoint(key, parent, isLeft);
+    return assignAt(existing, parent, isLeft, std::forward<K>(key), std::forward<M>(value));
+}
 
 /**
-* Advances the iterator's location using an in-order sequencing
+* Finishes an insert once the descent is done: assigns value to existing
+* if there is one, otherwise makes a new node for key at parent/isLeft.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::assignAt(NodeType* existing, NodeType* parent, bool isLeft, K&& key, M&& value)
 {
-  this->current_ = successor(current_);
-  return *this;
+    //Key already there, overwrite the value
+    if(existing != nullptr){
+      existing->getValue() = std::forward<M>(value);
+      hitFix(existing);
+      return std::make_pair(iteratorAt(existing), false);
+    }
+    //New leaf (or new root for an empty tree)
+    NodeType* inserted = createNode(parent, std::forward<K>(key), std::forward<M>(value));
+    linkChild(parent, isLeft, inserted);
+    leafFix(inserted);
+    return std::make_pair(iteratorAt(inserted), true);
 }
 
+/**
+* Descends from the root looking for key, making one ordering decision
+* per level. Returns the node holding key if there is one. Otherwise
+* returns NULL and sets parent/isLeft to where a new node for key
+* belongs (parent is NULL for an empty tree).
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findInsertionPoint(const Key& key, NodeType*& parent, bool& isLeft) const
+{
+    NodeType* current = root_;
+    parent = nullptr;
+    isLeft = false;
+
+    if constexpr (UsesThreeWay<Compare, Key, Key>::value){
+      while(current != nullptr){
+        int order = threeWayCompare(comp_, key, current->getKey());
+        if(order == 0){
+          return current;
+        }
+        parent = current;
+        isLeft = order < 0;
+        current = isLeft ? current->getLeft() : current->getRight();
+      }
+      return nullptr;
+    }
+
+    //the last node we went right from is the only one that can equal key
+    NodeType* candidate = nullptr;
+    while(current != nullptr){
+      parent = current;
+      isLeft = comp_(key, current->getKey());
+      if(isLeft){
+        current = current->getLeft();
+      }
+      else{
+        candidate = current;
+        current = current->getRight();
+      }
+    }
+    if(candidate != nullptr && !comp_(candidate->getKey(), key)){
+      return candidate;
+    }
+    return nullptr;
+}
 
-/*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
+/**
+* Same contract as findInsertionPoint above, but tries the spot next to
+* hint (NULL meaning end()) first:
+*  - after the rightmost node, when hint is end() or the rightmost node,
+*  - between hint's predecessor and hint,
+*  - between hint and its successor.
+* Each check is one or two comparisons plus a predecessor/successor step;
+* if none applies we fall back to a descent from the root.
 */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findInsertionPoint(NodeType* hint, const Key& key, NodeType*& parent, bool& isLeft) const
+{
+    parent = nullptr;
+    isLeft = false;
+    if(root_ == nullptr){
+      return nullptr;
+    }
+    //Append fast path: straight to the largest node
+    if((hint == nullptr || hint == rightmost_) && comp_(rightmost_->getKey(), key)){
+      parent = rightmost_;
+      return nullptr;
+    }
+    if(hint != nullptr){
+      //key goes just before hint
+      if(comp_(key, hint->getKey())){
+        NodeType* before = predecessor(hint);
+        if(before == nullptr || comp_(before->getKey(), key)){
+          //one of the two is always missing the child we need
+          if(hint->getLeft() == nullptr){
+            parent = hint;
+            isLeft = true;
+          }
+          else{
+            parent = before;
+          }
+          return nullptr;
+        }
+      }
+      //key goes just after hint
+      else if(comp_(hint->getKey(), key)){
+        NodeType* after = successor(hint);
+        if(after == nullptr || comp_(key, after->getKey())){
+          if(hint->getRight() == nullptr){
+            parent = hint;
+          }
+          else{
+            parent = after;
+            isLeft = true;
+          }
+          return nullptr;
+        }
+      }
+      //hint holds key
+      else{
+        return hint;
+      }
+    }
+    return findInsertionPoint(key, parent, isLeft);
+}
 
-/*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+/**
+* Called after insert links in a brand new leaf, so balanced subclasses
+* can restore their invariants. A plain BST only updates the heights
+* above the leaf.
 */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::leafFix(NodeType* leaf)
+{
+    if constexpr (TRACKS_HEIGHT){
+      heightFix(leaf->getParent());
+    }
+}
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* Called when an insert or emplace finds its key already in the tree, so
+* self-adjusting subclasses can count it as an access. The shape of the
+* tree is unchanged, so there is nothing to do here.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::hitFix(NodeType* node)
 {
-    root_ = nullptr;
+
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Recomputes the height and balance flag of node, whose children have
+* changed, and of its ancestors, keeping unbalanced_ in step. Stops at
+* the first node whose height comes out the same, since nothing above it
+* can have changed. That is O(1) amortized for random inserts, and never
+* more than the length of the path the change was made at.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::heightFix(NodeType* node)
 {
-    clear();
+    while(node != nullptr){
+      int leftHeight = (node->getLeft() != nullptr) ? node->getLeft()->getHeight() : 0;
+      int rightHeight = (node->getRight() != nullptr) ? node->getRight()->getHeight() : 0;
+      bool unbalanced = std::abs(leftHeight - rightHeight) > 1;
+      if(unbalanced != node->isUnbalanced()){
+        node->setUnbalanced(unbalanced);
+        if(unbalanced){
+          ++unbalanced_;
+        }
+        else{
+          --unbalanced_;
+        }
+      }
+      int height = std::max(leftHeight, rightHeight) + 1;
+      if(height == node->getHeight()){
+        return;
+      }
+      node->setHeight(height);
+      node = node->getParent();
+    }
+}
 
+/**
+* Hangs child off parent on the given side, or makes it the root when
+* parent is NULL. Every new node comes through here, which keeps
+* size_ and rightmost_ current.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::linkChild(NodeType* parent, bool isLeft, NodeType* child)
+{
+    ++size_;
+    if(parent == nullptr){
+      root_ = child;
+      rightmost_ = child;
+    }
+    else if(isLeft){
+      parent->setLeft(child);
+    }
+    else{
+      parent->setRight(child);
+      if(parent == rightmost_){
+        rightmost_ = child;
+      }
+    }
 }
 
 /**
- * Returns true if tree is empty
+* Called by remove() while node is still linked in, just before it is
+* taken out of the tree. Rotations and node swaps never change which node
+* is largest, so removal is the only other place rightmost_ can move.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::beforeUnlink(NodeType* node)
 {
-    return root_ == NULL;
+    --size_;
+    if(node == rightmost_){
+      rightmost_ = predecessor(node);
+    }
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+
+/**
+* Returns an iterator to the first item whose key is not before key, or
+* end() if there is none.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lower_bound(const Key& key) const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return iteratorAt(lowerBoundNode(key));
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Returns an iterator to the first item whose key is after key, or end()
+* if there is none.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::upper_bound(const Key& key) const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return iteratorAt(upperBoundNode(key));
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Returns [lower_bound(key), upper_bound(key)), which holds the item with
+* key if there is one and is empty otherwise. Keys are unique, so the
+* upper end is just the successor of a match; no second descent is made.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator,
+          typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::equal_range(const Key& key) const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    NodeType* low = lowerBoundNode(key);
+    NodeType* high = low;
+    if(low != nullptr && !comp_(key, low->getKey())){
+      high = successor(low);
+    }
+    return std::make_pair(iteratorAt(low), iteratorAt(high));
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Returns an iterator to the last item whose key is not after key, or
+* end() if every key is after it.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::floor(const Key& key) const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    NodeType* current = root_;
+    NodeType* candidate = nullptr;
+    while(current != nullptr){
+      if(comp_(key, current->getKey())){
+        current = current->getLeft();
+      }
+      else{
+        candidate = current;
+        current = current->getRight();
+      }
+    }
+    return iteratorAt(candidate);
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+* Returns an iterator to the first item whose key is not before key, or
+* end() if there is none; another name for lower_bound.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::ceiling(const Key& key) const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    return lower_bound(key);
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/**
+* Removes the item at pos, which must not be end(), and returns an
+* iterator to the item after it. No lookup is needed.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::erase(iterator pos)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    NodeType* next = successor(pos.current_);
+    removeNode(pos.current_);
+    return iteratorAt(next);
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Removes every item in [first, last) and returns last.
+* Each node is unlinked directly, so unlike calling remove() per key no
+* lookup is made; the walk to the next node is amortized O(1). Erasing
+* the whole tree is handed to clear(), which skips rebalancing and, with
+* a pool allocator, may free everything at once.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::erase(iterator first, iterator last)
 {
-    //Insert into an empty tree
-    if(root_ == nullptr){
-      Node<Key,Value>* rootNode = new Node<Key, Value> (keyValuePair.first, keyValuePair.second, nullptr);
-      root_ = rootNode;
+    if(last.current_ == nullptr && first.current_ == getSmallestNode()){
+      clear();
+      return last;
     }
-
-    //Not an empty tree
-    else{
-        //Start at the root
-        Node<Key,Value>* current = root_;
-        while(current != nullptr){
-          //Going to the left
-            if(current->getKey() > keyValuePair.first){
-              //Space is open on the left
-                if(current->getLeft() == nullptr){
-                    Node<Key,Value>* inserted = new Node<Key, Value> (keyValuePair.first, keyValuePair.second, current);
-                    current->setLeft(inserted);
-                    break;
-                }
-                //Keep on traversing left
-                else{
-                    current = current->getLeft();
-                }
-            }
-            //Going to the right 
-            else if(current->getKey() < keyValuePair.first){
-                //Space open on right
-                if(current->getRight() == nullptr){
-                    Node<Key,Value> *inserted = new Node<Key,Value>(keyValuePair.first,keyValuePair.second, current);
-                    current->setRight(inserted);
-                    break;
-                }
-                //Keep on travering right for open space 
-                else{
-                    current = current->getRight();
-                }
-            }
-            else{
-                //Set value of inserted node at root 
-                current->setValue(keyValuePair.second);
-                break;
-            }
-        }
+    NodeType* current = first.current_;
+    while(current != last.current_){
+      NodeType* next = successor(current);
+      removeNode(current);
+      current = next;
     }
+    return last;
 }
 
-
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
+* Does nothing if the key is not there.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::remove(const Key& key)
+{
+    NodeType* current = internalFind(key);
+    if(current != nullptr){
+      removeNode(current);
+    }
+}
+
+/**
+* Unlinks and destroys a node that is in the tree. Subclasses override
+* this to rebalance; remove() and erase() both come through here.
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::removeNode(NodeType* current)
 {
-    Node<Key, Value>* current = internalFind(key);
-    //empty tree, nothing to remove
-    if(current == nullptr){
-        return;
-    }
+    beforeUnlink(current);
     
     //two children, call nodeswap with predecessor
     if(current->getLeft() != nullptr && current->getRight()!= nullptr){
       nodeSwap(current, predecessor(current));
     }
 
+    //only the node's ancestors can change height
+    NodeType* parent = current->getParent();
+    unlinkNode(current);
+    if constexpr (TRACKS_HEIGHT){
+      if(current->isUnbalanced()){
+        --unbalanced_;
+      }
+    }
+    destroyNode(current);
+    if constexpr (TRACKS_HEIGHT){
+      heightFix(parent);
+    }
+}
+
+/**
+* Takes current, which has at most one child, out of the tree, putting
+* the child in its place.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::unlinkNode(NodeType* current)
+{
     //node to remove is a leaf
     if(current->getLeft() == nullptr && current->getRight() == nullptr){
       //leaf child is the root!
       if(current->getParent() == nullptr){
         root_ = nullptr;
-        delete current;
         return;
       }
       //left lead node
@@ -524,22 +1822,20 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
       else if(current->getParent()->getRight() == current){
         current->getParent()->setRight(nullptr);
       }
-      delete current;
       return;
     }
 
     //if node to be removed has one right lead child 
     else if(current->getRight() != nullptr && current->getLeft() == nullptr){
       //Right child and parent variable to avoid segfaults
-      Node <Key, Value>* RC = current->getRight();
-      Node <Key, Value>* parent = current->getParent();
+      NodeType* RC = current->getRight();
+      NodeType* parent = current->getParent();
 
       //case that it is the root
       if(current == root_){
         current->setRight(nullptr);
         RC->setParent(nullptr);
         root_ = RC;
-        delete current;
         return;
       }
       //it is a left child of  parent & adjust pointers
@@ -548,7 +1844,6 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         RC->setParent(parent);
         current->setParent(nullptr);
         current->setRight(nullptr);
-        delete current;
         return;
       }
       //node is right child of parent & adjust pointers
@@ -557,21 +1852,19 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         RC->setParent(parent);
         current->setParent(nullptr);
         current->setLeft(nullptr);
-        delete current;
         return;
       }
     }
 
 // current has one left child 
   else if(current->getRight() == nullptr && current->getLeft() != nullptr){
-    Node <Key, Value>* LC = current->getLeft();
-    Node <Key, Value>* parent = current->getParent();
+    NodeType* LC = current->getLeft();
+    NodeType* parent = current->getParent();
     //root
     if(current == root_){
       current->setLeft(nullptr);
       LC->setParent(nullptr);
       root_ = LC;
-      delete current;
       return;
       }
       //is left of its parent & adjust pointers
@@ -580,7 +1873,6 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         LC->setParent(parent);
         current->setParent(nullptr);
         current->setLeft(nullptr);
-        delete current;
         return;
       }
       //is right of its parent & adjust pointers
@@ -589,7 +1881,6 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         LC->setParent(parent);
         current->setParent(nullptr);
         current->setRight(nullptr);
-        delete current;
         return;
     }
   }
@@ -597,9 +1888,9 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 
 
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::predecessor(NodeType* current)
 {
     if(current->getLeft() != nullptr){
       current = current->getLeft();
@@ -615,7 +1906,7 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     }
 
     else{
-      Node<Key,Value>*parent = current->getParent();
+      NodeType*parent = current->getParent();
       //is 
       if(parent == nullptr || parent->getLeft() != current ){
         return current->getParent();
@@ -635,9 +1926,9 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 return current;
 }
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::successor(NodeType* current)
 {
     if(current->getRight() != nullptr){
       current = current->getRight();
@@ -652,7 +1943,7 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
       }
     }
     else{
-      Node<Key,Value>* parent = current->getParent();
+      NodeType* parent = current->getParent();
       if(parent == nullptr || parent->getRight() != current){
         return current->getParent();
       }
@@ -670,33 +1961,120 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* Iterative, so it cannot overflow the stack on a degenerate tree, and
+* O(1) extra space. Each node is freed as soon as its children have been
+* read; right children still to be visited wait on a fixed-size array.
+* If that array is full, the current node is rotated right instead, which
+* moves its left child up without needing to remember anything, so the
+* teardown is O(n) whatever the shape of the tree.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::deleteTree(Node<Key, Value> *root_){
-if (root_ == nullptr) {return;} 
-  
-    deleteTree(root_->getLeft()); //subtree to left 
-    deleteTree(root_->getRight()); //subtree to right 
-      
-    delete root_; // final deletion 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::deleteTree(NodeType *root_){
+    NodeType* pending[MAX_BALANCED_HEIGHT];
+    int numPending = 0;
+    NodeType* current = root_;
+
+    while(current != nullptr || numPending > 0){
+      if(current == nullptr){
+        current = pending[--numPending];
+        continue;
+      }
+      NodeType* left = current->getLeft();
+      NodeType* right = current->getRight();
+      if(left != nullptr && right != nullptr && numPending == MAX_BALANCED_HEIGHT){
+        //no room to remember the right subtree, so rotate right
+        current->setLeft(left->getRight());
+        left->setRight(current);
+        current = left;
+        continue;
+      }
+      destroyNode(current); // final deletion 
+      if(left == nullptr){
+        current = right;
+      }
+      else{
+        if(right != nullptr){
+          pending[numPending++] = right;
+        }
+        current = left;
+      }
+    }
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+/**
+* Empties the tree. When the allocator can drop all of its nodes at once
+* and the nodes have nothing to destruct, this is O(1) in the number of
+* nodes; otherwise every node is visited and destroyed.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clear()
 {
-    deleteTree(root_);
+    bool skipWalk = Alloc::releasesInBulk &&
+                    std::is_trivially_destructible<Key>::value &&
+                    std::is_trivially_destructible<Value>::value;
+    if(!skipWalk){
+      deleteTree(root_);
+    }
+    alloc_.release();
     root_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
+    height_ = 0;
+    unbalanced_ = 0;
+}
+
+/**
+* Constructs a node in storage taken from the allocation policy, building
+* its item in place from itemArgs.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::createNode(NodeType* parent, Args&&... itemArgs)
+{
+    return createNodeIn(alloc_, parent, std::forward<Args>(itemArgs)...);
+}
+
+/**
+* createNode with the storage taken from arena instead of the tree's own
+* allocator, for parallel bulk loads.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::createNodeIn(Alloc& arena, NodeType* parent, Args&&... itemArgs)
+{
+    void* mem = arena.allocate(sizeof(NodeType));
+    try{
+      NodeType* node = new (mem) NodeType(std::in_place, parent, std::forward<Args>(itemArgs)...);
+      TreeStats::countAllocation();
+      return node;
+    }
+    catch(...){
+      arena.deallocate(mem);
+      throw;
+    }
+}
+
+/**
+* Destroys a node and hands its storage back to the allocation policy,
+* which may recycle it for the next insert.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::destroyNode(NodeType* node)
+{
+    node->~NodeType();
+    alloc_.deallocate(node);
+    TreeStats::countDeallocation();
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::getSmallestNode() const
 {
-    Node<Key, Value>* rootcpy = root_;
+    NodeType* rootcpy = root_;
   //Traverse to leftmost node
     while(rootcpy != nullptr && rootcpy->getLeft()!= nullptr){
       rootcpy = rootcpy->getLeft();
@@ -707,61 +2085,163 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
-* exists
+* exists. Makes one ordering decision per level: a single three-way
+* compare (or, for arithmetic keys, a single machine compare) with an
+* early exit on a match, otherwise one Compare call per level plus one
+* equivalence check at the bottom.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
-{
-    Node<Key, Value>* rootcpy = root_;
-    //Begining of search 
-    while(rootcpy != nullptr && rootcpy->getKey() != key ){
-      if (key > rootcpy->getKey())
-            rootcpy = rootcpy->getRight();
- 
-        // pass left subtree as new tree
-        else if (key < rootcpy->getKey())
-            rootcpy = rootcpy->getLeft();
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::internalFind(const K& key) const
+{
+    NodeType* rootcpy = root_;
+    //Only read by TreeStats, so compiled away when it is off
+    size_t visited = 0;
+    if constexpr (UsesThreeWay<Compare, K, Key>::value){
+      while(rootcpy != nullptr){
+        ++visited;
+        int order = threeWayCompare(comp_, key, rootcpy->getKey());
+        if(order == 0){
+          TreeStats::countFind(visited, visited);
+          return rootcpy;
+        }
+        rootcpy = (order < 0) ? rootcpy->getLeft() : rootcpy->getRight();
+      }
+      TreeStats::countFind(visited, visited);
+      return nullptr;
+    }
+    else if constexpr (UsesBuiltinEquality<Compare, K, Key>::value){
+      //Keep this shape: the != test and the select share one compare,
+      //and the select compiles to a conditional move
+      while(rootcpy != nullptr && rootcpy->getKey() != key){
+        ++visited;
+        rootcpy = comp_(key, rootcpy->getKey()) ? rootcpy->getLeft() : rootcpy->getRight();
+      }
+      size_t matched = (rootcpy != nullptr);
+      TreeStats::countFind(visited + matched, 2 * visited + matched);
+      return rootcpy;
+    }
+
+    //Remember the last node not greater than key; only it can match
+    NodeType* candidate = nullptr;
+    while(rootcpy != nullptr){
+      ++visited;
+      if(comp_(key, rootcpy->getKey())){
+        rootcpy = rootcpy->getLeft();
+      }
+      else{
+        candidate = rootcpy;
+        rootcpy = rootcpy->getRight();
+      }
     }
+    TreeStats::countFind(visited, visited + (candidate != nullptr));
     //Key was not found
-    if(rootcpy == nullptr){
+    if(candidate == nullptr || comp_(candidate->getKey(), key)){
       return nullptr;
     }
     //Key is found
-    if(rootcpy->getKey() == key){
-      return rootcpy;
+    return candidate;
+}
+
+/**
+* Returns the first node whose key is not before key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lowerBoundNode(const K& key) const
+{
+    NodeType* current = root_;
+    NodeType* candidate = nullptr;
+    while(current != nullptr){
+      if(comp_(current->getKey(), key)){
+        current = current->getRight();
+      }
+      else{
+        candidate = current;
+        current = current->getLeft();
+      }
     }
-    else{
-      return nullptr;
+    return candidate;
+}
+
+/**
+* Returns the first node whose key is after key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::upperBoundNode(const K& key) const
+{
+    NodeType* current = root_;
+    NodeType* candidate = nullptr;
+    while(current != nullptr){
+      if(comp_(key, current->getKey())){
+        candidate = current;
+        current = current->getLeft();
+      }
+      else{
+        current = current->getRight();
+      }
     }
+    return candidate;
 }
 
 /**
- * Return true iff the BST is balanced.
+ * Returns the height of the subtree at root if every node in it is
+ * balanced, or -1 if it is not. depth is how far root is below the node
+ * the check started from.
+ * A balanced tree with fewer than 2^64 nodes is at most
+ * MAX_BALANCED_HEIGHT levels tall, so any path longer than that already
+ * proves the tree is unbalanced and the recursion stops there. That
+ * bounds the stack to a fixed number of frames even on a degenerate
+ * tree, while keeping a plain recursive walk, which beat hand-rolled
+ * explicit-stack versions on balanced trees.
  */
- template<typename Key, typename Value>
- int BinarySearchTree<Key,Value>::calculateHeight(Node<Key, Value> *root) const {
+ template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+ int BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::calculateHeight(NodeType *root, int depth) {
    //Function from lab 
    if(root == nullptr){
      return 0;
    }
+   if(depth >= MAX_BALANCED_HEIGHT){
+     return -1;
+   }
 
-  int left  = calculateHeight(root->getLeft());
-	int right = calculateHeight(root->getRight());
- 
-  if(left < 0 || right < 0){
-    return -1;
+  //empty children are handled here instead of by a call that returns 0,
+  //which saves a call for roughly half of all subtrees
+  int left = 0;
+  int right = 0;
+  if(root->getLeft() != nullptr){
+    left = calculateHeight(root->getLeft(), depth + 1);
+    if(left < 0){
+      return -1;
+    }
+  }
+  if(root->getRight() != nullptr){
+    right = calculateHeight(root->getRight(), depth + 1);
+    if(right < 0){
+      return -1;
+    }
   }
 
-  else if(std::abs(left-right) > 1){
+  if(std::abs(left-right) > 1){
     return -1;
   }
   
   return std::max(left,right) + 1;
  }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+/**
+ * Return true iff the BST is balanced.
+ * Plain nodes count the unbalanced ones as they change, so this is O(1)
+ * on top of the O(log n) amortized upkeep in insert and remove; other
+ * node types fall back to walking the tree.
+ */
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::isBalanced() const
 {
+    if constexpr (TRACKS_HEIGHT){
+      return unbalanced_ == 0;
+    }
     //Function from lab
     if(calculateHeight(root_) != -1){
       return true;
@@ -769,25 +2249,75 @@ bool BinarySearchTree<Key, Value>::isBalanced() const
     return false;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+/**
+ * Returns the number of levels in the tree (0 when empty).
+ * Plain nodes keep their heights, so that is just the root's. Otherwise
+ * walks the tree through parent pointers while tracking the current depth,
+ * so it uses O(1) extra space and no recursion.
+ */
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+int BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::height() const
+{
+    if constexpr (TRACKS_HEIGHT){
+      return (root_ != nullptr) ? root_->getHeight() : 0;
+    }
+    NodeType* prev = nullptr;
+    NodeType* current = root_;
+    int depth = 0;
+    int height = 0;
+
+    while(current != nullptr){
+      NodeType* next;
+      //arrived from above
+      if(prev == current->getParent()){
+        ++depth;
+        height = std::max(height, depth);
+        if(current->getLeft() != nullptr){
+          next = current->getLeft();
+        }
+        else if(current->getRight() != nullptr){
+          next = current->getRight();
+        }
+        else{
+          next = current->getParent();
+        }
+      }
+      //came up from the left subtree
+      else if(prev == current->getLeft() && current->getRight() != nullptr){
+        next = current->getRight();
+      }
+      //done with both subtrees
+      else{
+        next = current->getParent();
+      }
+      if(next == current->getParent()){
+        --depth;
+      }
+      prev = current;
+      current = next;
+    }
+    return height;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap( NodeType* n1, NodeType* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    NodeType* n1p = n1->getParent();
+    NodeType* n1r = n1->getRight();
+    NodeType* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    NodeType* n2p = n2->getParent();
+    NodeType* n2r = n2->getRight();
+    NodeType* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    NodeType* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -851,6 +2381,15 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+    // heights and balance flags describe positions, not items
+    if constexpr (TRACKS_HEIGHT){
+        int tempHeight = n1->getHeight();
+        n1->setHeight(n2->getHeight());
+        n2->setHeight(tempHeight);
+        bool tempUnbalanced = n1->isUnbalanced();
+        n1->setUnbalanced(n2->isUnbalanced());
+        n2->setUnbalanced(tempUnbalanced);
+    }
 }
 
 /**
@@ -0,0 +1,1788 @@
+#ifndef COMPACT_AVL_H
+#define COMPACT_AVL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "key_compare.h"
+#include "tree_stats.h"
+
+/**
+ * An AVL tree with the same interface as BinarySearchTree, so code can
+ * switch between the two with a typedef, laid out for memory rather than
+ * for pointer chasing.
+ *
+ * Every item lives in a slot of one contiguous arena, and slots refer to
+ * each other by 32-bit index instead of by pointer. The parent index only
+ * needs 30 bits (the tree holds at most MAX_ITEMS items), so the balance
+ * factor rides in the two bits left over. A slot is the item plus 12
+ * bytes, with no per-node allocation behind it: for int keys and values
+ * that is 20 bytes an item, against 40 for an AVLNode plus the heap's
+ * own header on each node.
+ *
+ * Removed slots go on a free list that later inserts take from first, and
+ * the arena grows by doubling, moving the items to the new block. Items
+ * therefore do move: a pointer or reference to an item is only good until
+ * the next insert. Iterators hold an index, not a pointer, so they stay
+ * valid across inserts just as BinarySearchTree's do, and an erase only
+ * invalidates iterators to the erased item.
+ *
+ * The rebalancing is the AVLTree one (the CSCI104 insertFix/removeFix
+ * cases), done on indices. Not carried over: findBatch, hinted insert,
+ * assignParallel, freeze and print.
+ */
+template<typename Key, typename Value, typename Compare = std::less<Key> >
+class CompactAVLTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    // Slot indices are 30 bits, and one value is kept to mean "no slot".
+    static constexpr size_t MAX_ITEMS = (size_t(1) << 30) - 1;
+
+    explicit CompactAVLTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    CompactAVLTree(InputIt first, InputIt last, bool sortFirst = false,
+                   const Compare& comp = Compare());
+    ~CompactAVLTree();
+    void remove(const Key& key);
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last, bool sortFirst = false);
+    void clear();
+    void reserve(size_t count);
+    // isBalanced is an O(1) check of height against size; verifyBalance
+    // is an O(n) check of every slot's balance, for tests and debugging.
+    bool isBalanced() const;
+    bool verifyBalance() const;
+    int height() const;
+    bool empty() const;
+    size_t size() const;
+    // Slots in the arena, used or not, and the bytes they take up.
+    size_t capacity() const;
+    size_t arenaBytes() const;
+
+    /**
+    * Iterator over the items in key order. It holds the tree and a slot
+    * index, so it survives the arena moving; an iterator converts to a
+    * const_iterator and the two compare equal at the same item.
+    */
+    template<bool IsConst>
+    class TreeIterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+
+        TreeIterator();
+        template<bool OtherConst,
+                 typename = typename std::enable_if<IsConst && !OtherConst>::type>
+        TreeIterator(const TreeIterator<OtherConst>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool OtherConst>
+        bool operator==(const TreeIterator<OtherConst>& rhs) const;
+        template<bool OtherConst>
+        bool operator!=(const TreeIterator<OtherConst>& rhs) const;
+
+        TreeIterator& operator++();
+        TreeIterator operator++(int);
+        TreeIterator& operator--();
+        TreeIterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        template<bool> friend class TreeIterator;
+        TreeIterator(uint32_t index, const CompactAVLTree* tree);
+        uint32_t index_;
+        const CompactAVLTree* tree_;
+    };
+
+    typedef TreeIterator<false> iterator;
+    typedef TreeIterator<true> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator find(const Key& key) const;
+    template<typename K, typename C = Compare,
+             typename = typename std::enable_if<IsTransparent<C>::value>::type>
+    iterator find(const K& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    // Insertion overwrites the value of an existing key, as in
+    // BinarySearchTree, and returns the item's position and whether it is new.
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value);
+
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+
+    iterator erase(iterator pos);
+    iterator erase(iterator first, iterator last);
+
+private:
+    CompactAVLTree(const CompactAVLTree&);
+    CompactAVLTree& operator=(const CompactAVLTree&);
+
+    // The item is only constructed while the slot is in use. A free slot
+    // has link == FREE_SLOT and keeps the next free slot in left.
+    struct Slot
+    {
+        alignas(value_type) unsigned char item[sizeof(value_type)];
+        uint32_t left;
+        uint32_t right;
+        uint32_t link;      // parent << 2 | (balance + 1)
+    };
+
+    static constexpr uint32_t NIL = uint32_t(MAX_ITEMS);
+    static constexpr uint32_t FREE_SLOT = 0xFFFFFFFFu;
+    static constexpr uint32_t MIN_CAPACITY = 16;
+    // An AVL tree of MAX_ITEMS items is well under this tall.
+    static constexpr int MAX_HEIGHT = 64;
+
+    //Slot access
+    value_type& itemAt(uint32_t index) const;
+    const Key& keyAt(uint32_t index) const;
+    uint32_t getParent(uint32_t index) const;
+    int getBalance(uint32_t index) const;
+    void setParent(uint32_t index, uint32_t parent);
+    void setBalance(uint32_t index, int balance);
+    iterator iteratorAt(uint32_t index) const;
+
+    //Arena management
+    template<typename... Args>
+    uint32_t createSlot(uint32_t parent, Args&&... args);
+    void destroySlot(uint32_t index);
+    Slot* allocateSlots(size_t count);
+    void relocateSlots(Slot* to);
+
+    //Lookups
+    template<typename K>
+    uint32_t findSlot(const K& key) const;
+    uint32_t findInsertionPoint(const Key& key, uint32_t& parent, bool& isLeft) const;
+    uint32_t lowerBoundSlot(const Key& key) const;
+    uint32_t smallestSlot(uint32_t index) const;
+    uint32_t largestSlot(uint32_t index) const;
+    uint32_t successor(uint32_t index) const;
+    uint32_t predecessor(uint32_t index) const;
+
+    //Insertion and removal
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignKey(K&& key, M&& value);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplaceKey(K&& key, Args&&... args);
+    void linkChild(uint32_t parent, bool isLeft, uint32_t child);
+    void leafFix(uint32_t leaf);
+    void insertFix(uint32_t parent, uint32_t current);
+    void removeSlot(uint32_t current);
+    void removeFix(uint32_t current, int diff);
+    void rotateRight(uint32_t current);
+    void rotateLeft(uint32_t current);
+
+    //Checking
+    int verifiedHeight(uint32_t index, uint32_t parent, int depth, size_t& count) const;
+
+    //Bulk loading
+    int buildRange(std::pair<Key, Value>* items, size_t count, uint32_t parent, bool isLeft);
+    size_t collapseDuplicates(std::vector<std::pair<Key, Value> >& items) const;
+
+private:
+    Slot* slots_;
+    uint32_t capacity_;   // slots allocated
+    uint32_t used_;       // slots ever handed out; those past it are untouched
+    uint32_t free_;       // head of the free list, or NIL
+    uint32_t root_;       // NIL when empty
+    size_t size_;
+    int height_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLTree::iterator class.
+  ---------------------------------------------------
+*/
+
+/**
+* Initializes an iterator at a slot of tree (NIL for end()).
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::TreeIterator(uint32_t index, const CompactAVLTree* tree) :
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to end() of no tree.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::TreeIterator() :
+    index_(NIL),
+    tree_(nullptr)
+{
+
+}
+
+/**
+* Converts an iterator into a const_iterator at the same item.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+template<bool OtherConst, typename>
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::TreeIterator(const TreeIterator<OtherConst>& other) :
+    index_(other.index_),
+    tree_(other.tree_)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename CompactAVLTree<Key, Value, Compare>::template TreeIterator<IsConst>::reference
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator*() const
+{
+    return tree_->itemAt(index_);
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename CompactAVLTree<Key, Value, Compare>::template TreeIterator<IsConst>::pointer
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator->() const
+{
+    return &(tree_->itemAt(index_));
+}
+
+/**
+* Checks if 'this' iterator is at the same item as 'rhs'.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+template<bool OtherConst>
+bool
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator==(const TreeIterator<OtherConst>& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+/**
+* Checks if 'this' iterator is at a different item than 'rhs'.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+template<bool OtherConst>
+bool
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator!=(const TreeIterator<OtherConst>& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the in-order successor.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename CompactAVLTree<Key, Value, Compare>::template TreeIterator<IsConst>&
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator++()
+{
+    index_ = tree_->successor(index_);
+    return *this;
+}
+
+/**
+* Post-increment: advances the iterator and returns where it was.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename CompactAVLTree<Key, Value, Compare>::template TreeIterator<IsConst>
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator++(int)
+{
+    TreeIterator before = *this;
+    ++(*this);
+    return before;
+}
+
+/**
+* Moves back to the in-order predecessor. From end() that is the largest
+* item.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename CompactAVLTree<Key, Value, Compare>::template TreeIterator<IsConst>&
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator--()
+{
+    if(index_ == NIL){
+      index_ = tree_->largestSlot(tree_->root_);
+    }
+    else{
+      index_ = tree_->predecessor(index_);
+    }
+    return *this;
+}
+
+/**
+* Post-decrement: moves the iterator back and returns where it was.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename CompactAVLTree<Key, Value, Compare>::template TreeIterator<IsConst>
+CompactAVLTree<Key, Value, Compare>::TreeIterator<IsConst>::operator--(int)
+{
+    TreeIterator before = *this;
+    --(*this);
+    return before;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLTree::iterator class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an empty tree; the arena is not allocated until the first
+* insert or reserve().
+*/
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(const Compare& comp) :
+    slots_(nullptr),
+    capacity_(0),
+    used_(0),
+    free_(NIL),
+    root_(NIL),
+    size_(0),
+    height_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Range constructor that bulk loads the items, ordered by comp, in O(n);
+* see assign.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(InputIt first, InputIt last, bool sortFirst,
+                                                    const Compare& comp) :
+    CompactAVLTree(comp)
+{
+    assign(first, last, sortFirst);
+}
+
+/**
+* Destroys every item and frees the arena.
+*/
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::~CompactAVLTree()
+{
+    clear();
+}
+
+/**
+* Removes every item and frees the arena. Unlike a pointer-based tree,
+* no walk is needed: the live items are the used slots that are not free.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::clear()
+{
+    if constexpr (!std::is_trivially_destructible<value_type>::value){
+      for(uint32_t i = 0; i < used_; ++i){
+        if(slots_[i].link != FREE_SLOT){
+          itemAt(i).~value_type();
+        }
+      }
+    }
+    std::free(slots_);
+    slots_ = nullptr;
+    capacity_ = 0;
+    used_ = 0;
+    free_ = NIL;
+    root_ = NIL;
+    size_ = 0;
+    height_ = 0;
+}
+
+/**
+* Makes room for count items, so that inserting up to that many moves no
+* item. Throws std::length_error past MAX_ITEMS.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::reserve(size_t count)
+{
+    if(count <= capacity_){
+      return;
+    }
+    if(count > MAX_ITEMS){
+      throw std::length_error("CompactAVLTree: too many items");
+    }
+    Slot* grown = allocateSlots(count);
+    try{
+      relocateSlots(grown);
+    }
+    catch(...){
+      std::free(grown);
+      throw;
+    }
+    std::free(slots_);
+    slots_ = grown;
+    capacity_ = uint32_t(count);
+}
+
+/**
+* As AVLTree::isBalanced, a sanity check, in O(1), that height_ is no
+* more than an AVL tree of size_ items can have: the smallest AVL tree of
+* height h has F(h + 2) - 1 nodes, F being the Fibonacci numbers. Wrong
+* balances in link can pass it; verifyBalance checks every slot.
+*/
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    static const std::array<size_t, MAX_HEIGHT + 1> minimumSize = []{
+      std::array<size_t, MAX_HEIGHT + 1> sizes;
+      sizes[0] = 0;
+      sizes[1] = 1;
+      for(size_t h = 2; h < sizes.size(); ++h){
+        //saturate once the sizes no longer fit
+        size_t grown = sizes[h - 1] + sizes[h - 2] + 1;
+        sizes[h] = (grown < sizes[h - 1]) ? SIZE_MAX : grown;
+      }
+      return sizes;
+    }();
+    if(height_ < 0 || height_ > MAX_HEIGHT){
+      return false;
+    }
+    return size_ >= minimumSize[height_];
+}
+
+/**
+* Returns true iff the 2-bit balance in every used slot's link is the
+* difference of its subtrees' recomputed heights and lies in [-1, 1],
+* every child's link points back at its parent, and height_ and size_
+* agree with the tree. Walks every slot, so it is for tests and
+* debugging.
+*/
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::verifyBalance() const
+{
+    size_t count = 0;
+    int height = verifiedHeight(root_, NIL, 0, count);
+    return height == height_ && count == size_;
+}
+
+/**
+* Returns the height of the subtree at index if verifyBalance's checks
+* hold throughout it, or -1 if one fails, and adds its slot count to
+* count. depth is index's distance from the root; a path longer than
+* MAX_HEIGHT already fails, which bounds the recursion.
+*/
+template<typename Key, typename Value, typename Compare>
+int CompactAVLTree<Key, Value, Compare>::verifiedHeight(uint32_t index, uint32_t parent, int depth, size_t& count) const
+{
+    if(index == NIL){
+      return 0;
+    }
+    if(index >= used_ || slots_[index].link == FREE_SLOT || depth >= MAX_HEIGHT
+       || getParent(index) != parent){
+      return -1;
+    }
+    int left = verifiedHeight(slots_[index].left, index, depth + 1, count);
+    int right = (left < 0) ? -1 : verifiedHeight(slots_[index].right, index, depth + 1, count);
+    if(right < 0 || getBalance(index) != right - left || std::abs(right - left) > 1){
+      return -1;
+    }
+    ++count;
+    return std::max(left, right) + 1;
+}
+
+/**
+* Returns the number of levels in the tree (0 when empty) in O(1).
+*/
+template<typename Key, typename Value, typename Compare>
+int CompactAVLTree<Key, Value, Compare>::height() const
+{
+    return height_;
+}
+
+/**
+* Returns true if the tree holds no items.
+*/
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns the number of items in the tree.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns the number of slots in the arena, used or free.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::capacity() const
+{
+    return capacity_;
+}
+
+/**
+* Returns the bytes allocated for the arena. Slots past the ones ever
+* used are never written, so the pages they span are usually not resident.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::arenaBytes() const
+{
+    return size_t(capacity_) * sizeof(Slot);
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::begin() const
+{
+    return iteratorAt(smallestSlot(root_));
+}
+
+/**
+* Returns an iterator past the largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::end() const
+{
+    return iteratorAt(NIL);
+}
+
+/**
+* Returns a const_iterator to the smallest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns a const_iterator past the largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns a reverse iterator past the smallest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns a const reverse iterator to the largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_reverse_iterator
+CompactAVLTree<Key, Value, Compare>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+/**
+* Returns a const reverse iterator past the smallest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_reverse_iterator
+CompactAVLTree<Key, Value, Compare>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return iteratorAt(findSlot(key));
+}
+
+/**
+* Heterogeneous version of find, only available with a transparent
+* comparator.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const K& key) const
+{
+    return iteratorAt(findSlot(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value& CompactAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    uint32_t index = findSlot(key);
+    if(index == NIL) throw std::out_of_range("Invalid key");
+    return itemAt(index).second;
+}
+template<typename Key, typename Value, typename Compare>
+Value const & CompactAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    uint32_t index = findSlot(key);
+    if(index == NIL) throw std::out_of_range("Invalid key");
+    return itemAt(index).second;
+}
+
+/**
+* Inserts a copy of keyValuePair, or overwrites the value if the key is
+* already present.
+*/
+template<typename Key, typename Value, typename Compare>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    return assignKey(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Same as above, but the value is moved into the tree instead of copied.
+* (The key is const inside the pair, so it is still copied.)
+*/
+template<typename Key, typename Value, typename Compare>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return assignKey(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Builds the item in a new slot straight from args, then links it in. As
+* with BinarySearchTree::emplace, if the key is already present the new
+* item is thrown away and the existing one is left alone.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::emplace(Args&&... args)
+{
+    uint32_t index = createSlot(NIL, std::forward<Args>(args)...);
+    uint32_t parent;
+    bool isLeft;
+    uint32_t existing;
+    try{
+      existing = findInsertionPoint(keyAt(index), parent, isLeft);
+    }
+    catch(...){
+      destroySlot(index);
+      throw;
+    }
+    if(existing != NIL){
+      destroySlot(index);
+      return std::make_pair(iteratorAt(existing), false);
+    }
+    setParent(index, parent);
+    linkChild(parent, isLeft, index);
+    leafFix(index);
+    return std::make_pair(iteratorAt(index), true);
+}
+
+/**
+* Inserts key with a value constructed from args, unless key is already
+* present, in which case nothing is constructed and args are not touched.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return emplaceKey(key, std::forward<Args>(args)...);
+}
+
+/**
+* As above, moving key into the new slot.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return emplaceKey(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Inserts key with the given value, or assigns value to the existing item
+* if key is already present. value is forwarded, so an rvalue is moved.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename M>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert_or_assign(const Key& key, M&& value)
+{
+    return assignKey(key, std::forward<M>(value));
+}
+
+/**
+* As above, moving key into the new slot if one is made.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename M>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert_or_assign(Key&& key, M&& value)
+{
+    return assignKey(std::move(key), std::forward<M>(value));
+}
+
+/**
+* Returns an iterator to the first item whose key is not before key, or
+* end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iteratorAt(lowerBoundSlot(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is after key, or end()
+* if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    uint32_t current = root_;
+    uint32_t candidate = NIL;
+    while(current != NIL){
+      if(comp_(key, keyAt(current))){
+        candidate = current;
+        current = slots_[current].left;
+      }
+      else{
+        current = slots_[current].right;
+      }
+    }
+    return iteratorAt(candidate);
+}
+
+/**
+* Returns [lower_bound(key), upper_bound(key)), which holds the item with
+* key if there is one and is empty otherwise.
+*/
+template<typename Key, typename Value, typename Compare>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator,
+          typename CompactAVLTree<Key, Value, Compare>::iterator>
+CompactAVLTree<Key, Value, Compare>::equal_range(const Key& key) const
+{
+    uint32_t low = lowerBoundSlot(key);
+    uint32_t high = low;
+    if(low != NIL && !comp_(key, keyAt(low))){
+      high = successor(low);
+    }
+    return std::make_pair(iteratorAt(low), iteratorAt(high));
+}
+
+/**
+* Returns an iterator to the last item whose key is not after key, or
+* end() if every key is after it.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::floor(const Key& key) const
+{
+    uint32_t current = root_;
+    uint32_t candidate = NIL;
+    while(current != NIL){
+      if(comp_(key, keyAt(current))){
+        current = slots_[current].left;
+      }
+      else{
+        candidate = current;
+        current = slots_[current].right;
+      }
+    }
+    return iteratorAt(candidate);
+}
+
+/**
+* Returns an iterator to the first item whose key is not before key, or
+* end() if there is none; another name for lower_bound.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::ceiling(const Key& key) const
+{
+    return lower_bound(key);
+}
+
+/**
+* Removes the item at pos, which must not be end(), and returns an
+* iterator to the item after it. The successor keeps its slot, so the
+* returned iterator is good.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::erase(iterator pos)
+{
+    uint32_t next = successor(pos.index_);
+    removeSlot(pos.index_);
+    return iteratorAt(next);
+}
+
+/**
+* Removes every item in [first, last) and returns last. Erasing the
+* whole tree is handed to clear().
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::erase(iterator first, iterator last)
+{
+    if(last.index_ == NIL && first.index_ == smallestSlot(root_)){
+      clear();
+      return end();
+    }
+    uint32_t current = first.index_;
+    while(current != last.index_){
+      uint32_t next = successor(current);
+      removeSlot(current);
+      current = next;
+    }
+    return last;
+}
+
+/**
+* A remove method to remove a specific key from the tree.
+* Does nothing if the key is not there.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    uint32_t current = findSlot(key);
+    if(current != NIL){
+      removeSlot(current);
+    }
+}
+
+/**
+* Replaces the contents with the items in [first, last) in O(n) (plus
+* O(n log n) if sortFirst asks for them to be sorted), as
+* BinarySearchTree::assign does: a later item with the same key
+* overwrites an earlier one, and an unsorted range without sortFirst
+* throws std::invalid_argument. The arena is sized to fit exactly, and
+* the items are laid out in it in the order a descent meets them.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+void CompactAVLTree<Key, Value, Compare>::assign(InputIt first, InputIt last, bool sortFirst)
+{
+    clear();
+
+    std::vector<std::pair<Key, Value> > items(first, last);
+    if(sortFirst){
+      // stable, so duplicates keep their input order and the last one wins
+      std::stable_sort(items.begin(), items.end(),
+          [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return comp_(a.first, b.first);
+          });
+    }
+
+    size_t kept = collapseDuplicates(items);
+    try{
+      reserve(kept);
+      height_ = buildRange(items.data(), kept, NIL, false);
+    }
+    catch(...){
+      clear();
+      throw;
+    }
+}
+
+/**
+* Returns the item in slot index, which must be in use.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::value_type&
+CompactAVLTree<Key, Value, Compare>::itemAt(uint32_t index) const
+{
+    return *std::launder(reinterpret_cast<value_type*>(slots_[index].item));
+}
+
+/**
+* Returns the key in slot index, which must be in use.
+*/
+template<typename Key, typename Value, typename Compare>
+const Key& CompactAVLTree<Key, Value, Compare>::keyAt(uint32_t index) const
+{
+    return itemAt(index).first;
+}
+
+/**
+* Returns the parent of slot index, or NIL for the root.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::getParent(uint32_t index) const
+{
+    return slots_[index].link >> 2;
+}
+
+/**
+* Returns the balance of slot index: its right subtree's height minus
+* its left's, -1, 0 or 1.
+*/
+template<typename Key, typename Value, typename Compare>
+int CompactAVLTree<Key, Value, Compare>::getBalance(uint32_t index) const
+{
+    return int(slots_[index].link & 3) - 1;
+}
+
+/**
+* Sets the parent of slot index, keeping its balance.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::setParent(uint32_t index, uint32_t parent)
+{
+    slots_[index].link = (parent << 2) | (slots_[index].link & 3);
+}
+
+/**
+* Sets the balance of slot index, keeping its parent. Only -1, 0 and 1
+* fit; the fixes work out a transient +-2 without storing it.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::setBalance(uint32_t index, int balance)
+{
+    slots_[index].link = (slots_[index].link & ~uint32_t(3)) | uint32_t(balance + 1);
+}
+
+/**
+* Wraps a slot index (NIL for end()) in an iterator of this tree.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iteratorAt(uint32_t index) const
+{
+    return iterator(index, this);
+}
+
+/**
+* Constructs an item from args in a free slot, or in a new one, and
+* returns its index. The slot is unlinked: no children, the given parent
+* and balance 0. When the arena is full it doubles, and the new item is
+* built in the new block before anything moves, so args may refer to an
+* item of this tree. If the item's construction throws, nothing changes.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename... Args>
+uint32_t CompactAVLTree<Key, Value, Compare>::createSlot(uint32_t parent, Args&&... args)
+{
+    uint32_t index;
+    if(free_ != NIL){
+      index = free_;
+      ::new (static_cast<void*>(slots_[index].item)) value_type(std::forward<Args>(args)...);
+      free_ = slots_[index].left;
+    }
+    else if(used_ < capacity_){
+      index = used_;
+      ::new (static_cast<void*>(slots_[index].item)) value_type(std::forward<Args>(args)...);
+      ++used_;
+    }
+    else{
+      if(capacity_ == MAX_ITEMS){
+        throw std::length_error("CompactAVLTree: too many items");
+      }
+      size_t grownCapacity = std::min(std::max(size_t(capacity_) * 2, size_t(MIN_CAPACITY)), MAX_ITEMS);
+      Slot* grown = allocateSlots(grownCapacity);
+      index = used_;
+      try{
+        ::new (static_cast<void*>(grown[index].item)) value_type(std::forward<Args>(args)...);
+      }
+      catch(...){
+        std::free(grown);
+        throw;
+      }
+      try{
+        relocateSlots(grown);
+      }
+      catch(...){
+        reinterpret_cast<value_type*>(grown[index].item)->~value_type();
+        std::free(grown);
+        throw;
+      }
+      std::free(slots_);
+      slots_ = grown;
+      capacity_ = uint32_t(grownCapacity);
+      ++used_;
+    }
+    TreeStats::countAllocation();
+    slots_[index].left = NIL;
+    slots_[index].right = NIL;
+    slots_[index].link = (parent << 2) | 1;
+    return index;
+}
+
+/**
+* Destroys the item in slot index and puts the slot on the free list.
+* The slot must already be unlinked from the tree.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::destroySlot(uint32_t index)
+{
+    TreeStats::countDeallocation();
+    itemAt(index).~value_type();
+    slots_[index].link = FREE_SLOT;
+    slots_[index].left = free_;
+    free_ = index;
+}
+
+/**
+* Allocates uninitialized room for count slots.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::Slot*
+CompactAVLTree<Key, Value, Compare>::allocateSlots(size_t count)
+{
+    static_assert(alignof(Slot) <= alignof(std::max_align_t), "CompactAVLTree items may not be over-aligned");
+    Slot* slots = static_cast<Slot*>(std::malloc(count * sizeof(Slot)));
+    if(slots == nullptr){
+      throw std::bad_alloc();
+    }
+    return slots;
+}
+
+/**
+* Moves the used slots, items and links, into the same places in to.
+* The old slots are left with their items destroyed, ready to be freed.
+* Items that can be copied as bytes are; otherwise they are moved, or
+* copied if moving might throw, so that a throw leaves this tree intact.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::relocateSlots(Slot* to)
+{
+    if(used_ == 0){
+      return;
+    }
+    if constexpr (std::is_trivially_copyable<value_type>::value){
+      std::memcpy(static_cast<void*>(to), static_cast<const void*>(slots_), size_t(used_) * sizeof(Slot));
+    }
+    else{
+      uint32_t i = 0;
+      try{
+        for(; i < used_; ++i){
+          to[i].left = slots_[i].left;
+          to[i].right = slots_[i].right;
+          to[i].link = slots_[i].link;
+          if(slots_[i].link != FREE_SLOT){
+            ::new (static_cast<void*>(to[i].item)) value_type(std::move_if_noexcept(itemAt(i)));
+          }
+        }
+      }
+      catch(...){
+        //undo the copies made so far; the originals were not touched
+        while(i-- > 0){
+          if(to[i].link != FREE_SLOT){
+            std::launder(reinterpret_cast<value_type*>(to[i].item))->~value_type();
+          }
+        }
+        throw;
+      }
+      for(i = 0; i < used_; ++i){
+        if(slots_[i].link != FREE_SLOT){
+          itemAt(i).~value_type();
+        }
+      }
+    }
+}
+
+/**
+* Returns the slot holding key, or NIL. Uses the same one-decision-per-
+* level descents as BinarySearchTree::internalFind (see key_compare.h).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+uint32_t CompactAVLTree<Key, Value, Compare>::findSlot(const K& key) const
+{
+    uint32_t current = root_;
+    //Only read by TreeStats, so compiled away when it is off
+    size_t visited = 0;
+
+    if constexpr (UsesThreeWay<Compare, K, Key>::value){
+      while(current != NIL){
+        ++visited;
+        int order = threeWayCompare(comp_, key, keyAt(current));
+        if(order == 0){
+          TreeStats::countFind(visited, visited);
+          return current;
+        }
+        current = (order < 0) ? slots_[current].left : slots_[current].right;
+      }
+      TreeStats::countFind(visited, visited);
+      return NIL;
+    }
+    else if constexpr (UsesBuiltinEquality<Compare, K, Key>::value){
+      //Keep this shape: the != test and the select share one compare,
+      //and the select compiles to a conditional move
+      while(current != NIL && keyAt(current) != key){
+        ++visited;
+        current = comp_(key, keyAt(current)) ? slots_[current].left : slots_[current].right;
+      }
+      size_t matched = (current != NIL);
+      TreeStats::countFind(visited + matched, 2 * visited + matched);
+      return current;
+    }
+
+    //Remember the last slot not greater than key; only it can match
+    uint32_t candidate = NIL;
+    while(current != NIL){
+      ++visited;
+      if(comp_(key, keyAt(current))){
+        current = slots_[current].left;
+      }
+      else{
+        candidate = current;
+        current = slots_[current].right;
+      }
+    }
+    TreeStats::countFind(visited, visited + (candidate != NIL));
+    if(candidate == NIL || comp_(keyAt(candidate), key)){
+      return NIL;
+    }
+    return candidate;
+}
+
+/**
+* Descends from the root looking for key. Returns the slot holding key
+* if there is one. Otherwise returns NIL and sets parent/isLeft to where
+* a new slot for key belongs (parent is NIL for an empty tree).
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::findInsertionPoint(const Key& key, uint32_t& parent, bool& isLeft) const
+{
+    uint32_t current = root_;
+    parent = NIL;
+    isLeft = false;
+    while(current != NIL){
+      int order = threeWayCompare(comp_, key, keyAt(current));
+      if(order == 0){
+        return current;
+      }
+      parent = current;
+      isLeft = order < 0;
+      current = isLeft ? slots_[current].left : slots_[current].right;
+    }
+    return NIL;
+}
+
+/**
+* Returns the first slot whose key is not before key, or NIL.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    uint32_t current = root_;
+    uint32_t candidate = NIL;
+    while(current != NIL){
+      if(comp_(keyAt(current), key)){
+        current = slots_[current].right;
+      }
+      else{
+        candidate = current;
+        current = slots_[current].left;
+      }
+    }
+    return candidate;
+}
+
+/**
+* Returns the leftmost slot of the subtree at index, or NIL if it is empty.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::smallestSlot(uint32_t index) const
+{
+    if(index == NIL){
+      return NIL;
+    }
+    while(slots_[index].left != NIL){
+      index = slots_[index].left;
+    }
+    return index;
+}
+
+/**
+* Returns the rightmost slot of the subtree at index, or NIL if it is empty.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::largestSlot(uint32_t index) const
+{
+    if(index == NIL){
+      return NIL;
+    }
+    while(slots_[index].right != NIL){
+      index = slots_[index].right;
+    }
+    return index;
+}
+
+/**
+* Returns the slot after index in key order, or NIL if it is the last.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::successor(uint32_t index) const
+{
+    if(slots_[index].right != NIL){
+      return smallestSlot(slots_[index].right);
+    }
+    //climb until we come up out of a left subtree
+    uint32_t parent = getParent(index);
+    while(parent != NIL && slots_[parent].right == index){
+      index = parent;
+      parent = getParent(index);
+    }
+    return parent;
+}
+
+/**
+* Returns the slot before index in key order, or NIL if it is the first.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::predecessor(uint32_t index) const
+{
+    if(slots_[index].left != NIL){
+      return largestSlot(slots_[index].left);
+    }
+    //climb until we come up out of a right subtree
+    uint32_t parent = getParent(index);
+    while(parent != NIL && slots_[parent].left == index){
+      index = parent;
+      parent = getParent(index);
+    }
+    return parent;
+}
+
+/**
+* Shared body of insert and insert_or_assign: one descent, then either
+* the existing value is assigned or a new leaf is made.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename M>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::assignKey(K&& key, M&& value)
+{
+    uint32_t parent;
+    bool isLeft;
+    uint32_t existing = findInsertionPoint(key, parent, isLeft);
+    //Key already there, overwrite the value
+    if(existing != NIL){
+      itemAt(existing).second = std::forward<M>(value);
+      return std::make_pair(iteratorAt(existing), false);
+    }
+    uint32_t inserted = createSlot(parent, std::forward<K>(key), std::forward<M>(value));
+    linkChild(parent, isLeft, inserted);
+    leafFix(inserted);
+    return std::make_pair(iteratorAt(inserted), true);
+}
+
+/**
+* Shared body of try_emplace: one descent, and the item is only built
+* (piecewise, from key and args) once we know the key is new.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::emplaceKey(K&& key, Args&&... args)
+{
+    uint32_t parent;
+    bool isLeft;
+    uint32_t existing = findInsertionPoint(key, parent, isLeft);
+    if(existing != NIL){
+      return std::make_pair(iteratorAt(existing), false);
+    }
+    uint32_t inserted = createSlot(parent, std::piecewise_construct,
+                                   std::forward_as_tuple(std::forward<K>(key)),
+                                   std::forward_as_tuple(std::forward<Args>(args)...));
+    linkChild(parent, isLeft, inserted);
+    leafFix(inserted);
+    return std::make_pair(iteratorAt(inserted), true);
+}
+
+/**
+* Makes child the left or right child of parent, or the root if parent
+* is NIL, and counts it. child's own parent link is set by the caller.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::linkChild(uint32_t parent, bool isLeft, uint32_t child)
+{
+    if(parent == NIL){
+      root_ = child;
+    }
+    else if(isLeft){
+      slots_[parent].left = child;
+    }
+    else{
+      slots_[parent].right = child;
+    }
+    ++size_;
+}
+
+/**
+* Updates the balance above a new leaf and rebalances, as in AVLTree.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::leafFix(uint32_t leaf)
+{
+    uint32_t parent = getParent(leaf);
+    //first item
+    if(parent == NIL){
+      height_ = 1;
+      return;
+    }
+    //Insertion at the left
+    if(slots_[parent].left == leaf){
+      //No rebalancing needed
+      if(getBalance(parent) == 1){
+        setBalance(parent, 0);
+      }
+      //Rebalance
+      else{
+        setBalance(parent, -1);
+        insertFix(parent, leaf);
+      }
+    }
+    //Insertion at the right
+    else{
+      //No rebalancing needed
+      if(getBalance(parent) == -1){
+        setBalance(parent, 0);
+      }
+      //Rebalance
+      else{
+        setBalance(parent, 1);
+        insertFix(parent, leaf);
+      }
+    }
+}
+
+/**
+* The AVLTree insertFix: parent's subtree just got taller, on current's
+* side. Case 3 is a grandparent balance of +-2, which is never stored;
+* the rotations settle it first.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::insertFix(uint32_t parent, uint32_t current)
+{
+  TreeStats::FixScope stats(TreeStats::INSERT_FIX);
+  uint32_t grandp = getParent(parent);
+  //parent is the root, and it just got taller
+  if(grandp == NIL){
+    ++height_;
+    return;
+  }
+
+  //parent is left of grandparent
+  if(slots_[grandp].left == parent){
+    int balance = getBalance(grandp) - 1;
+    //Case 1
+    if(balance == 0){
+      setBalance(grandp, 0);
+    }
+    //Case 2
+    else if(balance == -1){
+      setBalance(grandp, -1);
+      insertFix(grandp, parent);
+    }
+    //Case 3, zig zig to left
+    else if(slots_[parent].left == current){
+      rotateRight(grandp);
+      setBalance(parent, 0);
+      setBalance(grandp, 0);
+    }
+    //Case 3, zig zag
+    else{
+      int currentBalance = getBalance(current);
+      rotateLeft(parent);
+      rotateRight(grandp);
+      setBalance(parent, (currentBalance == 1) ? -1 : 0);
+      setBalance(grandp, (currentBalance == -1) ? 1 : 0);
+      setBalance(current, 0);
+    }
+  }
+  //parent is right of grandparent
+  else{
+    int balance = getBalance(grandp) + 1;
+    //Case 1
+    if(balance == 0){
+      setBalance(grandp, 0);
+    }
+    //Case 2
+    else if(balance == 1){
+      setBalance(grandp, 1);
+      insertFix(grandp, parent);
+    }
+    //Case 3, zig zig to right
+    else if(slots_[parent].right == current){
+      rotateLeft(grandp);
+      setBalance(parent, 0);
+      setBalance(grandp, 0);
+    }
+    //Case 3, zig zag
+    else{
+      int currentBalance = getBalance(current);
+      rotateRight(parent);
+      rotateLeft(grandp);
+      setBalance(parent, (currentBalance == -1) ? 1 : 0);
+      setBalance(grandp, (currentBalance == 1) ? -1 : 0);
+      setBalance(current, 0);
+    }
+  }
+}
+
+/**
+* Unlinks and destroys slot current, then rebalances. A slot with two
+* children is replaced by its predecessor, which is moved into current's
+* place by relinking; no item is moved, so iterators to every other item
+* stay good.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::removeSlot(uint32_t current)
+{
+    uint32_t parent = getParent(current);
+    uint32_t left = slots_[current].left;
+    uint32_t right = slots_[current].right;
+    uint32_t replacement;
+    //where the shrinking starts, and on which side
+    uint32_t fixFrom;
+    int diff;
+
+    //two children
+    if(left != NIL && right != NIL){
+      replacement = largestSlot(left);
+      //the predecessor is the left child: it moves up, keeping its left subtree
+      if(replacement == left){
+        fixFrom = replacement;
+        diff = 1;
+      }
+      //otherwise its left subtree takes its place, and it takes current's
+      else{
+        fixFrom = getParent(replacement);
+        diff = -1;
+        uint32_t child = slots_[replacement].left;
+        slots_[fixFrom].right = child;
+        if(child != NIL){
+          setParent(child, fixFrom);
+        }
+        slots_[replacement].left = left;
+        setParent(left, replacement);
+      }
+      slots_[replacement].right = right;
+      setParent(right, replacement);
+      slots_[replacement].link = slots_[current].link;
+    }
+    //at most one child, which takes current's place
+    else{
+      replacement = (left != NIL) ? left : right;
+      fixFrom = parent;
+      diff = 0;
+      if(replacement != NIL){
+        setParent(replacement, parent);
+      }
+      if(parent != NIL){
+        diff = (slots_[parent].left == current) ? 1 : -1;
+      }
+    }
+
+    if(parent == NIL){
+      root_ = replacement;
+    }
+    else if(slots_[parent].left == current){
+      slots_[parent].left = replacement;
+    }
+    else{
+      slots_[parent].right = replacement;
+    }
+    destroySlot(current);
+    --size_;
+    removeFix(fixFrom, diff);
+}
+
+/**
+ * Rebalances after a removal, as AVLTree::removeFix does. diff is the
+ * change to current's balance: +1 when its left subtree got shorter, -1
+ * when its right subtree did.
+ */
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::removeFix(uint32_t current, int diff)
+{
+   TreeStats::FixScope stats(TreeStats::REMOVE_FIX);
+   //the shrinking got past the root, so the whole tree is a level shorter
+   if(current == NIL){
+     --height_;
+     return;
+   }
+   //work out the parent's diff before any rotation moves current
+   uint32_t parent = getParent(current);
+   int nextdiff = 0;
+   if(parent != NIL){
+     nextdiff = (slots_[parent].left == current) ? 1 : -1;
+   }
+   int balance = getBalance(current) + diff;
+
+   //Case 1, left heavy
+   if(balance == -2){
+     uint32_t leftC = slots_[current].left;
+     //1a
+     if(getBalance(leftC) == -1){
+       rotateRight(current);
+       setBalance(current, 0);
+       setBalance(leftC, 0);
+       removeFix(parent, nextdiff);
+     }
+     //1b
+     else if(getBalance(leftC) == 0){
+       rotateRight(current);
+       setBalance(current, -1);
+       setBalance(leftC, 1);
+     }
+     //1c
+     else{
+       uint32_t grandC = slots_[leftC].right;
+       int grandBalance = getBalance(grandC);
+       rotateLeft(leftC);
+       rotateRight(current);
+       setBalance(current, (grandBalance == -1) ? 1 : 0);
+       setBalance(leftC, (grandBalance == 1) ? -1 : 0);
+       setBalance(grandC, 0);
+       removeFix(parent, nextdiff);
+     }
+   }
+   //Case 1, right heavy
+   else if(balance == 2){
+     uint32_t rightC = slots_[current].right;
+     //1a
+     if(getBalance(rightC) == 1){
+       rotateLeft(current);
+       setBalance(current, 0);
+       setBalance(rightC, 0);
+       removeFix(parent, nextdiff);
+     }
+     //1b
+     else if(getBalance(rightC) == 0){
+       rotateLeft(current);
+       setBalance(current, 1);
+       setBalance(rightC, -1);
+     }
+     //1c
+     else{
+       uint32_t grandC = slots_[rightC].left;
+       int grandBalance = getBalance(grandC);
+       rotateRight(rightC);
+       rotateLeft(current);
+       setBalance(current, (grandBalance == 1) ? -1 : 0);
+       setBalance(rightC, (grandBalance == -1) ? 1 : 0);
+       setBalance(grandC, 0);
+       removeFix(parent, nextdiff);
+     }
+   }
+   //Case 2, the other side still holds the height
+   else if(balance != 0){
+     setBalance(current, balance);
+   }
+   //Case 3, current got shorter too
+   else{
+     setBalance(current, 0);
+     removeFix(parent, nextdiff);
+   }
+}
+
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::rotateRight(uint32_t current){
+  TreeStats::countRotation();
+  uint32_t parent = getParent(current);
+  uint32_t LC = slots_[current].left;
+  //has a parent
+  if(parent != NIL){
+    if(slots_[parent].left == current){
+      slots_[parent].left = LC;
+    }
+    else{
+      slots_[parent].right = LC;
+    }
+  }
+  else{
+    root_ = LC;
+  }
+  setParent(LC, parent);
+  setParent(current, LC);
+  uint32_t RC = slots_[LC].right;
+  if(RC != NIL){
+    setParent(RC, current);
+  }
+  //readjust links
+  slots_[current].left = RC;
+  slots_[LC].right = current;
+}
+
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::rotateLeft(uint32_t current){
+  TreeStats::countRotation();
+  uint32_t parent = getParent(current);
+  uint32_t RC = slots_[current].right;
+  //has parent
+  if(parent != NIL){
+    if(slots_[parent].right == current){
+      slots_[parent].right = RC;
+    }
+    else{
+      slots_[parent].left = RC;
+    }
+  }
+  else{
+    root_ = RC;
+  }
+  setParent(RC, parent);
+  setParent(current, RC);
+  uint32_t LC = slots_[RC].left;
+  if(LC != NIL){
+    setParent(LC, current);
+  }
+  //readjust links
+  slots_[current].right = LC;
+  slots_[RC].left = current;
+}
+
+/**
+* Builds a perfectly balanced subtree from count sorted, distinct items,
+* hangs it under parent, and returns its height. The middle item becomes
+* the root, and the left half is never shorter, so every balance is 0 or
+* -1 and fits.
+*/
+template<typename Key, typename Value, typename Compare>
+int CompactAVLTree<Key, Value, Compare>::buildRange(std::pair<Key, Value>* items, size_t count, uint32_t parent, bool isLeft)
+{
+    if(count == 0){
+      return 0;
+    }
+    size_t mid = count / 2;
+    uint32_t index = createSlot(parent, std::move(items[mid].first), std::move(items[mid].second));
+    linkChild(parent, isLeft, index);
+
+    int leftHeight = buildRange(items, mid, index, true);
+    int rightHeight = buildRange(items + mid + 1, count - mid - 1, index, false);
+
+    setBalance(index, rightHeight - leftHeight);
+    return std::max(leftHeight, rightHeight) + 1;
+}
+
+/**
+* Squeezes runs of equal keys in the sorted items down to one item each,
+* keeping the last value seen, and returns how many items are left at
+* the front. Throws std::invalid_argument if items are not sorted.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::collapseDuplicates(std::vector<std::pair<Key, Value> >& items) const
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < items.size(); ++i){
+      if(kept > 0 && !comp_(items[kept-1].first, items[i].first)){
+        if(comp_(items[i].first, items[kept-1].first)){
+          throw std::invalid_argument("assign: range is not sorted by key");
+        }
+        items[kept-1].second = std::move(items[i].second);
+      }
+      else{
+        if(kept != i){
+          items[kept] = std::move(items[i]);
+        }
+        ++kept;
+      }
+    }
+    return kept;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
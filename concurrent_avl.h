@@ -0,0 +1,407 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "avlbst.h"
+#include "reader_epochs.h"
+
+/**
+ * An AVLTree shared by one writer and any number of readers, where the
+ * readers take no locks.
+ *
+ * Reads are optimistic, seqlock style. The tree has a version counter that
+ * the writer makes odd for the duration of every change (insert, remove,
+ * and all the rotations they do) and even again afterwards. A reader notes
+ * an even version, walks the tree and copies out what it needs, then
+ * checks the version is unchanged; if a write overlapped, it throws its
+ * copy away and tries again. Readers never write to shared memory except
+ * for an epoch counter in a per-thread slot, so they do not slow each other
+ * down.
+ *
+ * Readers and the writer share the tree's links without a data race:
+ * the nodes have atomic child links (AtomicLinks in NodeBase) that the
+ * writer stores with release order and readers load with acquire, so a
+ * reader that follows a link always sees the node behind it fully
+ * built. Readers start from a root and size the writer publishes at the
+ * end of each write, and a node's key and value are never written once
+ * it is linked in: insert over an existing key links in a new node in
+ * place of the old one.
+ *
+ * A reader may still be walking through a node the writer has just
+ * removed, so removed nodes are not freed straight away. The tree's
+ * DeferredNodeAllocator retires them instead, and the writer frees a batch
+ * only after every reader that started before the batch was unlinked has
+ * finished (epoch-based reclamation with two epochs in flight).
+ *
+ * The price is that readers copy values out rather than returning
+ * references or iterators, and that Key and Value must be trivially
+ * copyable, since a reader may copy from a node that is removed and
+ * destroyed while it looks. Writers are serialized with a mutex, so more
+ * than one writer thread is safe, just not concurrent.
+ */
+template<class Key, class Value, class Compare = std::less<Key> >
+class ConcurrentAVLTree : private AVLTree<Key, Value, Compare, DeferredNodeAllocator, false, true>
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "ConcurrentAVLTree readers copy racing data, so Key and Value must be trivially copyable");
+
+    typedef AVLTree<Key, Value, Compare, DeferredNodeAllocator, false, true> Base;
+    typedef AVLNode<Key, Value, false, true> NodeType;
+
+public:
+    explicit ConcurrentAVLTree(const Compare& comp = Compare());
+    ~ConcurrentAVLTree();
+
+    // Writer side, serialized by a mutex. insert overwrites an existing
+    // value and returns true if the key is new.
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    // Reader side, lock-free and safe from any number of threads.
+    // find copies the value into value and returns true if key is present.
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+
+private:
+    // Pins the current epoch for the lifetime of one read.
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(const ConcurrentAVLTree& tree);
+        ~ReadGuard();
+    private:
+        std::atomic<size_t>* pin_;
+    };
+
+    // Holds the writer mutex and keeps the version odd for its lifetime.
+    class WriteGuard
+    {
+    public:
+        explicit WriteGuard(ConcurrentAVLTree& tree);
+        ~WriteGuard();
+    private:
+        ConcurrentAVLTree& tree_;
+        std::lock_guard<std::mutex> lock_;
+    };
+
+    NodeType* lookup(const Key& key, unsigned char* valueCopy) const;
+    void replaceNode(NodeType* old, const std::pair<const Key, Value>& keyValuePair);
+    void reclaim();
+
+    ReaderEpochs epochs_;
+    std::atomic<uint64_t> version_;     // odd while a write is in progress
+    std::atomic<NodeType*> publishedRoot_;  // root_ as of the last finished write
+    std::atomic<size_t> publishedSize_;     // size_ as of the last finished write
+    DeferredNodeAllocator::RetiredSlot* waiting_;  // retired before the last epoch flip
+    std::mutex writeMutex_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    Base(comp),
+    version_(0),
+    publishedRoot_(nullptr),
+    publishedSize_(0),
+    waiting_(nullptr)
+{
+
+}
+
+/**
+* Frees every node. No reader may still be using the tree.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    Base::clear();
+    DeferredNodeAllocator::freeRetired(waiting_);
+    DeferredNodeAllocator::freeRetired(this->alloc_.takeRetired());
+}
+
+/**
+* Pins the current epoch.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ReadGuard::ReadGuard(const ConcurrentAVLTree& tree) :
+    pin_(tree.epochs_.enter())
+{
+
+}
+
+/**
+* Unpins the epoch.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ReadGuard::~ReadGuard()
+{
+    ReaderEpochs::leave(pin_);
+}
+
+/**
+* Takes the writer lock and makes the version odd. The release fence keeps
+* the tree changes that follow from becoming visible before the odd
+* version does.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::WriteGuard::WriteGuard(ConcurrentAVLTree& tree) :
+    tree_(tree),
+    lock_(tree.writeMutex_)
+{
+    tree_.version_.store(tree_.version_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+/**
+* Publishes the change: the new root and size, then the version made
+* even again. Then frees whatever retired nodes no reader can still hold.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::WriteGuard::~WriteGuard()
+{
+    tree_.publishedRoot_.store(tree_.root_, std::memory_order_release);
+    tree_.publishedSize_.store(tree_.size_, std::memory_order_release);
+    tree_.version_.store(tree_.version_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    tree_.reclaim();
+}
+
+/**
+* Two batches of retired nodes are tracked: waiting_, unlinked before the
+* last epoch flip, and the allocator's list, unlinked since. waiting_ is
+* freed once no reader from the previous epoch is left; then, if anything
+* has been retired since, it becomes the new waiting_ and the epoch moves
+* on, so readers arriving from now on can't have seen it.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaim()
+{
+    if(waiting_ != nullptr){
+      if(!epochs_.previousDrained()){
+        return;
+      }
+      DeferredNodeAllocator::freeRetired(waiting_);
+      waiting_ = nullptr;
+    }
+
+    DeferredNodeAllocator::RetiredSlot* retired = this->alloc_.takeRetired();
+    if(retired != nullptr){
+      waiting_ = retired;
+      epochs_.advance();
+    }
+}
+
+/**
+* Inserts keyValuePair, or overwrites the value of an existing key.
+* Returns true if the key is new.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    WriteGuard guard(*this);
+    NodeType* existing = this->internalFind(keyValuePair.first);
+    if(existing == nullptr){
+      Base::insert(keyValuePair);
+      return true;
+    }
+    replaceNode(existing, keyValuePair);
+    return false;
+}
+
+/**
+* Overwrites a value without writing to a node readers can reach: a new
+* node holding keyValuePair takes over old's links and balance, is linked
+* in where old was, and old is retired.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::replaceNode(NodeType* old, const std::pair<const Key, Value>& keyValuePair)
+{
+    NodeType* parent = old->getParent();
+    NodeType* fresh = this->createNode(parent, keyValuePair.first, keyValuePair.second);
+    fresh->setBalance(old->getBalance());
+    fresh->setLeft(old->getLeft());
+    fresh->setRight(old->getRight());
+    if(old->getLeft() != nullptr){
+      old->getLeft()->setParent(fresh);
+    }
+    if(old->getRight() != nullptr){
+      old->getRight()->setParent(fresh);
+    }
+    //fresh is complete, so linking it in (a release store) publishes it
+    if(parent == nullptr){
+      this->root_ = fresh;
+    }
+    else if(parent->getLeft() == old){
+      parent->setLeft(fresh);
+    }
+    else{
+      parent->setRight(fresh);
+    }
+    if(this->rightmost_ == old){
+      this->rightmost_ = fresh;
+    }
+    this->destroyNode(old);
+}
+
+/**
+* Removes key if it is present. Its node is retired, not freed.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    WriteGuard guard(*this);
+    Base::remove(key);
+}
+
+/**
+* Removes every item.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    WriteGuard guard(*this);
+    Base::clear();
+}
+
+/**
+* One optimistic descent: returns the node holding key, or NULL, and if
+* valueCopy is not NULL copies that node's value into it. The result
+* means nothing unless the version is checked afterwards. A walk
+* that goes on for longer than any balanced tree is tall has been misled
+* by a write in progress and gives up.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::NodeType*
+ConcurrentAVLTree<Key, Value, Compare>::lookup(const Key& key, unsigned char* valueCopy) const
+{
+    NodeType* node = publishedRoot_.load(std::memory_order_acquire);
+    NodeType* candidate = nullptr;
+    if constexpr (UsesBuiltinEquality<Compare, Key, Key>::value){
+      //Same shape as internalFind: stop at a match, and let the select
+      //compile to a conditional move
+      for(int depth = 0; node != nullptr && node->getKey() != key; ++depth){
+        if(depth == Base::MAX_BALANCED_HEIGHT){
+          return nullptr;
+        }
+        NodeType* left = node->getLeftAcquire();
+        NodeType* right = node->getRightAcquire();
+        node = this->comp_(key, node->getKey()) ? left : right;
+      }
+      candidate = node;
+    }
+    else{
+      for(int depth = 0; node != nullptr; ++depth){
+        if(depth == Base::MAX_BALANCED_HEIGHT){
+          return nullptr;
+        }
+        if(this->comp_(key, node->getKey())){
+          node = node->getLeftAcquire();
+        }
+        else{
+          candidate = node;
+          node = node->getRightAcquire();
+        }
+      }
+      if(candidate != nullptr && this->comp_(candidate->getKey(), key)){
+        candidate = nullptr;
+      }
+    }
+    if(candidate == nullptr){
+      return nullptr;
+    }
+    if(valueCopy != nullptr){
+      std::memcpy(valueCopy, &candidate->getValue(), sizeof(Value));
+    }
+    return candidate;
+}
+
+/**
+* Looks key up without taking a lock, retrying if a write overlapped.
+* On success the value is copied into value; otherwise value is untouched.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    ReadGuard guard(*this);
+    alignas(Value) unsigned char copy[sizeof(Value)];
+    while(true){
+      uint64_t before = version_.load(std::memory_order_acquire);
+      if(before & 1){
+        std::this_thread::yield();
+        continue;
+      }
+      bool found = lookup(key, copy) != nullptr;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(version_.load(std::memory_order_relaxed) == before){
+        if(found){
+          std::memcpy(static_cast<void*>(&value), copy, sizeof(Value));
+        }
+        return found;
+      }
+    }
+}
+
+/**
+* Returns true if key is present, without taking a lock.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    ReadGuard guard(*this);
+    while(true){
+      uint64_t before = version_.load(std::memory_order_acquire);
+      if(before & 1){
+        std::this_thread::yield();
+        continue;
+      }
+      bool found = lookup(key, nullptr) != nullptr;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(version_.load(std::memory_order_relaxed) == before){
+        return found;
+      }
+    }
+}
+
+/**
+* Returns the number of items as of the last write to finish.
+*/
+template<class Key, class Value, class Compare>
+size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return publishedSize_.load(std::memory_order_acquire);
+}
+
+/**
+* Returns true if the tree was empty as of the last write to finish.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
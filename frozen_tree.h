@@ -0,0 +1,447 @@
+#ifndef FROZEN_TREE_H
+#define FROZEN_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "key_compare.h"
+
+/**
+ * An allocator that places a vector's storage at the start of a cache line,
+ * so a block of adjacent elements spans as few lines as possible.
+ */
+template<typename T>
+class CacheAlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    static const std::size_t CACHE_LINE = 64;
+
+    CacheAlignedAllocator() { }
+    template<typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) { }
+
+    T* allocate(std::size_t n);
+    void deallocate(T* p, std::size_t n);
+
+    template<typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+/**
+ * A read-only snapshot of a search tree, made by BinarySearchTree::freeze().
+ *
+ * The items sit in one sorted array, which is what iteration walks. The
+ * keys are copied once more into an Eytzinger (breadth-first) array: slot 1
+ * holds the root and slot k has its children in slots 2k and 2k+1. The top
+ * levels of every search share the same few cache lines, and a lookup is
+ * a loop of
+ *
+ *     k = 2k + (keys[k] < key)
+ *
+ * with no data-dependent branch to mispredict. Each step also prefetches
+ * the cache line that holds k's descendants a few levels down, so the
+ * memory latency of those levels overlaps the comparisons above them.
+ *
+ * The snapshot does not follow later changes to its source tree; freeze
+ * again to pick them up.
+ */
+template<typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+    // A snapshot is immutable, so iterator and const_iterator are the same
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+    explicit FrozenTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    FrozenTree(InputIt first, InputIt last, const Compare& comp = Compare());
+
+    bool empty() const;
+    size_t size() const;
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+
+    iterator find(const Key& key) const;
+    template<typename K, typename C = Compare,
+             typename = typename std::enable_if<IsTransparent<C>::value>::type>
+    iterator find(const K& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+
+protected:
+    template<typename K>
+    size_t lowerBoundSlot(const K& key) const;
+    template<typename K>
+    size_t upperBoundSlot(const K& key) const;
+    iterator itemAt(size_t slot) const;
+    void layout(size_t slot, size_t& next);
+    void prefetchBelow(size_t slot) const;
+    static size_t lastLeftTurn(size_t slot);
+
+    // Number of keys (a power of two) that fit in one cache line. The
+    // descendants of slot k log2(stride) levels down are the stride slots
+    // starting at k*stride, so one prefetch covers that whole level.
+    static const size_t PREFETCH_STRIDE =
+        sizeof(Key) <= 4 ? 16 : sizeof(Key) <= 8 ? 8 : sizeof(Key) <= 16 ? 4 : 2;
+
+protected:
+    std::vector<value_type> items_;                    // sorted by key
+    std::vector<Key, CacheAlignedAllocator<Key> > keys_;  // Eytzinger order from slot 1
+    std::vector<size_t> ranks_;                        // index in items_ of each slot
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CacheAlignedAllocator class.
+  ---------------------------------------------------
+*/
+
+/**
+* Returns storage for n elements aligned to a cache line.
+*/
+template<typename T>
+T* CacheAlignedAllocator<T>::allocate(std::size_t n)
+{
+    if(n > std::numeric_limits<std::size_t>::max() / sizeof(T)){
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(CACHE_LINE)));
+}
+
+/**
+* Gives back storage from allocate().
+*/
+template<typename T>
+void CacheAlignedAllocator<T>::deallocate(T* p, std::size_t)
+{
+    ::operator delete(p, std::align_val_t(CACHE_LINE));
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CacheAlignedAllocator class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the FrozenTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an empty snapshot.
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree(const Compare& comp) :
+    comp_(comp)
+{
+
+}
+
+/**
+* Builds a snapshot of the items in [first, last), which must be sorted by
+* key with no key repeated (a tree's begin()/end() always are). O(n).
+* Throws std::invalid_argument otherwise.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(InputIt first, InputIt last, const Compare& comp) :
+    items_(first, last),
+    comp_(comp)
+{
+    for(size_t i = 1; i < items_.size(); ++i){
+      if(!comp_(items_[i-1].first, items_[i].first)){
+        throw std::invalid_argument("FrozenTree: range is not sorted by key");
+      }
+    }
+    if(items_.empty()){
+      return;
+    }
+
+    // slot 0 is never searched; it just keeps the root at slot 1
+    keys_.assign(items_.size() + 1, items_[0].first);
+    ranks_.assign(items_.size() + 1, 0);
+    size_t next = 0;
+    layout(1, next);
+}
+
+/**
+* Fills the subtree rooted at slot with the next items in sorted order,
+* visiting slots in order so they come out sorted left to right.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenTree<Key, Value, Compare>::layout(size_t slot, size_t& next)
+{
+    if(slot >= keys_.size()){
+      return;
+    }
+    layout(2 * slot, next);
+    keys_[slot] = items_[next].first;
+    ranks_[slot] = next;
+    ++next;
+    layout(2 * slot + 1, next);
+}
+
+/**
+* Returns true if the snapshot holds no items.
+*/
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return items_.empty();
+}
+
+/**
+* Returns the number of items.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return items_.size();
+}
+
+/**
+* Returns an iterator to the "smallest" item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    return items_.begin();
+}
+
+/**
+* Returns the iterator past the last item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return items_.end();
+}
+
+/**
+* Same as begin().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::cbegin() const
+{
+    return items_.begin();
+}
+
+/**
+* Same as end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::cend() const
+{
+    return items_.end();
+}
+
+/**
+* Returns a reverse iterator to the "largest" item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::reverse_iterator
+FrozenTree<Key, Value, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator one before the "smallest" item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::reverse_iterator
+FrozenTree<Key, Value, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Same as rbegin().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_reverse_iterator
+FrozenTree<Key, Value, Compare>::crbegin() const
+{
+    return rbegin();
+}
+
+/**
+* Same as rend().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_reverse_iterator
+FrozenTree<Key, Value, Compare>::crend() const
+{
+    return rend();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if(slot == 0 || comp_(key, keys_[slot])){
+      return end();
+    }
+    return itemAt(slot);
+}
+
+/**
+* Heterogeneous find, only available with a transparent comparator.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::find(const K& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if(slot == 0 || comp_(key, keys_[slot])){
+      return end();
+    }
+    return itemAt(slot);
+}
+
+/**
+* Returns an iterator to the first item whose key is not before key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return itemAt(lowerBoundSlot(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is after key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return itemAt(upperBoundSlot(key));
+}
+
+/**
+* Returns the slot of the first key not before key, or 0 if there is none.
+* The descent always runs to the bottom: the comparison only picks the
+* next slot, it never ends the loop.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const K& key) const
+{
+    const size_t n = items_.size();
+    const Key* keys = keys_.data();
+    size_t slot = 1;
+    while(slot <= n){
+      prefetchBelow(slot);
+      slot = 2 * slot + (comp_(keys[slot], key) ? 1 : 0);
+    }
+    return lastLeftTurn(slot);
+}
+
+/**
+* Returns the slot of the first key after key, or 0 if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+size_t FrozenTree<Key, Value, Compare>::upperBoundSlot(const K& key) const
+{
+    const size_t n = items_.size();
+    const Key* keys = keys_.data();
+    size_t slot = 1;
+    while(slot <= n){
+      prefetchBelow(slot);
+      slot = 2 * slot + (comp_(key, keys[slot]) ? 0 : 1);
+    }
+    return lastLeftTurn(slot);
+}
+
+/**
+* Maps a slot from lowerBoundSlot/upperBoundSlot to an iterator; slot 0
+* means end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::itemAt(size_t slot) const
+{
+    if(slot == 0){
+      return end();
+    }
+    return items_.begin() + ranks_[slot];
+}
+
+/**
+* Once a descent has fallen off the bottom, each bit of slot below the
+* leading 1 records one turn (0 = left, 1 = right). The answer is the slot
+* where the last left turn was taken: drop the trailing right turns and
+* that left turn itself. All right turns (key after every item) gives 0.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::lastLeftTurn(size_t slot)
+{
+#if defined(__GNUC__)
+    return slot >> (__builtin_ctzll(~static_cast<unsigned long long>(slot)) + 1);
+#else
+    while(slot & 1){
+      slot >>= 1;
+    }
+    return slot >> 1;
+#endif
+}
+
+/**
+* Asks for the cache line holding slot's descendants log2(PREFETCH_STRIDE)
+* levels down. The address is computed as an integer because it may be
+* past the end of the array, where a prefetch is harmless.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenTree<Key, Value, Compare>::prefetchBelow(size_t slot) const
+{
+#if defined(__GNUC__)
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(keys_.data());
+    __builtin_prefetch(reinterpret_cast<const void*>(base + slot * PREFETCH_STRIDE * sizeof(Key)));
+#else
+    (void)slot;
+#endif
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the FrozenTree class.
+  -------------------------------------------------
+*/
+
+#endif
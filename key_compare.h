@@ -0,0 +1,98 @@
+#ifndef KEY_COMPARE_H
+#define KEY_COMPARE_H
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Helpers that let a search tree make exactly one ordering decision per
+ * node it visits.
+ *
+ * When the comparator is std::less and the key offers a three-way
+ * compare() member (std::string, std::string_view, ...), a single call
+ * says "left", "right" or "found", so the descent can stop early.
+ * Built-in arithmetic keys under std::less or std::greater stop early
+ * too: "equal" and "less" come out of the same machine compare, which
+ * the compiler turns into a conditional move. Otherwise the descent asks
+ * comp(key, nodeKey) once per level and checks for equality once at the
+ * bottom, the way std::lower_bound does.
+ */
+
+/**
+ * True for std::less<T> and the transparent std::less<>.
+ */
+template<typename Compare>
+struct IsStdLess : std::false_type { };
+
+template<typename T>
+struct IsStdLess<std::less<T> > : std::true_type { };
+
+/**
+ * True for the standard orderings whose notion of equivalence is plain
+ * operator==: std::less<T>, std::greater<T> and their transparent forms.
+ */
+template<typename Compare>
+struct IsStdOrder : IsStdLess<Compare> { };
+
+template<typename T>
+struct IsStdOrder<std::greater<T> > : std::true_type { };
+
+/**
+ * True if a.compare(b) is a valid expression.
+ */
+template<typename A, typename B, typename = void>
+struct HasCompareMember : std::false_type { };
+
+template<typename A, typename B>
+struct HasCompareMember<A, B,
+    decltype((void)std::declval<const A&>().compare(std::declval<const B&>()))> : std::true_type { };
+
+/**
+ * True if comparing an A against a B in a tree ordered by Compare can be
+ * done with one three-way call.
+ */
+template<typename Compare, typename A, typename B>
+struct UsesThreeWay :
+    std::integral_constant<bool, IsStdLess<Compare>::value && HasCompareMember<A, B>::value> { };
+
+/**
+ * True if A and B are built-in arithmetic types ordered by a standard
+ * comparator, so a == b is exactly "neither orders before the other".
+ */
+template<typename Compare, typename A, typename B>
+struct UsesBuiltinEquality :
+    std::integral_constant<bool, IsStdOrder<Compare>::value &&
+                                 std::is_arithmetic<A>::value && std::is_arithmetic<B>::value> { };
+
+/**
+ * Returns a negative number if a orders before b, a positive number if it
+ * orders after, and 0 if they are equivalent. Costs one comparison when
+ * UsesThreeWay holds and up to two otherwise.
+ */
+template<typename Compare, typename A, typename B>
+int threeWayCompare(const Compare& comp, const A& a, const B& b)
+{
+    if constexpr (UsesThreeWay<Compare, A, B>::value){
+      return a.compare(b);
+    }
+    else{
+      if(comp(a, b)){
+        return -1;
+      }
+      return comp(b, a) ? 1 : 0;
+    }
+}
+
+/**
+ * Detects a transparent comparator (one that declares is_transparent,
+ * like std::less<>), which allows lookups by any type it can compare
+ * against the key.
+ */
+template<typename Compare, typename = void>
+struct IsTransparent : std::false_type { };
+
+template<typename Compare>
+struct IsTransparent<Compare, std::void_t<typename Compare::is_transparent> > : std::true_type { };
+
+#endif
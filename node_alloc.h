@@ -0,0 +1,451 @@
+#ifndef NODE_ALLOC_H
+#define NODE_ALLOC_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Node allocation policies for BinarySearchTree and its subclasses.
+ *
+ * A policy is any class providing:
+ *
+ *   void* allocate(std::size_t bytes);   // storage for exactly one node
+ *   void deallocate(void* p);            // give back storage from allocate()
+ *   void release();                      // drop every node handed out so far
+ *   void adopt(Policy& other);           // take over other's nodes (see below)
+ *   static const bool releasesInBulk;    // true if release() frees the memory
+ *
+ * Every tree owns its own allocator object, and a tree only ever asks it
+ * for nodes of a single size. Policies need not be thread safe: a parallel
+ * bulk load gives each task a default-constructed allocator of its own as
+ * an arena, and afterwards the tree's allocator adopt()s every arena, so
+ * that nodes allocated from an arena can be deallocated and released
+ * through the tree's allocator from then on.
+ */
+
+/**
+ * The default policy: every node is a separate trip through the global
+ * operator new / operator delete, exactly like a plain new Node.
+ */
+class HeapNodeAllocator
+{
+public:
+    static const bool releasesInBulk = false;
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p);
+    void release();
+    void adopt(HeapNodeAllocator& other);
+};
+
+/**
+ * A slab/arena pool for tree nodes.
+ *
+ * Nodes are carved out of large slabs with a bump pointer, so consecutive
+ * inserts land next to each other in memory. Nodes freed by remove() go on
+ * an intrusive free list and are handed out again before the slab is bumped.
+ * Slabs double in size (up to MAX_SLAB_NODES nodes) so a tree of n nodes
+ * owns O(log n) slabs, and release() gives all of them back without
+ * visiting a single node.
+ *
+ * The pool is not copyable; two trees must never share one.
+ */
+class PoolNodeAllocator
+{
+public:
+    static const bool releasesInBulk = true;
+
+    explicit PoolNodeAllocator(std::size_t firstSlabNodes = 64);
+    ~PoolNodeAllocator();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p);
+    void release();
+    void adopt(PoolNodeAllocator& other);
+
+    // Number of slabs currently held, mostly useful for tests.
+    std::size_t slabCount() const;
+
+    static const std::size_t MAX_SLAB_NODES = 1 << 16;
+
+private:
+    PoolNodeAllocator(const PoolNodeAllocator&);
+    PoolNodeAllocator& operator=(const PoolNodeAllocator&);
+
+    // A free slot reuses the node storage itself as the list link.
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    // Every slab starts with this header, so the slabs form a list too.
+    struct SlabHeader
+    {
+        SlabHeader* next;
+    };
+
+    void addSlab();
+
+    SlabHeader* slabs_;
+    FreeSlot* freeList_;
+    char* bump_;
+    char* bumpEnd_;
+    std::size_t slotSize_;
+    std::size_t firstSlabNodes_;
+    std::size_t nextSlabNodes_;
+    std::size_t slabCount_;
+};
+
+/**
+ * A heap policy for trees that readers walk without locks. deallocate()
+ * does not free a node, since a reader may still be looking at it; it
+ * only retires it. The owner collects retired nodes with takeRetired() and
+ * hands them to freeRetired() once no reader can reach them any more.
+ * Anything still retired when the allocator dies is freed then.
+ *
+ * A retired node must keep reading as it did while it was linked in, so
+ * the retired list is not threaded through the node itself. Every node
+ * is allocated with a header in front of it, and the list runs through
+ * the headers, which no reader ever looks at.
+ */
+class DeferredNodeAllocator
+{
+public:
+    static const bool releasesInBulk = false;
+
+    // The header in front of every node, which links it into the
+    // retired list once it is retired.
+    struct RetiredSlot
+    {
+        RetiredSlot* next;
+    };
+
+    DeferredNodeAllocator();
+    ~DeferredNodeAllocator();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p);
+    void release();
+    void adopt(DeferredNodeAllocator& other);
+
+    RetiredSlot* takeRetired();
+    static void freeRetired(RetiredSlot* list);
+
+private:
+    DeferredNodeAllocator(const DeferredNodeAllocator&);
+    DeferredNodeAllocator& operator=(const DeferredNodeAllocator&);
+
+    // Header size, rounded up so the node after it stays aligned.
+    static const std::size_t HEADER_BYTES =
+        (sizeof(RetiredSlot) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    RetiredSlot* retired_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the HeapNodeAllocator class.
+  ---------------------------------------------------
+*/
+
+/**
+* Allocates one node's worth of storage from the global heap.
+*/
+inline void* HeapNodeAllocator::allocate(std::size_t bytes)
+{
+    return ::operator new(bytes);
+}
+
+/**
+* Returns a node's storage to the global heap.
+*/
+inline void HeapNodeAllocator::deallocate(void* p)
+{
+    ::operator delete(p);
+}
+
+/**
+* Nothing to do: the heap can only free nodes one at a time, so the tree
+* walks itself instead (see releasesInBulk).
+*/
+inline void HeapNodeAllocator::release()
+{
+
+}
+
+/**
+* Nothing to do: heap nodes can be freed through any heap allocator.
+*/
+inline void HeapNodeAllocator::adopt(HeapNodeAllocator& other)
+{
+
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the HeapNodeAllocator class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the PoolNodeAllocator class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an empty pool. No memory is taken until the first allocate(),
+* which also fixes the slot size.
+*/
+inline PoolNodeAllocator::PoolNodeAllocator(std::size_t firstSlabNodes) :
+    slabs_(NULL),
+    freeList_(NULL),
+    bump_(NULL),
+    bumpEnd_(NULL),
+    slotSize_(0),
+    firstSlabNodes_(firstSlabNodes == 0 ? 1 : firstSlabNodes),
+    nextSlabNodes_(firstSlabNodes_),
+    slabCount_(0)
+{
+
+}
+
+/**
+* Frees every slab. Any nodes still living in them must already have been
+* destroyed by the owning tree.
+*/
+inline PoolNodeAllocator::~PoolNodeAllocator()
+{
+    release();
+}
+
+/**
+* Hands out a slot, preferring recycled ones from the free list.
+*/
+inline void* PoolNodeAllocator::allocate(std::size_t bytes)
+{
+    if(slotSize_ == 0){
+      // round the slot up so every slot in a slab stays suitably aligned
+      const std::size_t align = alignof(std::max_align_t);
+      std::size_t size = bytes < sizeof(FreeSlot) ? sizeof(FreeSlot) : bytes;
+      slotSize_ = (size + align - 1) / align * align;
+    }
+    if(bytes > slotSize_){
+      throw std::bad_alloc();
+    }
+
+    if(freeList_ != NULL){
+      FreeSlot* slot = freeList_;
+      freeList_ = slot->next;
+      return slot;
+    }
+    if(bump_ == bumpEnd_){
+      addSlab();
+    }
+    void* slot = bump_;
+    bump_ += slotSize_;
+    return slot;
+}
+
+/**
+* Puts a slot on the free list so the next allocate() reuses it.
+*/
+inline void PoolNodeAllocator::deallocate(void* p)
+{
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = freeList_;
+    freeList_ = slot;
+}
+
+/**
+* Frees every slab at once. This is O(number of slabs), not O(number of
+* nodes), and leaves the pool ready to be used again.
+*/
+inline void PoolNodeAllocator::release()
+{
+    while(slabs_ != NULL){
+      SlabHeader* next = slabs_->next;
+      std::free(slabs_);
+      slabs_ = next;
+    }
+    freeList_ = NULL;
+    bump_ = NULL;
+    bumpEnd_ = NULL;
+    nextSlabNodes_ = firstSlabNodes_;
+    slabCount_ = 0;
+}
+
+/**
+* Takes over other's slabs, and with them every node other handed out;
+* other is left empty. Both pools must serve nodes of the same size.
+* O(number of slabs) plus the slots other never handed out, which are
+* threaded onto the free list here rather than wasted.
+*/
+inline void PoolNodeAllocator::adopt(PoolNodeAllocator& other)
+{
+    if(other.slabs_ == NULL){
+      return;
+    }
+    if(slotSize_ == 0){
+      slotSize_ = other.slotSize_;
+    }
+
+    SlabHeader* last = other.slabs_;
+    while(last->next != NULL){
+      last = last->next;
+    }
+    last->next = slabs_;
+    slabs_ = other.slabs_;
+    slabCount_ += other.slabCount_;
+
+    while(other.freeList_ != NULL){
+      FreeSlot* slot = other.freeList_;
+      other.freeList_ = slot->next;
+      deallocate(slot);
+    }
+    for(char* p = other.bump_; p != other.bumpEnd_; p += slotSize_){
+      deallocate(p);
+    }
+
+    other.slabs_ = NULL;
+    other.bump_ = NULL;
+    other.bumpEnd_ = NULL;
+    other.nextSlabNodes_ = other.firstSlabNodes_;
+    other.slabCount_ = 0;
+}
+
+/**
+* Returns the number of slabs currently held by the pool.
+*/
+inline std::size_t PoolNodeAllocator::slabCount() const
+{
+    return slabCount_;
+}
+
+/**
+* Grabs a new slab, twice the size of the previous one.
+*/
+inline void PoolNodeAllocator::addSlab()
+{
+    const std::size_t align = alignof(std::max_align_t);
+    std::size_t headerSize = (sizeof(SlabHeader) + align - 1) / align * align;
+    void* mem = std::malloc(headerSize + nextSlabNodes_ * slotSize_);
+    if(mem == NULL){
+      throw std::bad_alloc();
+    }
+
+    SlabHeader* slab = static_cast<SlabHeader*>(mem);
+    slab->next = slabs_;
+    slabs_ = slab;
+    ++slabCount_;
+
+    bump_ = static_cast<char*>(mem) + headerSize;
+    bumpEnd_ = bump_ + nextSlabNodes_ * slotSize_;
+    if(nextSlabNodes_ < MAX_SLAB_NODES){
+      nextSlabNodes_ *= 2;
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PoolNodeAllocator class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the DeferredNodeAllocator class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an allocator with nothing retired.
+*/
+inline DeferredNodeAllocator::DeferredNodeAllocator() :
+    retired_(NULL)
+{
+
+}
+
+/**
+* Frees whatever is still retired. The owning tree must make sure no
+* reader is left by then.
+*/
+inline DeferredNodeAllocator::~DeferredNodeAllocator()
+{
+    freeRetired(retired_);
+}
+
+/**
+* Takes one node's worth of storage, plus its header, from the global heap.
+*/
+inline void* DeferredNodeAllocator::allocate(std::size_t bytes)
+{
+    char* block = static_cast<char*>(::operator new(HEADER_BYTES + bytes));
+    return block + HEADER_BYTES;
+}
+
+/**
+* Retires a node: it stays allocated, and its bytes untouched, until
+* freeRetired() is called on it. Only its header is written.
+*/
+inline void DeferredNodeAllocator::deallocate(void* p)
+{
+    RetiredSlot* slot = reinterpret_cast<RetiredSlot*>(static_cast<char*>(p) - HEADER_BYTES);
+    slot->next = retired_;
+    retired_ = slot;
+}
+
+/**
+* Nothing to do: nodes are retired one at a time (see releasesInBulk).
+*/
+inline void DeferredNodeAllocator::release()
+{
+
+}
+
+/**
+* Takes over other's retired nodes; live ones need nothing, since they
+* came from the global heap.
+*/
+inline void DeferredNodeAllocator::adopt(DeferredNodeAllocator& other)
+{
+    while(other.retired_ != NULL){
+      RetiredSlot* slot = other.retired_;
+      other.retired_ = slot->next;
+      slot->next = retired_;
+      retired_ = slot;
+    }
+}
+
+/**
+* Returns every node retired since the last call and forgets them.
+*/
+inline DeferredNodeAllocator::RetiredSlot* DeferredNodeAllocator::takeRetired()
+{
+    RetiredSlot* list = retired_;
+    retired_ = NULL;
+    return list;
+}
+
+/**
+* Gives a list from takeRetired() back to the heap. Each slot is the
+* start of its block, header and node.
+*/
+inline void DeferredNodeAllocator::freeRetired(RetiredSlot* list)
+{
+    while(list != NULL){
+      RetiredSlot* next = list->next;
+      ::operator delete(list);
+      list = next;
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the DeferredNodeAllocator class.
+  -------------------------------------------------
+*/
+
+#endif
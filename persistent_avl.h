@@ -0,0 +1,969 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "reader_epochs.h"
+
+/**
+ * A node of a PersistentAVLTree. A node never changes once the tree has
+ * published it: a write that would modify it builds a replacement, so any
+ * number of versions of the tree can share it. For the same reason there
+ * is no parent pointer, since a shared node has a different parent in
+ * each version.
+ */
+template<typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    PersistentAVLNode(const std::pair<const Key, Value>& item,
+                      const PersistentAVLNode* left, const PersistentAVLNode* right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    const PersistentAVLNode* getLeft() const;
+    const PersistentAVLNode* getRight() const;
+
+    // Height of node's subtree, 0 for an empty one.
+    static int heightOf(const PersistentAVLNode* node);
+
+private:
+    std::pair<const Key, Value> item_;
+    const PersistentAVLNode* left_;
+    const PersistentAVLNode* right_;
+    int height_;
+};
+
+/**
+ * An AVL tree with path copying, for readers that need a consistent
+ * point-in-time view while writes go on.
+ *
+ * insert and remove never modify a published node. They build new copies
+ * of the nodes on the path from the root down to the change (and of any
+ * node a rotation moves), point them at the untouched subtrees of the old
+ * version, and publish the new root with one atomic store. A reader calls
+ * snapshot() to pin the root current at that moment; it can then search
+ * and iterate that version for as long as it likes, with no locks and no
+ * retries, while later writes publish newer versions beside it.
+ *
+ * Every write leaves behind the nodes it copied. Those are reclaimed with
+ * epochs (see ReaderEpochs): a snapshot pins the epoch it was taken in, and
+ * a batch of replaced nodes is freed once every snapshot that could reach
+ * it has been destroyed. A long-lived snapshot therefore holds back the
+ * memory of every write made while it lives, much like a long-running
+ * transaction in an MVCC database.
+ *
+ * Writers are serialized with a mutex. A write costs O(log n) new nodes,
+ * so Key and Value should be cheap to copy.
+ *
+ * AVLTree itself cannot work this way: its nodes have parent pointers,
+ * which structural sharing rules out. That is why this is a separate class
+ * rather than a mode of AVLTree.
+ */
+template<class Key, class Value, class Compare = std::less<Key> >
+class PersistentAVLTree
+{
+    typedef PersistentAVLNode<Key, Value> NodeType;
+
+public:
+    class Snapshot;
+
+    /**
+     * A forward iterator over one snapshot. It stays valid for as long as
+     * the Snapshot it came from.
+     */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    private:
+        friend class Snapshot;
+        void pushLeftSpine(const NodeType* node);
+
+        // Nodes the walk has still to visit on its way back up: the
+        // current node on top, under it every ancestor the walk went left
+        // at. Nodes carry no parent pointer, so the path has to be kept
+        // here. Empty at the end.
+        std::vector<const NodeType*> pending_;
+    };
+
+    /**
+     * A pinned, read-only version of the tree. Later writes to the tree
+     * do not show up in it. It must not outlive its tree.
+     */
+    class Snapshot
+    {
+    public:
+        Snapshot(Snapshot&& other);
+        Snapshot& operator=(Snapshot&& other);
+        ~Snapshot();
+
+        size_t size() const;
+        bool empty() const;
+
+        const_iterator begin() const;
+        const_iterator end() const;
+        const_iterator find(const Key& key) const;
+        const_iterator lower_bound(const Key& key) const;
+        const_iterator upper_bound(const Key& key) const;
+        bool contains(const Key& key) const;
+
+    private:
+        friend class PersistentAVLTree;
+        explicit Snapshot(const PersistentAVLTree& tree);
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+
+        const PersistentAVLTree* tree_;
+        std::atomic<size_t>* pin_;
+        const NodeType* root_;
+        size_t size_;
+    };
+
+    explicit PersistentAVLTree(const Compare& comp = Compare());
+    ~PersistentAVLTree();
+
+    // Writer side, serialized by a mutex. insert overwrites an existing
+    // value and returns true if the key is new.
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    // Reader side, lock-free and safe from any number of threads.
+    Snapshot snapshot() const;
+    size_t size() const;
+    bool empty() const;
+
+private:
+    PersistentAVLTree(const PersistentAVLTree&);
+    PersistentAVLTree& operator=(const PersistentAVLTree&);
+
+    // One published version. When a write replaces it, the nodes that
+    // write copied are listed in it and it goes on a retired list, so
+    // freeing a version frees its garbage too.
+    struct Version
+    {
+        Version(const NodeType* root, size_t size);
+
+        const NodeType* root;
+        size_t size;
+        std::vector<const NodeType*> replaced;
+        Version* nextRetired;
+    };
+
+    const NodeType* insertPath(const NodeType* node, const std::pair<const Key, Value>& item, bool& added);
+    const NodeType* removePath(const NodeType* node, const Key& key);
+    const NodeType* removeSmallest(const NodeType* node, const NodeType*& smallest);
+    const NodeType* balanced(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right);
+    const NodeType* makeNode(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right);
+    void replace(const NodeType* node);
+    void commit(const NodeType* root, size_t size);
+    void abandon();
+    void reclaim();
+    static void freeVersions(Version* list);
+    static void deleteTree(const NodeType* node);
+
+    Compare comp_;
+    std::atomic<Version*> current_;
+    ReaderEpochs epochs_;
+    Version* retired_;      // replaced since the last epoch advance
+    Version* waiting_;      // replaced before it
+    std::mutex writeMutex_;
+
+    // Bookkeeping for the write in progress: the nodes it has made, and
+    // the published nodes it has copied. Nothing is retired until the
+    // write commits, so a write that throws leaves the tree untouched.
+    std::vector<const NodeType*> created_;
+    std::vector<const NodeType*> replaced_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* Builds a node over two existing subtrees, which it may share with other
+* versions of the tree.
+*/
+template<typename Key, typename Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item,
+                                                 const PersistentAVLNode* left, const PersistentAVLNode* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(heightOf(left), heightOf(right)))
+{
+
+}
+
+/**
+* A getter for the key/value pair.
+*/
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& PersistentAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+/**
+* A getter for the key.
+*/
+template<typename Key, typename Value>
+const Key& PersistentAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+/**
+* A getter for the value.
+*/
+template<typename Key, typename Value>
+const Value& PersistentAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+/**
+* A getter for the left child.
+*/
+template<typename Key, typename Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+/**
+* A getter for the right child.
+*/
+template<typename Key, typename Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+/**
+* Returns the height of node's subtree, 0 if node is NULL.
+*/
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::heightOf(const PersistentAVLNode* node)
+{
+    return (node == nullptr) ? 0 : node->height_;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  -------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentAVLTree::const_iterator class.
+  -------------------------------------------------
+*/
+
+/**
+* Creates an end iterator.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator()
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::reference
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return pending_.back()->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::pointer
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(pending_.back()->getItem());
+}
+
+/**
+* Checks if two iterators are at the same item (or both at the end).
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if(pending_.empty() || rhs.pending_.empty()){
+      return pending_.empty() == rhs.pending_.empty();
+    }
+    return pending_.back() == rhs.pending_.back();
+}
+
+/**
+* Checks if two iterators are at different items.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next item in key order: the smallest item of the
+* current node's right subtree, or else the nearest ancestor the walk
+* went left at, which is already next in pending_.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    const NodeType* current = pending_.back();
+    pending_.pop_back();
+    pushLeftSpine(current->getRight());
+    return *this;
+}
+
+/**
+* Post-increment.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator before(*this);
+    ++(*this);
+    return before;
+}
+
+/**
+* Pushes node and each left child below it; the last one pushed is the
+* smallest item of node's subtree.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::const_iterator::pushLeftSpine(const NodeType* node)
+{
+    while(node != nullptr){
+      pending_.push_back(node);
+      node = node->getLeft();
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLTree::const_iterator class.
+  -------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot class.
+  -------------------------------------------------
+*/
+
+/**
+* Pins the current epoch, then reads the current version. The pin comes
+* first so that the writer cannot free the version's nodes between the
+* two.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const PersistentAVLTree& tree) :
+    tree_(&tree),
+    pin_(tree.epochs_.enter())
+{
+    const Version* version = tree.current_.load(std::memory_order_acquire);
+    root_ = version->root;
+    size_ = version->size;
+}
+
+/**
+* Takes over other's pin; other is left empty.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(Snapshot&& other) :
+    tree_(other.tree_),
+    pin_(other.pin_),
+    root_(other.root_),
+    size_(other.size_)
+{
+    other.pin_ = nullptr;
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
+
+/**
+* Drops this snapshot's pin and takes over other's.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::operator=(Snapshot&& other)
+{
+    if(this != &other){
+      if(pin_ != nullptr){
+        ReaderEpochs::leave(pin_);
+      }
+      tree_ = other.tree_;
+      pin_ = other.pin_;
+      root_ = other.root_;
+      size_ = other.size_;
+      other.pin_ = nullptr;
+      other.root_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+}
+
+/**
+* Unpins the epoch, letting the writer free what only this snapshot
+* could still reach.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    if(pin_ != nullptr){
+      ReaderEpochs::leave(pin_);
+    }
+}
+
+/**
+* Returns the number of items in this version.
+*/
+template<class Key, class Value, class Compare>
+size_t PersistentAVLTree<Key, Value, Compare>::Snapshot::size() const
+{
+    return size_;
+}
+
+/**
+* Returns true if this version has no items.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::begin() const
+{
+    const_iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+/**
+* Returns an iterator past the largest item.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::end() const
+{
+    return const_iterator();
+}
+
+/**
+* Returns an iterator to key's item, or end() if key is not present.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::find(const Key& key) const
+{
+    const_iterator it = lower_bound(key);
+    if(it != end() && tree_->comp_(key, it->first)){
+      return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+* Every node the descent goes left at is greater than or equal to key,
+* and each is smaller than the one before, so the last of them is the
+* answer and the ones before it are its pending ancestors.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::lower_bound(const Key& key) const
+{
+    const_iterator it;
+    const NodeType* node = root_;
+    while(node != nullptr){
+      if(tree_->comp_(node->getKey(), key)){
+        node = node->getRight();
+      }
+      else{
+        it.pending_.push_back(node);
+        node = node->getLeft();
+      }
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::upper_bound(const Key& key) const
+{
+    const_iterator it;
+    const NodeType* node = root_;
+    while(node != nullptr){
+      if(tree_->comp_(key, node->getKey())){
+        it.pending_.push_back(node);
+        node = node->getLeft();
+      }
+      else{
+        node = node->getRight();
+      }
+    }
+    return it;
+}
+
+/**
+* Returns true if key is present, without building an iterator.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::contains(const Key& key) const
+{
+    const NodeType* node = root_;
+    while(node != nullptr){
+      if(tree_->comp_(key, node->getKey())){
+        node = node->getLeft();
+      }
+      else if(tree_->comp_(node->getKey(), key)){
+        node = node->getRight();
+      }
+      else{
+        return true;
+      }
+    }
+    return false;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot class.
+  -------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  -------------------------------------------------
+*/
+
+/**
+* A version starts out current, with nothing replaced yet.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Version::Version(const NodeType* root, size_t size) :
+    root(root),
+    size(size),
+    nextRetired(nullptr)
+{
+
+}
+
+/**
+* Creates an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    comp_(comp),
+    current_(new Version(nullptr, 0)),
+    retired_(nullptr),
+    waiting_(nullptr)
+{
+
+}
+
+/**
+* Frees every node of every version. No snapshot may still be alive.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    Version* current = current_.load(std::memory_order_relaxed);
+    deleteTree(current->root);
+    delete current;
+    freeVersions(waiting_);
+    freeVersions(retired_);
+}
+
+/**
+* Inserts keyValuePair, or overwrites the value of an existing key, and
+* publishes the result as a new version. Returns true if the key is new.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    const Version* current = current_.load(std::memory_order_relaxed);
+    bool added = false;
+    try{
+      const NodeType* root = insertPath(current->root, keyValuePair, added);
+      commit(root, current->size + (added ? 1 : 0));
+    }
+    catch(...){
+      abandon();
+      throw;
+    }
+    reclaim();
+    return added;
+}
+
+/**
+* Removes key and publishes the result as a new version. Nothing is
+* published if key is not present.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    const Version* current = current_.load(std::memory_order_relaxed);
+    const NodeType* node = current->root;
+    while(node != nullptr && (comp_(key, node->getKey()) || comp_(node->getKey(), key))){
+      node = comp_(key, node->getKey()) ? node->getLeft() : node->getRight();
+    }
+    if(node == nullptr){
+      return;
+    }
+    try{
+      const NodeType* root = removePath(current->root, key);
+      commit(root, current->size - 1);
+    }
+    catch(...){
+      abandon();
+      throw;
+    }
+    reclaim();
+}
+
+/**
+* Publishes an empty version. The old nodes are reclaimed like any
+* others, once no snapshot can reach them.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    const Version* current = current_.load(std::memory_order_relaxed);
+    if(current->root == nullptr){
+      return;
+    }
+    try{
+      //Every node of the current version is replaced by nothing
+      std::vector<const NodeType*> stack(1, current->root);
+      while(!stack.empty()){
+        const NodeType* node = stack.back();
+        stack.pop_back();
+        replace(node);
+        if(node->getLeft() != nullptr){
+          stack.push_back(node->getLeft());
+        }
+        if(node->getRight() != nullptr){
+          stack.push_back(node->getRight());
+        }
+      }
+      commit(nullptr, 0);
+    }
+    catch(...){
+      abandon();
+      throw;
+    }
+    reclaim();
+}
+
+/**
+* Pins the current version for reading.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot
+PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    return Snapshot(*this);
+}
+
+/**
+* Returns the number of items in the current version.
+*/
+template<class Key, class Value, class Compare>
+size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return snapshot().size();
+}
+
+/**
+* Returns true if the current version is empty.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Returns a copy of node's subtree with item inserted (or its value
+* overwritten). Only the nodes on the path to item are copied; everything
+* beside the path is shared with the old version.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::insertPath(const NodeType* node, const std::pair<const Key, Value>& item, bool& added)
+{
+    if(node == nullptr){
+      added = true;
+      return makeNode(item, nullptr, nullptr);
+    }
+    if(comp_(item.first, node->getKey())){
+      const NodeType* left = insertPath(node->getLeft(), item, added);
+      replace(node);
+      return balanced(node->getItem(), left, node->getRight());
+    }
+    if(comp_(node->getKey(), item.first)){
+      const NodeType* right = insertPath(node->getRight(), item, added);
+      replace(node);
+      return balanced(node->getItem(), node->getLeft(), right);
+    }
+    replace(node);
+    return makeNode(item, node->getLeft(), node->getRight());
+}
+
+/**
+* Returns a copy of node's subtree without key, which must be present.
+* A node with two children takes over the item of its successor.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removePath(const NodeType* node, const Key& key)
+{
+    if(comp_(key, node->getKey())){
+      const NodeType* left = removePath(node->getLeft(), key);
+      replace(node);
+      return balanced(node->getItem(), left, node->getRight());
+    }
+    if(comp_(node->getKey(), key)){
+      const NodeType* right = removePath(node->getRight(), key);
+      replace(node);
+      return balanced(node->getItem(), node->getLeft(), right);
+    }
+    replace(node);
+    if(node->getLeft() == nullptr){
+      return node->getRight();
+    }
+    if(node->getRight() == nullptr){
+      return node->getLeft();
+    }
+    const NodeType* smallest = nullptr;
+    const NodeType* right = removeSmallest(node->getRight(), smallest);
+    return balanced(smallest->getItem(), node->getLeft(), right);
+}
+
+/**
+* Returns a copy of node's subtree without its smallest item, and sets
+* smallest to the node that held it.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeSmallest(const NodeType* node, const NodeType*& smallest)
+{
+    replace(node);
+    if(node->getLeft() == nullptr){
+      smallest = node;
+      return node->getRight();
+    }
+    const NodeType* left = removeSmallest(node->getLeft(), smallest);
+    return balanced(node->getItem(), left, node->getRight());
+}
+
+/**
+* Builds a node for item over left and right, whose heights differ by at
+* most two, rotating if they differ by two. A rotation rebuilds the nodes
+* it moves rather than relinking them, since they may be shared.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::balanced(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right)
+{
+    int leftHeight = NodeType::heightOf(left);
+    int rightHeight = NodeType::heightOf(right);
+    if(leftHeight > rightHeight + 1){
+      replace(left);
+      if(NodeType::heightOf(left->getLeft()) >= NodeType::heightOf(left->getRight())){
+        //Single rotation to the right
+        const NodeType* lowered = makeNode(item, left->getRight(), right);
+        return makeNode(left->getItem(), left->getLeft(), lowered);
+      }
+      //Double rotation: left's right child comes up to the top
+      const NodeType* middle = left->getRight();
+      replace(middle);
+      const NodeType* newLeft = makeNode(left->getItem(), left->getLeft(), middle->getLeft());
+      const NodeType* newRight = makeNode(item, middle->getRight(), right);
+      return makeNode(middle->getItem(), newLeft, newRight);
+    }
+    if(rightHeight > leftHeight + 1){
+      replace(right);
+      if(NodeType::heightOf(right->getRight()) >= NodeType::heightOf(right->getLeft())){
+        //Single rotation to the left
+        const NodeType* lowered = makeNode(item, left, right->getLeft());
+        return makeNode(right->getItem(), lowered, right->getRight());
+      }
+      //Double rotation: right's left child comes up to the top
+      const NodeType* middle = right->getLeft();
+      replace(middle);
+      const NodeType* newLeft = makeNode(item, left, middle->getLeft());
+      const NodeType* newRight = makeNode(right->getItem(), middle->getRight(), right->getRight());
+      return makeNode(middle->getItem(), newLeft, newRight);
+    }
+    return makeNode(item, left, right);
+}
+
+/**
+* Allocates a node for the write in progress, noting it so abandon() can
+* free it if the write fails.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::makeNode(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right)
+{
+    created_.push_back(nullptr);
+    created_.back() = new NodeType(item, left, right);
+    return created_.back();
+}
+
+/**
+* Notes that the write in progress no longer uses node. node is freed
+* after the write commits and no snapshot can reach it. A rotation may
+* replace a node this same write made, which is simply freed late.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::replace(const NodeType* node)
+{
+    replaced_.push_back(node);
+}
+
+/**
+* Publishes root as the current version. Only the allocation of the new
+* version can fail, and it comes first; from the store on, nothing throws.
+* The replaced nodes are handed to the old version, which is retired.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::commit(const NodeType* root, size_t size)
+{
+    Version* next = new Version(root, size);
+    Version* old = current_.load(std::memory_order_relaxed);
+    old->replaced.swap(replaced_);
+    created_.clear();
+    current_.store(next, std::memory_order_release);
+    old->nextRetired = retired_;
+    retired_ = old;
+}
+
+/**
+* Undoes a failed write: frees what it made and forgets what it copied.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::abandon()
+{
+    for(size_t i = 0; i < created_.size(); ++i){
+      delete created_[i];
+    }
+    created_.clear();
+    replaced_.clear();
+}
+
+/**
+* Two batches of retired versions are tracked: waiting_, replaced before
+* the last epoch advance, and retired_, replaced since. waiting_ is freed
+* once no snapshot from the previous epoch is left; then, if anything has
+* been retired since, it becomes the new waiting_ and the epoch moves on,
+* so snapshots taken from now on can't reach it.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::reclaim()
+{
+    if(waiting_ != nullptr){
+      if(!epochs_.previousDrained()){
+        return;
+      }
+      freeVersions(waiting_);
+      waiting_ = nullptr;
+    }
+
+    if(retired_ != nullptr){
+      waiting_ = retired_;
+      retired_ = nullptr;
+      epochs_.advance();
+    }
+}
+
+/**
+* Frees a list of retired versions and the nodes each one lists.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::freeVersions(Version* list)
+{
+    while(list != nullptr){
+      Version* next = list->nextRetired;
+      for(size_t i = 0; i < list->replaced.size(); ++i){
+        delete list->replaced[i];
+      }
+      delete list;
+      list = next;
+    }
+}
+
+/**
+* Frees every node of one version's tree.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::deleteTree(const NodeType* node)
+{
+    if(node == nullptr){
+      return;
+    }
+    deleteTree(node->getLeft());
+    deleteTree(node->getRight());
+    delete node;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,491 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <cstdint>
+#include <algorithm>
+#include "bst.h"
+
+/**
+* A node for a red-black tree. The color takes no space of its own: nodes
+* are at least pointer aligned, so the low bit of the parent pointer is
+* always zero and holds the color instead. getParent and setParent hide
+* the NodeBase ones to mask the bit off and keep it, and the tree code
+* only ever goes through them, so an RBNode is just the item and three
+* pointers.
+*/
+template <typename Key, typename Value>
+class RBNode : public NodeBase<Key, Value, RBNode<Key, Value> >
+{
+public:
+    // Constructor.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    template<typename... Args>
+    RBNode(std::in_place_t, RBNode<Key, Value>* parent, Args&&... itemArgs);
+
+    // Parent pointer with the color bit masked off.
+    RBNode<Key, Value>* getParent() const;
+    void setParent(RBNode<Key, Value>* parent);
+
+    // Getter/setter for the node's color.
+    bool isRed() const;
+    void setRed(bool red);
+
+private:
+    static const uintptr_t RED_BIT = 1;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor.
+* A new node is red, since it is linked in as a leaf and a red leaf never changes any
+* path's count of black nodes.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent) :
+    NodeBase<Key, Value, RBNode<Key, Value> >(key, value, parent)
+{
+    static_assert(alignof(RBNode<Key, Value>) > RED_BIT, "the color is kept in the parent pointer's low bit");
+    setRed(true);
+}
+
+/**
+* In-place constructor: itemArgs build the key/value pair directly inside
+* the node (see NodeBase). The node starts red as above.
+*/
+template<class Key, class Value>
+template<typename... Args>
+RBNode<Key, Value>::RBNode(std::in_place_t, RBNode<Key, Value>* parent, Args&&... itemArgs) :
+    NodeBase<Key, Value, RBNode<Key, Value> >(std::in_place, parent, std::forward<Args>(itemArgs)...)
+{
+    setRed(true);
+}
+
+/**
+* A getter for the parent, without the color bit.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getParent() const
+{
+    return reinterpret_cast<RBNode<Key, Value>*>(reinterpret_cast<uintptr_t>(this->parent_) & ~RED_BIT);
+}
+
+/**
+* A setter for the parent that leaves the color alone.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setParent(RBNode<Key, Value>* parent)
+{
+    uintptr_t color = reinterpret_cast<uintptr_t>(this->parent_) & RED_BIT;
+    this->parent_ = reinterpret_cast<RBNode<Key, Value>*>(reinterpret_cast<uintptr_t>(parent) | color);
+}
+
+/**
+* Returns true if the node is red, false if it is black.
+*/
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return (reinterpret_cast<uintptr_t>(this->parent_) & RED_BIT) != 0;
+}
+
+/**
+* Colors the node red, or black when red is false.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    uintptr_t parent = reinterpret_cast<uintptr_t>(this->parent_) & ~RED_BIT;
+    this->parent_ = reinterpret_cast<RBNode<Key, Value>*>(parent | (red ? RED_BIT : 0));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* A self-balancing red-black tree. Like AVLTree, it passes the comparator
+* and allocation policy through to BinarySearchTree along with its own
+* node type, inherits insertion and lookups, and rebalances through
+* leafFix and removeNode. Its balance is looser than AVL's (a path may be
+* up to twice as long as another), but an insert makes at most two
+* rotations and a remove at most three, against O(log n) for AVL removes,
+* which makes it the cheaper of the two under heavy insert/remove churn.
+*/
+template <class Key, class Value, class Compare = std::less<Key>, class Alloc = HeapNodeAllocator>
+class RedBlackTree : public BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >
+{
+public:
+    explicit RedBlackTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    RedBlackTree(InputIt first, InputIt last, bool sortFirst = false,
+                 const Compare& comp = Compare());
+
+    // True iff no red node has a red child and every path from the root
+    // down passes the same number of black nodes; O(n).
+    virtual bool isBalanced() const;
+protected:
+    virtual void removeNode(RBNode<Key, Value>* current);
+    virtual void nodeSwap( RBNode<Key, Value>* n1, RBNode<Key, Value>* n2);
+    //Helper functions
+    virtual void insertFix(RBNode<Key, Value>* current);
+    virtual void removeFix(RBNode<Key, Value>* current, RBNode<Key, Value>* parent);
+    virtual void rotateRight(RBNode<Key, Value>* current);
+    virtual void rotateLeft(RBNode<Key, Value>* current);
+    virtual void buildFix(RBNode<Key, Value>* node, int leftHeight, int rightHeight);
+    virtual void leafFix(RBNode<Key, Value>* leaf);
+
+    static bool isRed(RBNode<Key, Value>* node);
+    static int blackHeight(RBNode<Key, Value>* node);
+};
+
+/**
+* Default constructor for an empty red-black tree ordered by comp.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RedBlackTree<Key, Value, Compare, Alloc>::RedBlackTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >(comp)
+{
+
+}
+
+/**
+* Range constructor that bulk loads a balanced tree ordered by comp in
+* O(n). As with AVLTree, the load happens here so that buildFix dispatches to the
+* red-black version and colors the nodes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+RedBlackTree<Key, Value, Compare, Alloc>::RedBlackTree(InputIt first, InputIt last, bool sortFirst,
+                                                       const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >(comp)
+{
+    this->assign(first, last, sortFirst);
+}
+
+/**
+* Colors a node created by a bulk load, from the heights of its two
+* freshly built subtrees (which differ by at most one).
+* Recall: Giving a subtree of height h ceil(h / 2) black nodes on every
+* path down works out to this rule: a child is red exactly when it is one
+* shorter than an even-height parent. Such a child has odd height, so its
+* own children are black. Every node is made black here first and only
+* turned red by its parent's call, which leaves the root black.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::buildFix(RBNode<Key, Value>* node, int leftHeight, int rightHeight)
+{
+    int height = std::max(leftHeight, rightHeight) + 1;
+    node->setRed(false);
+    if(height % 2 == 0){
+      if(leftHeight == height - 1){
+        node->getLeft()->setRed(true);
+      }
+      if(rightHeight == height - 1){
+        node->getRight()->setRed(true);
+      }
+    }
+}
+
+/**
+* Called by BinarySearchTree::insert once a new (red) leaf is linked in.
+* Recall: If key is already in the tree, insert just overwrites the
+* value and no new leaf is made, so there is nothing to fix.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::leafFix(RBNode<Key, Value>* leaf)
+{
+    insertFix(leaf);
+}
+
+/**
+* Restores the red-black rules above current, a red node whose parent may
+* also be red. Recoloring moves the problem two levels up; once a rotation
+* is needed the tree is fixed, so there are at most two per insert.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::insertFix(RBNode<Key, Value>* current)
+{
+  TreeStats::FixScope stats(TreeStats::INSERT_FIX);
+  RBNode<Key, Value>* parent = current->getParent();
+  //current is the root, which is always black
+  if(parent == nullptr){
+    current->setRed(false);
+    return;
+  }
+  //a black parent means nothing is broken
+  if(!parent->isRed()){
+    return;
+  }
+
+  //parent is red, so it is not the root and grandp exists
+  RBNode<Key, Value>* grandp = parent->getParent();
+  RBNode<Key, Value>* uncle = (grandp->getLeft() == parent) ? grandp->getRight() : grandp->getLeft();
+
+  //Case 1: red uncle, recolor and carry on from the grandparent
+  if(isRed(uncle)){
+    parent->setRed(false);
+    uncle->setRed(false);
+    grandp->setRed(true);
+    insertFix(grandp);
+    return;
+  }
+
+  //parent is left of grandparent
+  if(grandp->getLeft() == parent){
+    //Case 2: zig zag, turned into case 3
+    if(parent->getRight() == current){
+      rotateLeft(parent);
+      std::swap(parent, current);
+    }
+    //Case 3: zig zig
+    rotateRight(grandp);
+  }
+  //parent is right of grandparent
+  else{
+    if(parent->getLeft() == current){
+      rotateRight(parent);
+      std::swap(parent, current);
+    }
+    rotateLeft(grandp);
+  }
+  parent->setRed(false);
+  grandp->setRed(true);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::rotateRight(RBNode<Key, Value>* current){
+  TreeStats::countRotation();
+  RBNode<Key, Value>* parent = current->getParent();
+  RBNode<Key, Value>* LC = current->getLeft();
+  //has a parent
+  if(parent != nullptr){
+    if(parent->getLeft() == current){
+      parent->setLeft(LC);
+    }
+    else{
+      parent->setRight(LC);
+    }
+  }
+  else{
+    this->root_ = LC;
+  }
+  LC->setParent(parent);
+  current->setParent(LC);
+  RBNode<Key, Value>* RC = LC->getRight();
+  if(RC != nullptr){
+    RC->setParent(current);
+  }
+  //readjust pointers
+  current->setLeft(RC);
+  LC->setRight(current);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::rotateLeft(RBNode<Key, Value>* current){
+  TreeStats::countRotation();
+  RBNode<Key, Value>* parent = current->getParent();
+  RBNode<Key, Value>* RC = current->getRight();
+  //has parent
+  if(parent != nullptr){
+    if(parent->getRight() == current){
+      parent->setRight(RC);
+    }
+    else{
+      parent->setLeft(RC);
+    }
+  }
+  else{
+    this->root_ = RC;
+  }
+  RC->setParent(parent);
+  current->setParent(RC);
+  RBNode<Key, Value>* LC = RC->getLeft();
+  if(LC != nullptr){
+    LC->setParent(current);
+  }
+  //readjust pointers
+  current->setRight(LC);
+  RC->setLeft(current);
+}
+
+/*
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ * BinarySearchTree::remove and erase find the node and call this.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::removeNode(RBNode<Key, Value>* current)
+{
+    this->beforeUnlink(current);
+    //two children
+    if(current->getLeft() != nullptr && current->getRight() != nullptr){
+      nodeSwap(current, this->predecessor(current));
+    }
+
+    //current now has at most one child, which takes its place
+    RBNode<Key, Value>* child = (current->getLeft() != nullptr) ? current->getLeft() : current->getRight();
+    RBNode<Key, Value>* parent = current->getParent();
+    bool wasRed = current->isRed();
+    this->unlinkNode(current);
+    this->destroyNode(current);
+    //taking out a red node changes no path's black count
+    if(wasRed){
+      return;
+    }
+    //a black node's only child is red, and can take over its black
+    if(child != nullptr){
+      child->setRed(false);
+      return;
+    }
+    removeFix(nullptr, parent);
+}
+
+/**
+ * Rebalances after a removal. Every path through current, a child of
+ * parent that may be NULL, is one black node short. Pushing the shortage
+ * up only recolors; once a rotation is needed the tree is fixed, so there
+ * are at most three per remove.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::removeFix(RBNode<Key, Value>* current, RBNode<Key, Value>* parent)
+{
+  TreeStats::FixScope stats(TreeStats::REMOVE_FIX);
+  //at the root the shortage is shared by every path; a red node can
+  //make it up by turning black
+  if(parent == nullptr || isRed(current)){
+    if(current != nullptr){
+      current->setRed(false);
+    }
+    return;
+  }
+
+  //current is left of parent. When current is NULL the sibling cannot be,
+  //since the paths through it have a black node to spare
+  if(parent->getLeft() == current){
+    RBNode<Key, Value>* sibling = parent->getRight();
+    //Case 1: red sibling, rotate it up so current gets a black one
+    if(sibling->isRed()){
+      sibling->setRed(false);
+      parent->setRed(true);
+      rotateLeft(parent);
+      sibling = parent->getRight();
+    }
+    //Case 2: both of the sibling's children are black, so shorten its
+    //side too and hand the shortage to parent
+    if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+      sibling->setRed(true);
+      removeFix(parent, parent->getParent());
+      return;
+    }
+    //Case 3: only the near child is red, rotate it up to make case 4
+    if(!isRed(sibling->getRight())){
+      sibling->getLeft()->setRed(false);
+      sibling->setRed(true);
+      rotateRight(sibling);
+      sibling = parent->getRight();
+    }
+    //Case 4: the far child is red; rotating the sibling up gives
+    //current's side the black it was missing
+    sibling->setRed(parent->isRed());
+    parent->setRed(false);
+    sibling->getRight()->setRed(false);
+    rotateLeft(parent);
+  }
+  //current is right of parent
+  else{
+    RBNode<Key, Value>* sibling = parent->getLeft();
+    //Case 1
+    if(sibling->isRed()){
+      sibling->setRed(false);
+      parent->setRed(true);
+      rotateRight(parent);
+      sibling = parent->getLeft();
+    }
+    //Case 2
+    if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+      sibling->setRed(true);
+      removeFix(parent, parent->getParent());
+      return;
+    }
+    //Case 3
+    if(!isRed(sibling->getLeft())){
+      sibling->getRight()->setRed(false);
+      sibling->setRed(true);
+      rotateLeft(sibling);
+      sibling = parent->getLeft();
+    }
+    //Case 4
+    sibling->setRed(parent->isRed());
+    parent->setRed(false);
+    sibling->getLeft()->setRed(false);
+    rotateRight(parent);
+  }
+}
+
+/**
+* Swaps two nodes' positions, and with them their colors, since a color
+* belongs to a position in the tree rather than to an item.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RedBlackTree<Key, Value, Compare, Alloc>::nodeSwap( RBNode<Key, Value>* n1, RBNode<Key, Value>* n2)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/**
+ * Return true iff the tree follows the red-black rules, which is what
+ * keeps its height under 2 log2(n + 1). The rebalancing always keeps them,
+ * so this walks the tree only to check.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+bool RedBlackTree<Key, Value, Compare, Alloc>::isBalanced() const
+{
+    return !isRed(this->root_) && blackHeight(this->root_) != -1;
+}
+
+/**
+* Returns true if node is red; NULL children count as black.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool RedBlackTree<Key, Value, Compare, Alloc>::isRed(RBNode<Key, Value>* node)
+{
+    return node != nullptr && node->isRed();
+}
+
+/**
+* Returns the number of black nodes on every path from node down to a
+* NULL child (which counts as one), or -1 if the paths disagree or a red
+* node has a red child.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+int RedBlackTree<Key, Value, Compare, Alloc>::blackHeight(RBNode<Key, Value>* node)
+{
+    if(node == nullptr){
+      return 1;
+    }
+    if(node->isRed() && (isRed(node->getLeft()) || isRed(node->getRight()))){
+      return -1;
+    }
+    int left = blackHeight(node->getLeft());
+    if(left == -1){
+      return -1;
+    }
+    int right = blackHeight(node->getRight());
+    if(right == -1 || right != left){
+      return -1;
+    }
+    return left + (node->isRed() ? 0 : 1);
+}
+
+#endif
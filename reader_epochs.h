@@ -0,0 +1,139 @@
+#ifndef READER_EPOCHS_H
+#define READER_EPOCHS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+/**
+ * Epoch bookkeeping for trees whose readers take no locks, so that a
+ * writer knows when memory it has unlinked can no longer be reached by
+ * any reader.
+ *
+ * A reader pins the current epoch for as long as it may hold pointers
+ * into the structure. The writer collects what it unlinks into a batch,
+ * advances the epoch, and frees the batch once previousDrained() says
+ * nobody pinned before the advance is left. Only two epochs are ever in
+ * flight: the writer must not advance again until the previous epoch has
+ * drained, which is what lets each reader slot get by with two counters.
+ *
+ * Readers hash onto slots by thread id, and each slot sits on its own
+ * cache line, so readers on different slots never share one.
+ */
+class ReaderEpochs
+{
+public:
+    ReaderEpochs();
+
+    // Reader side. enter() returns the counter to hand back to leave().
+    std::atomic<size_t>* enter() const;
+    static void leave(std::atomic<size_t>* pin);
+
+    // Writer side.
+    bool previousDrained() const;
+    void advance();
+
+private:
+    ReaderEpochs(const ReaderEpochs&);
+    ReaderEpochs& operator=(const ReaderEpochs&);
+
+    static size_t readerSlot();
+
+    static const size_t READER_SLOTS = 64;
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<size_t> active[2];
+    };
+
+    mutable ReaderSlot slots_[READER_SLOTS];
+    std::atomic<uint64_t> epoch_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ReaderEpochs class.
+  ---------------------------------------------------
+*/
+
+/**
+* Starts at epoch 0 with no readers.
+*/
+inline ReaderEpochs::ReaderEpochs() :
+    epoch_(0)
+{
+    for(size_t i = 0; i < READER_SLOTS; ++i){
+      slots_[i].active[0].store(0, std::memory_order_relaxed);
+      slots_[i].active[1].store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Pins the epoch current at entry: the reader counts itself in the slot
+* for that epoch, then checks the epoch did not move in the meantime
+* (if it did, the writer may already have looked at the slot, so it
+* starts over).
+*/
+inline std::atomic<size_t>* ReaderEpochs::enter() const
+{
+    ReaderSlot& slot = slots_[readerSlot()];
+    while(true){
+      uint64_t epoch = epoch_.load();
+      std::atomic<size_t>* pin = &slot.active[epoch & 1];
+      pin->fetch_add(1);
+      if(epoch_.load() == epoch){
+        return pin;
+      }
+      pin->fetch_sub(1, std::memory_order_release);
+    }
+}
+
+/**
+* Unpins the epoch enter() pinned.
+*/
+inline void ReaderEpochs::leave(std::atomic<size_t>* pin)
+{
+    pin->fetch_sub(1, std::memory_order_release);
+}
+
+/**
+* Returns true if no reader that pinned the epoch before the last
+* advance() is still inside.
+*/
+inline bool ReaderEpochs::previousDrained() const
+{
+    uint64_t previous = (epoch_.load(std::memory_order_relaxed) - 1) & 1;
+    for(size_t i = 0; i < READER_SLOTS; ++i){
+      if(slots_[i].active[previous].load() != 0){
+        return false;
+      }
+    }
+    return true;
+}
+
+/**
+* Moves to the next epoch. Readers arriving from now on cannot see
+* anything unlinked before the call. Only call once previousDrained().
+*/
+inline void ReaderEpochs::advance()
+{
+    epoch_.fetch_add(1);
+}
+
+/**
+* Returns the calling thread's reader slot.
+*/
+inline size_t ReaderEpochs::readerSlot()
+{
+    static thread_local size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % READER_SLOTS;
+    return slot;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ReaderEpochs class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <cstddef>
+#include <type_traits>
+#include "bst.h"
+
+/**
+* A node for a splay tree. A splay tree keeps no balance information at
+* all, so this is NodeBase with nothing added.
+*/
+template <typename Key, typename Value>
+class SplayNode : public NodeBase<Key, Value, SplayNode<Key, Value> >
+{
+public:
+    // Constructor.
+    SplayNode(const Key& key, const Value& value, SplayNode<Key, Value>* parent);
+    template<typename... Args>
+    SplayNode(std::in_place_t, SplayNode<Key, Value>* parent, Args&&... itemArgs);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the SplayNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor.
+*/
+template<class Key, class Value>
+SplayNode<Key, Value>::SplayNode(const Key& key, const Value& value, SplayNode<Key, Value>* parent) :
+    NodeBase<Key, Value, SplayNode<Key, Value> >(key, value, parent)
+{
+
+}
+
+/**
+* In-place constructor: itemArgs build the key/value pair directly inside
+* the node (see NodeBase).
+*/
+template<class Key, class Value>
+template<typename... Args>
+SplayNode<Key, Value>::SplayNode(std::in_place_t, SplayNode<Key, Value>* parent, Args&&... itemArgs) :
+    NodeBase<Key, Value, SplayNode<Key, Value> >(std::in_place, parent, std::forward<Args>(itemArgs)...)
+{
+
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the SplayNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* A self-adjusting splay tree. Every find, insert and remove rotates the
+* node it touched (for a remove, the removed node's parent; for a find
+* that misses, the last node looked at) up to the root, so recently used
+* keys sit near the top. No operation is O(log n) on its own, but any
+* sequence of them is O(log n) amortized, and on skewed access patterns,
+* where a few keys get most lookups, the hot keys stay within a level or
+* two of the root.
+*
+* Splaying turns every lookup into writes. Two options reduce that:
+* semi-splaying, which does one rotation instead of two per zig-zig step
+* and so only about halves the node's depth, and splaying on only every
+* Nth find. See setSplayPolicy. Inserts and removes always splay, since
+* they write anyway.
+*
+* Only find on a non-const tree splays; the other lookups (lower_bound,
+* operator[] and so on), and find on a const tree, are the plain
+* BinarySearchTree ones.
+*/
+template <class Key, class Value, class Compare = std::less<Key>, class Alloc = HeapNodeAllocator>
+class SplayTree : public BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >
+{
+public:
+    enum SplayMode { FULL_SPLAY, SEMI_SPLAY };
+
+    explicit SplayTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    SplayTree(InputIt first, InputIt last, bool sortFirst = false,
+              const Compare& comp = Compare());
+
+    // How far, and how often, find splays. every is clamped to at least 1.
+    void setSplayPolicy(SplayMode mode, unsigned every = 1);
+
+    // Splaying lookups; the const ones come from BinarySearchTree.
+    using BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >::find;
+    typename BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >::iterator
+    find(const Key& key);
+    template<typename K, typename C = Compare,
+             typename = typename std::enable_if<IsTransparent<C>::value>::type>
+    typename BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >::iterator
+    find(const K& key);
+protected:
+    virtual void removeNode(SplayNode<Key, Value>* current);
+    virtual void leafFix(SplayNode<Key, Value>* leaf);
+    virtual void hitFix(SplayNode<Key, Value>* node);
+    //Helper functions
+    template<typename K>
+    SplayNode<Key, Value>* splayFind(const K& key);
+    void splay(SplayNode<Key, Value>* current, SplayMode mode);
+    void rotateUp(SplayNode<Key, Value>* current);
+    void rotateRight(SplayNode<Key, Value>* current);
+    void rotateLeft(SplayNode<Key, Value>* current);
+
+    SplayMode mode_;        // how find splays; inserts and removes always splay fully
+    unsigned splayEvery_;   // find splays once in this many calls
+    unsigned findsLeft_;    // finds until the next splaying one
+};
+
+/**
+* Default constructor for an empty splay tree ordered by comp, which
+* fully splays on every access.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+SplayTree<Key, Value, Compare, Alloc>::SplayTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >(comp),
+    mode_(FULL_SPLAY),
+    splayEvery_(1),
+    findsLeft_(1)
+{
+
+}
+
+/**
+* Range constructor that bulk loads a balanced tree ordered by comp in
+* O(n), which the accesses then reshape.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+SplayTree<Key, Value, Compare, Alloc>::SplayTree(InputIt first, InputIt last, bool sortFirst,
+                                                 const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >(comp),
+    mode_(FULL_SPLAY),
+    splayEvery_(1),
+    findsLeft_(1)
+{
+    this->assign(first, last, sortFirst);
+}
+
+/**
+* Sets how find splays: fully or semi, and only on every every-th call.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::setSplayPolicy(SplayMode mode, unsigned every)
+{
+    mode_ = mode;
+    splayEvery_ = (every == 0) ? 1 : every;
+    findsLeft_ = splayEvery_;
+}
+
+/**
+* Looks up key and splays what it found, as set by setSplayPolicy.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >::iterator
+SplayTree<Key, Value, Compare, Alloc>::find(const Key& key)
+{
+    return this->iteratorAt(splayFind(key));
+}
+
+/**
+* Heterogeneous version of the above, for transparent comparators.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, SplayNode<Key, Value> >::iterator
+SplayTree<Key, Value, Compare, Alloc>::find(const K& key)
+{
+    return this->iteratorAt(splayFind(key));
+}
+
+/**
+* Descends to key, then splays the node holding it, or on a miss the last
+* node looked at, if this is a splaying find. Returns the node holding
+* key, or NULL.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K>
+SplayNode<Key, Value>* SplayTree<Key, Value, Compare, Alloc>::splayFind(const K& key)
+{
+    SplayNode<Key, Value>* current = this->root_;
+    SplayNode<Key, Value>* last = nullptr;
+    //Only read by TreeStats, so compiled away when it is off
+    size_t visited = 0;
+    size_t comparisons = 0;
+    while(current != nullptr){
+      ++visited;
+      last = current;
+      //One ordering decision per level, as in findInsertionPoint
+      int order = threeWayCompare(this->comp_, key, current->getKey());
+      comparisons += (UsesThreeWay<Compare, K, Key>::value || order < 0) ? 1 : 2;
+      if(order == 0){
+        break;
+      }
+      current = (order < 0) ? current->getLeft() : current->getRight();
+    }
+    TreeStats::countFind(visited, comparisons);
+
+    if(last != nullptr && --findsLeft_ == 0){
+      findsLeft_ = splayEvery_;
+      splay(last, mode_);
+    }
+    return current;
+}
+
+/**
+* Called by BinarySearchTree::insert once a new leaf is linked in; the
+* new item is the one accessed, so it goes to the root.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::leafFix(SplayNode<Key, Value>* leaf)
+{
+    splay(leaf, FULL_SPLAY);
+}
+
+/**
+* Called when an insert finds its key already there: that is an access
+* to the existing item, so it goes to the root too.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::hitFix(SplayNode<Key, Value>* node)
+{
+    splay(node, FULL_SPLAY);
+}
+
+/*
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ * BinarySearchTree::remove and erase find the node and call this; the
+ * removed node's parent is then splayed.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::removeNode(SplayNode<Key, Value>* current)
+{
+    this->beforeUnlink(current);
+    //two children
+    if(current->getLeft() != nullptr && current->getRight() != nullptr){
+      this->nodeSwap(current, this->predecessor(current));
+    }
+    SplayNode<Key, Value>* parent = current->getParent();
+    this->unlinkNode(current);
+    this->destroyNode(current);
+    if(parent != nullptr){
+      splay(parent, FULL_SPLAY);
+    }
+}
+
+/**
+* Rotates current up. A full splay goes all the way to the root, two
+* levels per step: zig-zig (current and its parent are children on the
+* same side) rotates the parent up and then current, zig-zag rotates
+* current up twice, and a final zig when the parent is the root.
+* A semi-splay does the zig-zig step with the one rotation of the parent
+* and carries on from the parent, so current only climbs about half way,
+* with about half the rotations.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::splay(SplayNode<Key, Value>* current, SplayMode mode)
+{
+    while(current->getParent() != nullptr){
+      SplayNode<Key, Value>* parent = current->getParent();
+      SplayNode<Key, Value>* grandp = parent->getParent();
+      //zig
+      if(grandp == nullptr){
+        rotateUp(current);
+        return;
+      }
+      //zig zig
+      if((grandp->getLeft() == parent) == (parent->getLeft() == current)){
+        rotateUp(parent);
+        if(mode == SEMI_SPLAY){
+          current = parent;
+          continue;
+        }
+        rotateUp(current);
+      }
+      //zig zag
+      else{
+        rotateUp(current);
+        rotateUp(current);
+      }
+    }
+}
+
+/**
+* Rotates current above its parent.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::rotateUp(SplayNode<Key, Value>* current)
+{
+    SplayNode<Key, Value>* parent = current->getParent();
+    if(parent->getLeft() == current){
+      rotateRight(parent);
+    }
+    else{
+      rotateLeft(parent);
+    }
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::rotateRight(SplayNode<Key, Value>* current){
+  TreeStats::countRotation();
+  SplayNode<Key, Value>* parent = current->getParent();
+  SplayNode<Key, Value>* LC = current->getLeft();
+  //has a parent
+  if(parent != nullptr){
+    if(parent->getLeft() == current){
+      parent->setLeft(LC);
+    }
+    else{
+      parent->setRight(LC);
+    }
+  }
+  else{
+    this->root_ = LC;
+  }
+  LC->setParent(parent);
+  current->setParent(LC);
+  SplayNode<Key, Value>* RC = LC->getRight();
+  if(RC != nullptr){
+    RC->setParent(current);
+  }
+  //readjust pointers
+  current->setLeft(RC);
+  LC->setRight(current);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::rotateLeft(SplayNode<Key, Value>* current){
+  TreeStats::countRotation();
+  SplayNode<Key, Value>* parent = current->getParent();
+  SplayNode<Key, Value>* RC = current->getRight();
+  //has parent
+  if(parent != nullptr){
+    if(parent->getRight() == current){
+      parent->setRight(RC);
+    }
+    else{
+      parent->setLeft(RC);
+    }
+  }
+  else{
+    this->root_ = RC;
+  }
+  RC->setParent(parent);
+  current->setParent(RC);
+  SplayNode<Key, Value>* LC = RC->getLeft();
+  if(LC != nullptr){
+    LC->setParent(current);
+  }
+  //readjust pointers
+  current->setRight(LC);
+  RC->setLeft(current);
+}
+
+#endif
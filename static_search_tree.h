@@ -0,0 +1,525 @@
+#ifndef STATIC_SEARCH_TREE_H
+#define STATIC_SEARCH_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "frozen_tree.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STATIC_SEARCH_TREE_X86 1
+#endif
+
+/**
+ * Maps an integral key onto the signed integer the search kernels compare.
+ * Keys up to 32 bits become int32_t and wider ones int64_t. Unsigned keys
+ * of the full lane width get their top bit flipped, which turns unsigned
+ * order into signed order, since SIMD only has a signed greater-than.
+ */
+template<typename Key>
+struct SearchLane
+{
+    static_assert(std::is_integral<Key>::value && !std::is_same<Key, bool>::value && sizeof(Key) <= 8,
+                  "StaticSearchTree needs an integral key of at most 64 bits");
+
+    typedef typename std::conditional<sizeof(Key) <= 4, int32_t, int64_t>::type type;
+    typedef typename std::make_unsigned<type>::type unsigned_type;
+
+    static type encode(Key key);
+};
+
+/**
+ * A read-only, SIMD-searchable index over integral keys (an "S+ tree").
+ *
+ * Nodes are one 64-byte cache line of sorted keys: 16 for 32-bit lanes or
+ * 8 for 64-bit lanes, which is two AVX2 registers. The bottom layer is
+ * simply every key in sorted order, padded to whole nodes. Each layer above
+ * it gives every node NODE_KEYS + 1 children, with key j being the smallest
+ * key under child j + 1, so all layers sit in one array and a child is
+ * found by arithmetic instead of a pointer.
+ *
+ * A lookup reads one node per layer. At each node a vector compare of the
+ * key against all lanes, plus a movemask, gives the number of keys below it,
+ * and that count picks the child. There are no per-key branches. The
+ * kernel is picked when the index is built: AVX2 if the CPU has it,
+ * otherwise SSE2 for 32-bit lanes on x86, otherwise a scalar loop. Every
+ * kernel reads the same layout.
+ *
+ * Keys are ordered ascending, as with std::less. Like FrozenTree, the
+ * index is a snapshot and does not follow later changes to its source.
+ */
+template<typename Key, typename Value>
+class StaticSearchTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+    // An index is immutable, so iterator and const_iterator are the same
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+    typedef typename SearchLane<Key>::type Lane;
+
+    // Keys per node: one cache line
+    static const size_t NODE_KEYS = 64 / sizeof(Lane);
+
+    explicit StaticSearchTree(bool allowSimd = true);
+    template<typename InputIt>
+    StaticSearchTree(InputIt first, InputIt last, bool allowSimd = true);
+
+    bool empty() const;
+    size_t size() const;
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+
+    // Name of the node search kernel in use: "avx2", "sse2" or "scalar".
+    const char* kernel() const;
+
+protected:
+    enum Kernel { SCALAR, SSE2, AVX2 };
+
+    size_t lowerBoundIndex(Lane x) const;
+    template<typename RankFn>
+    size_t descend(Lane x, RankFn rank) const;
+#ifdef STATIC_SEARCH_TREE_X86
+    __attribute__((target("avx2"))) size_t descendAvx2(Lane x) const;
+#endif
+    static unsigned rankScalar(const Lane* node, Lane x);
+#ifdef __SSE2__
+    static unsigned rankSse2(const Lane* node, Lane x);
+#endif
+    static Kernel pickKernel(bool allowSimd);
+
+protected:
+    std::vector<value_type> items_;                         // sorted by key
+    std::vector<Lane, CacheAlignedAllocator<Lane> > keys_;  // every layer, bottom first
+    std::vector<size_t> layers_;                            // start of each layer in keys_
+    Kernel kernel_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the SearchLane class.
+  ---------------------------------------------------
+*/
+
+/**
+* Converts a key to its lane value; the conversion preserves order.
+*/
+template<typename Key>
+typename SearchLane<Key>::type SearchLane<Key>::encode(Key key)
+{
+    if constexpr (std::is_unsigned<Key>::value && sizeof(Key) == sizeof(type)){
+      const unsigned_type topBit = unsigned_type(1) << (8 * sizeof(type) - 1);
+      return static_cast<type>(static_cast<unsigned_type>(key) ^ topBit);
+    }
+    else{
+      return static_cast<type>(key);
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the SearchLane class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the StaticSearchTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Creates an empty index.
+*/
+template<typename Key, typename Value>
+StaticSearchTree<Key, Value>::StaticSearchTree(bool allowSimd) :
+    kernel_(pickKernel(allowSimd))
+{
+
+}
+
+/**
+* Builds the index from the items in [first, last), which must be sorted
+* ascending with no key repeated (a tree's begin()/end() always are). O(n).
+* Throws std::invalid_argument otherwise. With allowSimd false the scalar
+* kernel is used even if the CPU could do better, which is handy for
+* comparing them.
+*/
+template<typename Key, typename Value>
+template<typename InputIt>
+StaticSearchTree<Key, Value>::StaticSearchTree(InputIt first, InputIt last, bool allowSimd) :
+    items_(first, last),
+    kernel_(pickKernel(allowSimd))
+{
+    const size_t n = items_.size();
+    for(size_t i = 1; i < n; ++i){
+      if(!(items_[i-1].first < items_[i].first)){
+        throw std::invalid_argument("StaticSearchTree: range is not sorted by key");
+      }
+    }
+    if(n == 0){
+      return;
+    }
+
+    // Layer sizes in keys, always whole nodes. A layer of m nodes needs
+    // ceil(m / (NODE_KEYS + 1)) parent nodes; stop once a layer is one node.
+    std::vector<size_t> layerKeys(1, (n + NODE_KEYS - 1) / NODE_KEYS * NODE_KEYS);
+    while(layerKeys.back() > NODE_KEYS){
+      size_t nodes = layerKeys.back() / NODE_KEYS;
+      layerKeys.push_back((nodes + NODE_KEYS) / (NODE_KEYS + 1) * NODE_KEYS);
+    }
+    size_t total = 0;
+    for(size_t h = 0; h < layerKeys.size(); ++h){
+      layers_.push_back(total);
+      total += layerKeys[h];
+    }
+
+    // padding holds the largest lane value, so no search ever counts it
+    const Lane pad = std::numeric_limits<Lane>::max();
+    keys_.assign(total, pad);
+    for(size_t i = 0; i < n; ++i){
+      keys_[i] = SearchLane<Key>::encode(items_[i].first);
+    }
+    for(size_t h = 1; h < layerKeys.size(); ++h){
+      for(size_t i = 0; i < layerKeys[h]; ++i){
+        // key j of a node is the smallest key under child j+1: step to
+        // that child, then always to the leftmost child down to the bottom
+        size_t node = (i / NODE_KEYS) * (NODE_KEYS + 1) + i % NODE_KEYS + 1;
+        for(size_t down = 1; down < h; ++down){
+          node *= NODE_KEYS + 1;
+        }
+        keys_[layers_[h] + i] = (node * NODE_KEYS < n) ? keys_[node * NODE_KEYS] : pad;
+      }
+    }
+}
+
+/**
+* Chooses the best kernel this CPU can run.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::Kernel
+StaticSearchTree<Key, Value>::pickKernel(bool allowSimd)
+{
+    if(!allowSimd){
+      return SCALAR;
+    }
+#ifdef STATIC_SEARCH_TREE_X86
+    if(__builtin_cpu_supports("avx2")){
+      return AVX2;
+    }
+#endif
+#ifdef __SSE2__
+    if(sizeof(Lane) == 4){
+      return SSE2;
+    }
+#endif
+    return SCALAR;
+}
+
+/**
+* Returns true if the index holds no items.
+*/
+template<typename Key, typename Value>
+bool StaticSearchTree<Key, Value>::empty() const
+{
+    return items_.empty();
+}
+
+/**
+* Returns the number of items.
+*/
+template<typename Key, typename Value>
+size_t StaticSearchTree<Key, Value>::size() const
+{
+    return items_.size();
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::iterator
+StaticSearchTree<Key, Value>::begin() const
+{
+    return items_.begin();
+}
+
+/**
+* Returns the iterator past the last item.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::iterator
+StaticSearchTree<Key, Value>::end() const
+{
+    return items_.end();
+}
+
+/**
+* Same as begin().
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::const_iterator
+StaticSearchTree<Key, Value>::cbegin() const
+{
+    return items_.begin();
+}
+
+/**
+* Same as end().
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::const_iterator
+StaticSearchTree<Key, Value>::cend() const
+{
+    return items_.end();
+}
+
+/**
+* Returns a reverse iterator to the largest item.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::reverse_iterator
+StaticSearchTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator one before the smallest item.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::reverse_iterator
+StaticSearchTree<Key, Value>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Same as rbegin().
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::const_reverse_iterator
+StaticSearchTree<Key, Value>::crbegin() const
+{
+    return rbegin();
+}
+
+/**
+* Same as rend().
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::const_reverse_iterator
+StaticSearchTree<Key, Value>::crend() const
+{
+    return rend();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::iterator
+StaticSearchTree<Key, Value>::find(const Key& key) const
+{
+    Lane x = SearchLane<Key>::encode(key);
+    size_t index = lowerBoundIndex(x);
+    if(index >= items_.size() || keys_[index] != x){
+      return end();
+    }
+    return items_.begin() + index;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::iterator
+StaticSearchTree<Key, Value>::lower_bound(const Key& key) const
+{
+    size_t index = lowerBoundIndex(SearchLane<Key>::encode(key));
+    return index >= items_.size() ? end() : items_.begin() + index;
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key.
+* Lanes are integers, so that is the lower bound of the next lane value.
+*/
+template<typename Key, typename Value>
+typename StaticSearchTree<Key, Value>::iterator
+StaticSearchTree<Key, Value>::upper_bound(const Key& key) const
+{
+    Lane x = SearchLane<Key>::encode(key);
+    if(x == std::numeric_limits<Lane>::max()){
+      return end();
+    }
+    size_t index = lowerBoundIndex(x + 1);
+    return index >= items_.size() ? end() : items_.begin() + index;
+}
+
+/**
+* Returns the name of the kernel picked at construction.
+*/
+template<typename Key, typename Value>
+const char* StaticSearchTree<Key, Value>::kernel() const
+{
+    switch(kernel_){
+      case AVX2: return "avx2";
+      case SSE2: return "sse2";
+      default: return "scalar";
+    }
+}
+
+/**
+* Returns the position in the bottom layer (which is also the position in
+* items_) of the first key not less than x. A result of size() or more
+* means there is none.
+*/
+template<typename Key, typename Value>
+size_t StaticSearchTree<Key, Value>::lowerBoundIndex(Lane x) const
+{
+    if(items_.empty()){
+      return 0;
+    }
+#ifdef STATIC_SEARCH_TREE_X86
+    if(kernel_ == AVX2){
+      return descendAvx2(x);
+    }
+#endif
+#ifdef __SSE2__
+    if(kernel_ == SSE2){
+      return descend(x, rankSse2);
+    }
+#endif
+    return descend(x, rankScalar);
+}
+
+/**
+* Walks from the root node to the bottom layer, one node per layer, using
+* rank(node, x) to count the node's keys below x. If every key in the
+* chosen bottom node is below x, the answer is the first key of the next
+* node, which is right after it in the bottom layer.
+*/
+template<typename Key, typename Value>
+template<typename RankFn>
+size_t StaticSearchTree<Key, Value>::descend(Lane x, RankFn rank) const
+{
+    const Lane* keys = keys_.data();
+    size_t k = 0;
+    for(size_t h = layers_.size() - 1; h > 0; --h){
+      unsigned i = rank(keys + layers_[h] + k, x);
+      k = k * (NODE_KEYS + 1) + i * NODE_KEYS;
+    }
+    return k + rank(keys + k, x);
+}
+
+/**
+* descend() with the AVX2 kernel written inline, since it has to be
+* compiled for AVX2 as a whole. The keys in a node are sorted, so the keys
+* below x form a prefix and the count is the number of trailing ones in the
+* compare mask.
+*/
+#ifdef STATIC_SEARCH_TREE_X86
+template<typename Key, typename Value>
+__attribute__((target("avx2")))
+size_t StaticSearchTree<Key, Value>::descendAvx2(Lane x) const
+{
+    const Lane* keys = keys_.data();
+    __m256i xs;
+    if constexpr (sizeof(Lane) == 4){
+      xs = _mm256_set1_epi32(x);
+    }
+    else{
+      xs = _mm256_set1_epi64x(x);
+    }
+
+    size_t k = 0;
+    for(size_t h = layers_.size(); h-- > 0; ){
+      const __m256i* node = reinterpret_cast<const __m256i*>(keys + layers_[h] + k);
+      unsigned mask;
+      if constexpr (sizeof(Lane) == 4){
+        __m256i lo = _mm256_cmpgt_epi32(xs, _mm256_load_si256(node));
+        __m256i hi = _mm256_cmpgt_epi32(xs, _mm256_load_si256(node + 1));
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(lo))
+             | (_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8);
+      }
+      else{
+        __m256i lo = _mm256_cmpgt_epi64(xs, _mm256_load_si256(node));
+        __m256i hi = _mm256_cmpgt_epi64(xs, _mm256_load_si256(node + 1));
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo))
+             | (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+      }
+      unsigned i = __builtin_ctz(~mask);
+      if(h == 0){
+        return k + i;
+      }
+      k = k * (NODE_KEYS + 1) + i * NODE_KEYS;
+    }
+    return k;
+}
+#endif
+
+/**
+* Counts the keys in a node that are below x, one compare per key but no
+* branches.
+*/
+template<typename Key, typename Value>
+unsigned StaticSearchTree<Key, Value>::rankScalar(const Lane* node, Lane x)
+{
+    unsigned count = 0;
+    for(size_t i = 0; i < NODE_KEYS; ++i){
+      count += (node[i] < x) ? 1 : 0;
+    }
+    return count;
+}
+
+/**
+* SSE2 kernel for 32-bit lanes: four compares of four keys each. SSE2 has
+* no 64-bit compare, so 64-bit lanes never use it.
+*/
+#ifdef __SSE2__
+template<typename Key, typename Value>
+unsigned StaticSearchTree<Key, Value>::rankSse2(const Lane* node, Lane x)
+{
+    if constexpr (sizeof(Lane) == 4){
+      const __m128i xs = _mm_set1_epi32(x);
+      const __m128i* lanes = reinterpret_cast<const __m128i*>(node);
+      unsigned mask = 0;
+      for(int part = 0; part < 4; ++part){
+        __m128i gt = _mm_cmpgt_epi32(xs, _mm_load_si128(lanes + part));
+        mask |= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(gt))) << (4 * part);
+      }
+      return __builtin_ctz(~mask);
+    }
+    else{
+      return rankScalar(node, x);
+    }
+}
+#endif
+
+/*
+  -------------------------------------------------
+  End implementations for the StaticSearchTree class.
+  -------------------------------------------------
+*/
+
+#endif
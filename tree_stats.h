@@ -0,0 +1,362 @@
+#ifndef TREE_STATS_H
+#define TREE_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Hot-path counters for the trees, to tell whether a slow tree is
+ * comparing, descending, rotating or allocating too much.
+ *
+ * The counters are only compiled in with -DBST_STATS (see DEFS in the
+ * Makefile). Without it every hook below is an empty inline function,
+ * so the trees compile to the same code as if they were not there.
+ *
+ * With it, each thread counts into a block of its own, so counting never
+ * makes threads share a cache line. snapshot() adds up the blocks of
+ * every thread, including threads that have exited, so it can be scraped
+ * from any thread. reset() does not touch the counters: it records the
+ * current totals as a baseline, which later snapshots subtract, so a
+ * reset racing with counting loses nothing.
+ *
+ * Fix depth is kept as a count of top-level fixes and of fix steps
+ * (calls, recursive ones included); steps / fixes is the mean depth.
+ */
+class TreeStats
+{
+public:
+    struct Snapshot
+    {
+        uint64_t finds;             // internalFind calls
+        uint64_t findNodesVisited;
+        uint64_t findComparisons;   // key comparisons made by internalFind
+        uint64_t rotations;         // single rotations; a double one counts 2
+        uint64_t insertFixes;       // top-level insertFix calls
+        uint64_t insertFixSteps;    // insertFix calls, recursive ones included
+        uint64_t removeFixes;
+        uint64_t removeFixSteps;
+        uint64_t allocations;       // nodes created
+        uint64_t deallocations;     // nodes destroyed one by one; a bulk
+                                    // release() by the pool is not counted
+    };
+
+#ifdef BST_STATS
+    static const bool enabled = true;
+#else
+    static const bool enabled = false;
+#endif
+
+    // Totals over all threads since the last reset(); all zero when
+    // the counters are compiled out.
+    static Snapshot snapshot();
+    static void reset();
+
+    // Hooks called by the trees.
+    static void countFind(size_t nodesVisited, size_t comparisons);
+    static void countRotation();
+    static void countAllocation();
+    static void countDeallocation();
+
+    // Counts one insertFix or removeFix step for its lifetime, and a
+    // top-level fix when it is the outermost one on this thread.
+    enum FixKind { INSERT_FIX, REMOVE_FIX };
+    class FixScope
+    {
+    public:
+        explicit FixScope(FixKind kind);
+        ~FixScope();
+    private:
+        FixScope(const FixScope&);
+        FixScope& operator=(const FixScope&);
+#ifdef BST_STATS
+        FixKind kind_;
+#endif
+    };
+
+private:
+    enum Counter
+    {
+        FINDS, FIND_NODES_VISITED, FIND_COMPARISONS, ROTATIONS,
+        INSERT_FIXES, INSERT_FIX_STEPS, REMOVE_FIXES, REMOVE_FIX_STEPS,
+        ALLOCATIONS, DEALLOCATIONS, COUNTER_COUNT
+    };
+
+#ifdef BST_STATS
+    // One thread's counters. Only the owner writes them, so an increment
+    // is a relaxed load and store, not a locked read-modify-write.
+    struct ThreadCounters
+    {
+        ThreadCounters();
+        ~ThreadCounters();
+        void add(Counter counter, uint64_t amount);
+
+        std::atomic<uint64_t> values[COUNTER_COUNT];
+        unsigned fixDepth[2];
+        ThreadCounters* next;
+        ThreadCounters* prev;
+    };
+
+    struct Registry
+    {
+        std::mutex lock;
+        ThreadCounters* live;
+        uint64_t exited[COUNTER_COUNT];     // totals of threads that have exited
+        uint64_t baseline[COUNTER_COUNT];   // totals at the last reset()
+    };
+
+    static Registry& registry();
+    static ThreadCounters& local();
+    static void totals(Registry& registry, uint64_t* sums);
+#endif
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the TreeStats class.
+  ---------------------------------------------------
+*/
+
+#ifdef BST_STATS
+
+/**
+* Adds the calling thread's block to the registry.
+*/
+inline TreeStats::ThreadCounters::ThreadCounters() :
+    next(nullptr),
+    prev(nullptr)
+{
+    for(int i = 0; i < COUNTER_COUNT; ++i){
+      values[i].store(0, std::memory_order_relaxed);
+    }
+    fixDepth[INSERT_FIX] = 0;
+    fixDepth[REMOVE_FIX] = 0;
+
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+    next = reg.live;
+    if(next != nullptr){
+      next->prev = this;
+    }
+    reg.live = this;
+}
+
+/**
+* Folds the exiting thread's counts into the registry's totals and
+* removes its block.
+*/
+inline TreeStats::ThreadCounters::~ThreadCounters()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+    for(int i = 0; i < COUNTER_COUNT; ++i){
+      reg.exited[i] += values[i].load(std::memory_order_relaxed);
+    }
+    if(prev != nullptr){
+      prev->next = next;
+    }
+    else{
+      reg.live = next;
+    }
+    if(next != nullptr){
+      next->prev = prev;
+    }
+}
+
+/**
+* Bumps one counter; only ever called by the owning thread.
+*/
+inline void TreeStats::ThreadCounters::add(Counter counter, uint64_t amount)
+{
+    std::atomic<uint64_t>& value = values[counter];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/**
+* The registry is never destroyed: threads (the WorkPool's, say) may
+* still exit, and fold their counts in, during static destruction.
+*/
+inline TreeStats::Registry& TreeStats::registry()
+{
+    static Registry* reg = new Registry();
+    return *reg;
+}
+
+/**
+* Returns the calling thread's block, registering it on first use.
+*/
+inline TreeStats::ThreadCounters& TreeStats::local()
+{
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+/**
+* Sums every live block and the exited threads' totals into sums. The
+* caller holds the registry lock.
+*/
+inline void TreeStats::totals(Registry& reg, uint64_t* sums)
+{
+    for(int i = 0; i < COUNTER_COUNT; ++i){
+      sums[i] = reg.exited[i];
+    }
+    for(ThreadCounters* block = reg.live; block != nullptr; block = block->next){
+      for(int i = 0; i < COUNTER_COUNT; ++i){
+        sums[i] += block->values[i].load(std::memory_order_relaxed);
+      }
+    }
+}
+
+/**
+* Counts since the last reset(), summed over all threads.
+*/
+inline TreeStats::Snapshot TreeStats::snapshot()
+{
+    uint64_t sums[COUNTER_COUNT];
+    Registry& reg = registry();
+    {
+      std::lock_guard<std::mutex> lock(reg.lock);
+      totals(reg, sums);
+      for(int i = 0; i < COUNTER_COUNT; ++i){
+        sums[i] -= reg.baseline[i];
+      }
+    }
+
+    Snapshot result;
+    result.finds = sums[FINDS];
+    result.findNodesVisited = sums[FIND_NODES_VISITED];
+    result.findComparisons = sums[FIND_COMPARISONS];
+    result.rotations = sums[ROTATIONS];
+    result.insertFixes = sums[INSERT_FIXES];
+    result.insertFixSteps = sums[INSERT_FIX_STEPS];
+    result.removeFixes = sums[REMOVE_FIXES];
+    result.removeFixSteps = sums[REMOVE_FIX_STEPS];
+    result.allocations = sums[ALLOCATIONS];
+    result.deallocations = sums[DEALLOCATIONS];
+    return result;
+}
+
+/**
+* Starts counting from zero again by moving the baseline up to the
+* current totals.
+*/
+inline void TreeStats::reset()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+    totals(reg, reg.baseline);
+}
+
+/**
+* Records one internalFind.
+*/
+inline void TreeStats::countFind(size_t nodesVisited, size_t comparisons)
+{
+    ThreadCounters& counters = local();
+    counters.add(FINDS, 1);
+    counters.add(FIND_NODES_VISITED, nodesVisited);
+    counters.add(FIND_COMPARISONS, comparisons);
+}
+
+/**
+* Records one single rotation.
+*/
+inline void TreeStats::countRotation()
+{
+    local().add(ROTATIONS, 1);
+}
+
+/**
+* Records one node created.
+*/
+inline void TreeStats::countAllocation()
+{
+    local().add(ALLOCATIONS, 1);
+}
+
+/**
+* Records one node destroyed.
+*/
+inline void TreeStats::countDeallocation()
+{
+    local().add(DEALLOCATIONS, 1);
+}
+
+/**
+* Counts a step, and a fix if no fix of this kind is already running on
+* this thread.
+*/
+inline TreeStats::FixScope::FixScope(FixKind kind) :
+    kind_(kind)
+{
+    ThreadCounters& counters = local();
+    if(counters.fixDepth[kind]++ == 0){
+      counters.add(kind == INSERT_FIX ? INSERT_FIXES : REMOVE_FIXES, 1);
+    }
+    counters.add(kind == INSERT_FIX ? INSERT_FIX_STEPS : REMOVE_FIX_STEPS, 1);
+}
+
+/**
+* Leaves the step.
+*/
+inline TreeStats::FixScope::~FixScope()
+{
+    --local().fixDepth[kind_];
+}
+
+#else
+
+/**
+* Counters are compiled out: always all zero.
+*/
+inline TreeStats::Snapshot TreeStats::snapshot()
+{
+    Snapshot result = Snapshot();
+    return result;
+}
+
+inline void TreeStats::reset()
+{
+
+}
+
+inline void TreeStats::countFind(size_t nodesVisited, size_t comparisons)
+{
+
+}
+
+inline void TreeStats::countRotation()
+{
+
+}
+
+inline void TreeStats::countAllocation()
+{
+
+}
+
+inline void TreeStats::countDeallocation()
+{
+
+}
+
+inline TreeStats::FixScope::FixScope(FixKind kind)
+{
+
+}
+
+inline TreeStats::FixScope::~FixScope()
+{
+
+}
+
+#endif
+
+/*
+  -------------------------------------------------
+  End implementations for the TreeStats class.
+  -------------------------------------------------
+*/
+
+#endif
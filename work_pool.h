@@ -0,0 +1,442 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A small work-stealing thread pool for fork-join recursion, used by the
+ * trees' parallel operations.
+ *
+ * invoke(left, right) puts right on the calling thread's deque, runs left
+ * itself, then takes right back and runs it too, unless another thread
+ * stole it in the meantime. Each thread pops its own newest task from the
+ * back of its deque, while idle threads steal the oldest task from the
+ * front of someone else's. In a divide-and-conquer recursion the oldest
+ * task is the biggest subproblem, so one steal hands over a lot of work
+ * and steals stay rare. A thread whose task was stolen runs other tasks
+ * while it waits rather than blocking, so nested invokes cannot deadlock.
+ *
+ * The deques are guarded by a mutex each instead of being lock-free:
+ * callers stop forking below a grain size, so a task is thousands of
+ * node visits and a lock per push or steal does not show.
+ */
+class WorkPool
+{
+public:
+    // threads is the total number of threads that work on the pool's
+    // tasks, counting the caller of invoke; 0 means one per hardware
+    // thread. A pool of one thread runs everything inline.
+    explicit WorkPool(unsigned threads = 0);
+    ~WorkPool();
+
+    // The pool shared by all trees, started on first use.
+    static WorkPool& shared();
+
+    unsigned threads() const;
+
+    // Runs left() and right(), possibly in parallel, and returns once both
+    // have finished. If either throws, the exception is rethrown here
+    // (left's first) after both have finished.
+    template<typename F, typename G>
+    void invoke(F&& left, G&& right);
+
+private:
+    WorkPool(const WorkPool&);
+    WorkPool& operator=(const WorkPool&);
+
+    struct Task
+    {
+        void (*run)(void*);
+        void* callable;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    struct alignas(64) TaskDeque
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    void push(Task* task);
+    bool takeBack(Task* task);
+    bool runOne();
+    Task* popOwn();
+    Task* steal();
+    void workerLoop(unsigned index);
+    unsigned ownDeque() const;
+    static void execute(Task* task);
+
+    // The deque of the current thread, if it is one of this pool's workers.
+    struct Membership
+    {
+        const WorkPool* pool;
+        unsigned index;
+    };
+    static Membership& membership();
+
+    // One deque per worker, and a last one shared by every outside thread.
+    std::unique_ptr<TaskDeque[]> deques_;
+    unsigned dequeCount_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    bool stopping_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the WorkPool class.
+  ---------------------------------------------------
+*/
+
+/**
+* Starts threads - 1 workers; the thread calling invoke is the last one.
+*/
+inline WorkPool::WorkPool(unsigned threads) :
+    dequeCount_(0),
+    queued_(0),
+    stopping_(false)
+{
+    if(threads == 0){
+      threads = std::thread::hardware_concurrency();
+    }
+    if(threads == 0){
+      threads = 1;
+    }
+    dequeCount_ = threads;
+    deques_.reset(new TaskDeque[dequeCount_]);
+    for(unsigned i = 0; i + 1 < threads; ++i){
+      workers_.push_back(std::thread(&WorkPool::workerLoop, this, i));
+    }
+}
+
+/**
+* Stops and joins the workers. No invoke may still be running.
+*/
+inline WorkPool::~WorkPool()
+{
+    {
+      std::lock_guard<std::mutex> lock(sleepLock_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for(size_t i = 0; i < workers_.size(); ++i){
+      workers_[i].join();
+    }
+}
+
+/**
+* Returns the process-wide pool, sized to the hardware.
+*/
+inline WorkPool& WorkPool::shared()
+{
+    static WorkPool pool;
+    return pool;
+}
+
+/**
+* Returns the number of threads working on tasks, the caller included.
+*/
+inline unsigned WorkPool::threads() const
+{
+    return static_cast<unsigned>(workers_.size()) + 1;
+}
+
+/**
+* The task for right lives in this stack frame, which is safe because the
+* frame does not return until the task is done.
+*/
+template<typename F, typename G>
+void WorkPool::invoke(F&& left, G&& right)
+{
+    if(workers_.empty()){
+      left();
+      right();
+      return;
+    }
+
+    typedef typename std::remove_reference<G>::type RightType;
+    Task task;
+    task.run = [](void* callable){ (*static_cast<RightType*>(callable))(); };
+    task.callable = const_cast<void*>(static_cast<const void*>(std::addressof(right)));
+    task.done.store(false, std::memory_order_relaxed);
+    push(&task);
+
+    std::exception_ptr leftError;
+    try{
+      left();
+    }
+    catch(...){
+      leftError = std::current_exception();
+    }
+
+    if(takeBack(&task)){
+      execute(&task);
+    }
+    else{
+      //Stolen: keep busy until the thief finishes it
+      while(!task.done.load(std::memory_order_acquire)){
+        if(!runOne()){
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    if(leftError){
+      std::rethrow_exception(leftError);
+    }
+    if(task.error){
+      std::rethrow_exception(task.error);
+    }
+}
+
+/**
+* Pushes task on the current thread's deque and wakes a worker to steal
+* it. Taking sleepLock_ after counting the task means a worker deciding
+* to sleep either sees the count or gets the notification.
+*/
+inline void WorkPool::push(Task* task)
+{
+    TaskDeque& deque = deques_[ownDeque()];
+    {
+      std::lock_guard<std::mutex> lock(deque.lock);
+      deque.tasks.push_back(task);
+    }
+    queued_.fetch_add(1);
+    {
+      std::lock_guard<std::mutex> lock(sleepLock_);
+    }
+    wake_.notify_one();
+}
+
+/**
+* Removes task from the back of the current thread's deque if it is
+* still there. Anything pushed after it by the same thread has been taken
+* back or finished by now, so it can only be at the back or gone.
+*/
+inline bool WorkPool::takeBack(Task* task)
+{
+    TaskDeque& deque = deques_[ownDeque()];
+    std::lock_guard<std::mutex> lock(deque.lock);
+    if(deque.tasks.empty() || deque.tasks.back() != task){
+      return false;
+    }
+    deque.tasks.pop_back();
+    queued_.fetch_sub(1);
+    return true;
+}
+
+/**
+* Runs one queued task, the current thread's own newest if it has one,
+* otherwise one stolen from another deque. Returns false if there was
+* nothing to run.
+*/
+inline bool WorkPool::runOne()
+{
+    Task* task = popOwn();
+    if(task == nullptr){
+      task = steal();
+    }
+    if(task == nullptr){
+      return false;
+    }
+    execute(task);
+    return true;
+}
+
+/**
+* Takes the newest task from the current thread's deque.
+*/
+inline WorkPool::Task* WorkPool::popOwn()
+{
+    TaskDeque& deque = deques_[ownDeque()];
+    std::lock_guard<std::mutex> lock(deque.lock);
+    if(deque.tasks.empty()){
+      return nullptr;
+    }
+    Task* task = deque.tasks.back();
+    deque.tasks.pop_back();
+    queued_.fetch_sub(1);
+    return task;
+}
+
+/**
+* Takes the oldest task from the first other deque that has one,
+* starting after the current thread's own.
+*/
+inline WorkPool::Task* WorkPool::steal()
+{
+    unsigned self = ownDeque();
+    for(unsigned i = 1; i < dequeCount_; ++i){
+      TaskDeque& deque = deques_[(self + i) % dequeCount_];
+      std::lock_guard<std::mutex> lock(deque.lock);
+      if(!deque.tasks.empty()){
+        Task* task = deque.tasks.front();
+        deque.tasks.pop_front();
+        queued_.fetch_sub(1);
+        return task;
+      }
+    }
+    return nullptr;
+}
+
+/**
+* A worker runs tasks while there are any and sleeps when there are none.
+*/
+inline void WorkPool::workerLoop(unsigned index)
+{
+    membership().pool = this;
+    membership().index = index;
+    while(true){
+      if(runOne()){
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepLock_);
+      if(stopping_){
+        return;
+      }
+      if(queued_.load() == 0){
+        wake_.wait(lock);
+      }
+    }
+}
+
+/**
+* Returns the index of the current thread's deque: its own for a worker,
+* the shared last one for anybody else.
+*/
+inline unsigned WorkPool::ownDeque() const
+{
+    const Membership& member = membership();
+    return (member.pool == this) ? member.index : dequeCount_ - 1;
+}
+
+/**
+* Runs task, keeping any exception for invoke to rethrow, and marks it
+* done.
+*/
+inline void WorkPool::execute(Task* task)
+{
+    try{
+      task->run(task->callable);
+    }
+    catch(...){
+      task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+/**
+* Returns the current thread's pool membership.
+*/
+inline WorkPool::Membership& WorkPool::membership()
+{
+    static thread_local Membership member = { nullptr, 0 };
+    return member;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the WorkPool class.
+  -------------------------------------------------
+*/
+
+/**
+ * Parallel algorithms built on WorkPool.
+ */
+
+// Inputs below this many items are sorted or merged by one thread.
+static const size_t PARALLEL_SORT_GRAIN = 1 << 14;
+
+/**
+* Merges the sorted runs [a, aEnd) and [b, bEnd) into out, moving the
+* items. Stable: on equal keys everything from a comes first. The larger
+* run's middle item is placed directly, by binary search in the other
+* run, and the two sides of it are merged in parallel.
+*/
+template<typename T, typename Compare>
+void parallelMerge(T* a, T* aEnd, T* b, T* bEnd, T* out, Compare comp, WorkPool& pool)
+{
+    size_t aCount = aEnd - a;
+    size_t bCount = bEnd - b;
+    if(aCount + bCount <= PARALLEL_SORT_GRAIN){
+      std::merge(std::make_move_iterator(a), std::make_move_iterator(aEnd),
+                 std::make_move_iterator(b), std::make_move_iterator(bEnd), out, comp);
+      return;
+    }
+    T* aSplit;
+    T* bSplit;
+    if(aCount >= bCount){
+      //b's items equal to the pivot belong after it
+      aSplit = a + aCount / 2;
+      bSplit = std::lower_bound(b, bEnd, *aSplit, comp);
+      T* pivot = out + (aSplit - a) + (bSplit - b);
+      *pivot = std::move(*aSplit);
+      pool.invoke([&](){ parallelMerge(a, aSplit, b, bSplit, out, comp, pool); },
+                  [&](){ parallelMerge(aSplit + 1, aEnd, bSplit, bEnd, pivot + 1, comp, pool); });
+    }
+    else{
+      //a's items equal to the pivot belong before it
+      bSplit = b + bCount / 2;
+      aSplit = std::upper_bound(a, aEnd, *bSplit, comp);
+      T* pivot = out + (aSplit - a) + (bSplit - b);
+      *pivot = std::move(*bSplit);
+      pool.invoke([&](){ parallelMerge(a, aSplit, b, bSplit, out, comp, pool); },
+                  [&](){ parallelMerge(aSplit, aEnd, bSplit + 1, bEnd, pivot + 1, comp, pool); });
+    }
+}
+
+/**
+* Merge sorts src[0, count) using scratch[0, count) as the other buffer,
+* leaving the result in scratch if intoScratch, else in src. The halves
+* are sorted in parallel into the buffer the merge reads from.
+*/
+template<typename T, typename Compare>
+void parallelSortRuns(T* src, T* scratch, size_t count, bool intoScratch, Compare comp, WorkPool& pool)
+{
+    if(count <= PARALLEL_SORT_GRAIN){
+      std::stable_sort(src, src + count, comp);
+      if(intoScratch){
+        std::move(src, src + count, scratch);
+      }
+      return;
+    }
+    size_t mid = count / 2;
+    pool.invoke([&](){ parallelSortRuns(src, scratch, mid, !intoScratch, comp, pool); },
+                [&](){ parallelSortRuns(src + mid, scratch + mid, count - mid, !intoScratch, comp, pool); });
+    T* from = intoScratch ? src : scratch;
+    T* to = intoScratch ? scratch : src;
+    parallelMerge(from, from + mid, from + mid, from + count, to, comp, pool);
+}
+
+/**
+* Sorts items stably on every thread of pool. Merge sort, with the
+* merges themselves split up so that the last ones do not run on a
+* single core. Needs a scratch buffer as big as the input, which is
+* filled by moving the items out, so T only has to be movable.
+*/
+template<typename T, typename Compare>
+void parallelStableSort(std::vector<T>& items, Compare comp, WorkPool& pool = WorkPool::shared())
+{
+    if(pool.threads() == 1 || items.size() <= PARALLEL_SORT_GRAIN){
+      std::stable_sort(items.begin(), items.end(), comp);
+      return;
+    }
+    std::vector<T> scratch(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+    parallelSortRuns(scratch.data(), items.data(), items.size(), true, comp, pool);
+}
+
+#endif